@@ -0,0 +1,453 @@
+import Audio;
+import Emulator;
+import Input;
+import Resampler;
+import SyntheticCore;
+import Types;
+import Video;
+import VideoFilters;
+
+import <SDL.h>;
+
+import <algorithm>;
+import <array>;
+import <chrono>;
+import <cmath>;
+import <format>;
+import <fstream>;
+import <functional>;
+import <iostream>;
+import <memory>;
+import <numeric>;
+import <span>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+/* Measures the per-frame cost of the frontend itself, with a synthetic core that does no emulation.
+   Each case is run for a number of warmup iterations, and then for a number of repetitions of a number
+   of timed iterations. The statistics reported are over the per-repetition averages, so that a single
+   preempted iteration does not skew the result.
+
+   Usage: HumlaBench [--iterations=N] [--repetitions=N] [--warmup=N] [--json=PATH|-] [--software-renderer] [--dummy-drivers] */
+namespace Benchmark
+{
+	struct Options
+	{
+		uint iterations = 500;
+		uint repetitions = 10;
+		uint warmup_iterations = 50;
+		bool dummy_drivers = false; /* for machines without a display */
+		bool software_renderer = false;
+		std::string json_path;
+	};
+
+	struct Result
+	{
+		std::string name;
+		uint iterations;
+		uint ops_per_iteration;
+		std::vector<f64> ns_per_op; /* one entry per repetition */
+	};
+
+	bool Initialize();
+	Result Measure(std::string name, uint ops_per_iteration, std::function<void()> setup, std::function<void()> body);
+	bool ParseArguments(int argc, char* argv[]);
+	void RunAudioBenchmarks();
+	void RunCoreBenchmarks();
+	void RunInputBenchmarks();
+	void RunResamplerBenchmarks();
+	void RunVideoBenchmarks();
+	void Shutdown();
+	void WriteJson(std::ostream& out);
+	void WriteTable(std::ostream& out);
+
+	Options options;
+
+	std::shared_ptr<SyntheticCore> core;
+
+	std::vector<Result> results;
+
+	SDL_Renderer* sdl_renderer;
+	SDL_Window* sdl_window;
+
+
+	bool Initialize()
+	{
+		SDL_SetMainReady();
+		if (options.dummy_drivers) {
+			SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+			options.software_renderer = true;
+		}
+		if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_GAMECONTROLLER) != 0) {
+			std::cerr << SDL_GetError() << '\n';
+			return false;
+		}
+		sdl_window = SDL_CreateWindow("Humla benchmark", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+			640, 480, SDL_WINDOW_HIDDEN);
+		if (!sdl_window) {
+			std::cerr << SDL_GetError() << '\n';
+			return false;
+		}
+		sdl_renderer = SDL_CreateRenderer(sdl_window, -1,
+			options.software_renderer ? SDL_RENDERER_SOFTWARE : SDL_RENDERER_ACCELERATED);
+		if (!sdl_renderer) {
+			std::cerr << SDL_GetError() << '\n';
+			return false;
+		}
+
+		core = std::make_shared<SyntheticCore>();
+		Emulator::SetCore(core);
+		core->Initialize();
+		core->SetupCommunicationWithFrontend();
+
+		/* Audio is captured rather than played, so that the queue is drained at a controlled point instead
+		   of by a device thread competing with the measurements. */
+		if (!Audio::InitializeHeadless(true) || !Input::InitializeHeadless() || !Video::Initialize(sdl_renderer, sdl_window)) {
+			return false;
+		}
+		Video::SetGameRenderAreaSize(640, 480);
+		Emulator::UnlockFramerate();
+		return true;
+	}
+
+
+	Result Measure(std::string name, uint ops_per_iteration, std::function<void()> setup, std::function<void()> body)
+	{
+		using Clock = std::chrono::steady_clock;
+		for (uint i = 0; i < options.warmup_iterations; ++i) {
+			setup();
+			body();
+		}
+		Result result{ .name = std::move(name), .iterations = options.iterations, .ops_per_iteration = ops_per_iteration };
+		for (uint rep = 0; rep < options.repetitions; ++rep) {
+			Clock::duration elapsed{};
+			for (uint i = 0; i < options.iterations; ++i) {
+				setup();
+				auto start = Clock::now();
+				body();
+				elapsed += Clock::now() - start;
+			}
+			f64 ns = std::chrono::duration<f64, std::nano>(elapsed).count();
+			result.ns_per_op.push_back(ns / (f64(options.iterations) * ops_per_iteration));
+		}
+		std::cerr << std::format("{:<48} done\n", result.name);
+		return result;
+	}
+
+
+	bool ParseArguments(int argc, char* argv[])
+	{
+		for (int i = 1; i < argc; ++i) {
+			std::string_view arg = argv[i];
+			auto value_of = [&](std::string_view key) -> std::string_view {
+				return arg.starts_with(key) ? arg.substr(key.size()) : std::string_view{};
+			};
+			if (auto value = value_of("--iterations="); !value.empty()) {
+				options.iterations = std::max(uint(std::stoul(std::string(value))), 1u);
+			}
+			else if (auto value = value_of("--repetitions="); !value.empty()) {
+				options.repetitions = std::max(uint(std::stoul(std::string(value))), 1u);
+			}
+			else if (auto value = value_of("--warmup="); !value.empty()) {
+				options.warmup_iterations = uint(std::stoul(std::string(value)));
+			}
+			else if (auto value = value_of("--json="); !value.empty()) {
+				options.json_path = value;
+			}
+			else if (arg == "--software-renderer") {
+				options.software_renderer = true;
+			}
+			else if (arg == "--dummy-drivers") {
+				options.dummy_drivers = true;
+			}
+			else {
+				std::cerr << std::format("Unknown argument \"{}\"\n", arg);
+				return false;
+			}
+		}
+		return true;
+	}
+
+
+	void RunAudioBenchmarks()
+	{
+		/* One video frame's worth of interleaved stereo samples at the output rate, as a core would emit. */
+		size_t num_samples = 2 * size_t(std::lround(Audio::GetSampleRate() / core->GetRefreshRate()));
+		std::vector<f32> samples_f32(num_samples);
+		std::vector<s16> samples_s16(num_samples);
+		for (size_t i = 0; i < num_samples; ++i) {
+			samples_f32[i] = f32(std::sin(0.01 * f64(i)));
+			samples_s16[i] = s16(samples_f32[i] * 32767.0f);
+		}
+		std::vector<f32> drained(4 * num_samples);
+		auto drain = [&] { while (Audio::ReadSamples(drained) > 0); };
+
+		results.push_back(Measure("Audio::EnqueueSamples/f32/frame", 1, drain,
+			[&] { Audio::EnqueueSamples(std::span<const f32>{ samples_f32 }); }));
+		results.push_back(Measure("Audio::EnqueueSamples/s16/frame", 1, drain,
+			[&] { Audio::EnqueueSamples(std::span<const s16>{ samples_s16 }); }));
+		results.push_back(Measure("Audio::EnqueueSample/frame", 1, drain,
+			[&] { for (f32 sample : samples_f32) Audio::EnqueueSample(sample); }));
+	}
+
+
+	void RunCoreBenchmarks()
+	{
+		/* A whole frame as the emulation thread runs it, through either core interface: producing the frame,
+		   publishing its video and queueing its audio. */
+		core->SetVideoFormat(Video::PixelFormat::RGBA8888, 256, 224);
+		std::vector<f32> drained(1 << 14);
+		auto drain = [&] { while (Audio::ReadSamples(drained) > 0); };
+		for (bool frame_output_is_enabled : { false, true }) {
+			core->frame_output_is_enabled = frame_output_is_enabled;
+			results.push_back(Measure(std::format("Emulator::RunCore/{}", frame_output_is_enabled ? "RunFrame" : "Run"), 1,
+				drain, [] { Emulator::RunCore(*core); }));
+		}
+		core->frame_output_is_enabled = false;
+	}
+
+
+	void RunInputBenchmarks()
+	{
+		using Action = SyntheticCore::Action;
+		static constexpr std::array bound_keys = {
+			SDLK_x, SDLK_z, SDLK_RSHIFT, SDLK_RETURN, SDLK_UP, SDLK_DOWN, SDLK_LEFT, SDLK_RIGHT
+		};
+		/* Controller bindings only take effect for controllers that are open, so a virtual one stands in for a
+		   real one, and the events come from it. */
+		int virtual_controller_index = SDL_JoystickAttachVirtual(SDL_JOYSTICK_TYPE_GAMECONTROLLER,
+			SDL_CONTROLLER_AXIS_MAX, SDL_CONTROLLER_BUTTON_MAX, 0);
+		if (virtual_controller_index < 0) {
+			std::cerr << std::format("Could not attach a virtual controller; {}\n", SDL_GetError());
+		}
+		Input::OpenGameControllers();
+		SDL_JoystickID virtual_controller_id = virtual_controller_index >= 0
+			? SDL_JoystickGetDeviceInstanceID(virtual_controller_index) : Input::default_joystick_id;
+		for (uint action = 0; action < uint(Action::Count); ++action) {
+			Input::AddBinding(0, Action(action), Input::HostInputType::Key, bound_keys[action]);
+			Input::AddBinding(1, Action(action), Input::HostInputType::ControllerButton, s32(action), virtual_controller_id);
+		}
+
+		auto make_events = [](auto fill_event) {
+			std::vector<SDL_Event> events;
+			for (uint action = 0; action < uint(Action::Count); ++action) {
+				for (bool press : { true, false }) {
+					SDL_Event event{};
+					fill_event(event, action, press);
+					events.push_back(event);
+				}
+			}
+			return events;
+		};
+		std::vector<SDL_Event> bound_key_events = make_events([](SDL_Event& event, uint action, bool press) {
+			event.type = press ? SDL_KEYDOWN : SDL_KEYUP;
+			event.key.keysym.sym = bound_keys[action];
+		});
+		std::vector<SDL_Event> unbound_key_events = make_events([](SDL_Event& event, uint action, bool press) {
+			event.type = press ? SDL_KEYDOWN : SDL_KEYUP;
+			event.key.keysym.sym = SDLK_a + SDL_Keycode(action);
+		});
+		std::vector<SDL_Event> controller_button_events = make_events([virtual_controller_id](SDL_Event& event, uint action, bool press) {
+			event.type = press ? SDL_CONTROLLERBUTTONDOWN : SDL_CONTROLLERBUTTONUP;
+			event.cbutton.button = u8(action);
+			event.cbutton.which = virtual_controller_id;
+		});
+
+		/* Each iteration matches and queues the events on this thread and then delivers them to the core, as
+		   the emulation thread would at the end of a frame. */
+		auto dispatch = [](const std::vector<SDL_Event>& events) {
+			return [&events] {
+				for (const SDL_Event& event : events) Input::ProcessEvent(event);
+				Input::OnNewFrame();
+			};
+		};
+		/* A case that is meant to reach the core is only measured if it does, or it would only measure a
+		   failed lookup. */
+		auto no_setup = [] {};
+		auto measure_delivered = [&](std::string name, const std::vector<SDL_Event>& events) {
+			u64 num_input_events = core->num_input_events;
+			dispatch(events)();
+			if (core->num_input_events - num_input_events == events.size()) {
+				results.push_back(Measure(std::move(name), uint(events.size()), no_setup, dispatch(events)));
+			}
+			else {
+				std::cerr << std::format("Skipping {}; its events do not reach the core\n", name);
+			}
+		};
+		measure_delivered("Input::ProcessEvent/key/bound", bound_key_events);
+		results.push_back(Measure("Input::ProcessEvent/key/unbound", uint(unbound_key_events.size()), no_setup, dispatch(unbound_key_events)));
+		measure_delivered("Input::ProcessEvent/controller_button", controller_button_events);
+
+		if (virtual_controller_index >= 0) {
+			SDL_JoystickDetachVirtual(virtual_controller_index);
+			Input::OpenGameControllers();
+		}
+	}
+
+
+	void RunResamplerBenchmarks()
+	{
+		/* One video frame's worth of stereo input, converted to 48 kHz, at rates that cores produce: that of
+		   the SNES, and that of the NES after decimating its 1.79 MHz by 32. At 60 frames per second, 1% of
+		   one core is 166667 ns per frame. */
+		static constexpr f64 output_sample_rate = 48000.0;
+		for (f64 input_sample_rate : { 32040.0, 1789773.0 / 32.0 }) {
+			std::vector<f32> input(2 * size_t(std::lround(input_sample_rate / 60.0)));
+			for (size_t i = 0; i < input.size(); ++i) {
+				input[i] = f32(0.5 * std::sin(0.01 * f64(i / 2)));
+			}
+			std::vector<f32> output(2 * size_t(output_sample_rate / 60.0) + 64);
+			for (size_t i = 0; i < size_t(Resampler::Quality::Count); ++i) {
+				auto quality = Resampler::Quality(i);
+				Resampler resampler;
+				resampler.Configure(2, input_sample_rate, output_sample_rate, quality);
+				results.push_back(Measure(std::format("Resampler::Process/{}/{:.0f}Hz/frame",
+					Resampler::GetQualityName(quality), input_sample_rate), 1, [] {}, [&] {
+						std::span<const f32> remaining = input;
+						while (!remaining.empty()) {
+							remaining = remaining.subspan(resampler.Process(remaining, output).num_input_samples);
+						}
+					}));
+			}
+		}
+	}
+
+
+	void RunVideoBenchmarks()
+	{
+		struct Format { Video::PixelFormat format; std::string_view name; };
+		static constexpr std::array formats = {
+			Format{ Video::PixelFormat::ABGR8888, "ABGR8888" },
+			Format{ Video::PixelFormat::BGR888, "BGR888" },
+			Format{ Video::PixelFormat::INDEX1LSB, "INDEX1LSB" },
+			Format{ Video::PixelFormat::RGB888, "RGB888" },
+			Format{ Video::PixelFormat::RGBA8888, "RGBA8888" }
+		};
+		struct Resolution { uint width, height; };
+		static constexpr std::array resolutions = {
+			Resolution{ 256, 224 }, Resolution{ 640, 480 }, Resolution{ 1920, 1080 }
+		};
+
+		for (const Format& format : formats) {
+			for (const Resolution& resolution : resolutions) {
+				core->SetVideoFormat(format.format, resolution.width, resolution.height);
+				std::string name = std::format("Video::RenderGame/{}/{}x{}", format.name, resolution.width, resolution.height);
+				/* A new frame is published before every iteration, so that each one includes an upload. The
+				   render commands are flushed inside the timed region, since SDL may otherwise defer them. */
+				results.push_back(Measure(name, 1,
+					[] {
+						core->Run();
+						SDL_RenderPresent(sdl_renderer);
+					},
+					[] {
+						Video::RenderGame();
+						SDL_RenderFlush(sdl_renderer);
+					}));
+				std::string idle_name = std::format("Video::RenderGame/{}/{}x{}/no_new_frame", format.name, resolution.width, resolution.height);
+				results.push_back(Measure(idle_name, 1,
+					[] { SDL_RenderPresent(sdl_renderer); },
+					[] {
+						Video::RenderGame();
+						SDL_RenderFlush(sdl_renderer);
+					}));
+			}
+		}
+
+		/* Filter chains, from a typical core resolution to a 4K game render area. */
+		using enum VideoFilters::Filter;
+		struct Chain { std::vector<VideoFilters::Filter> filters; std::string_view name; };
+		std::array chains = {
+			Chain{ { SharpBilinear }, "sharp_bilinear" },
+			Chain{ { Scale2x, CrtScanlines, SharpBilinear }, "scale2x+crt_scanlines+sharp_bilinear" },
+			Chain{ { Scale3x, SharpBilinear }, "scale3x+sharp_bilinear" },
+			Chain{ { Xbr, CrtScanlines, SharpBilinear }, "xbr+crt_scanlines+sharp_bilinear" }
+		};
+		core->SetVideoFormat(Video::PixelFormat::ABGR8888, 256, 224);
+		Video::SetGameRenderAreaSize(3840, 2160);
+		for (const Chain& chain : chains) {
+			Video::SetFilterChain(chain.filters);
+			results.push_back(Measure(std::format("Video::RenderGame/filters/{}/256x224", chain.name), 1,
+				[] {
+					core->Run();
+					SDL_RenderPresent(sdl_renderer);
+				},
+				[] {
+					Video::RenderGame();
+					SDL_RenderFlush(sdl_renderer);
+				}));
+		}
+		Video::SetFilterChain({});
+		Video::SetGameRenderAreaSize(640, 480);
+	}
+
+
+	void Shutdown()
+	{
+		SDL_DestroyRenderer(sdl_renderer);
+		SDL_DestroyWindow(sdl_window);
+		SDL_Quit();
+	}
+
+
+	void WriteJson(std::ostream& out)
+	{
+		out << "{\n\t\"iterations\": " << options.iterations << ",\n\t\"repetitions\": " << options.repetitions
+			<< ",\n\t\"benchmarks\": [\n";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const Result& result = results[i];
+			std::vector<f64> sorted = result.ns_per_op;
+			std::ranges::sort(sorted);
+			f64 mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+			f64 variance = std::accumulate(sorted.begin(), sorted.end(), 0.0,
+				[&](f64 sum, f64 ns) { return sum + (ns - mean) * (ns - mean); }) / sorted.size();
+			out << std::format("\t\t{{ \"name\": \"{}\", \"ops_per_iteration\": {}, \"ns_per_op\": "
+				"{{ \"min\": {:.2f}, \"median\": {:.2f}, \"mean\": {:.2f}, \"max\": {:.2f}, \"stddev\": {:.2f} }} }}{}\n",
+				result.name, result.ops_per_iteration, sorted.front(), sorted[sorted.size() / 2], mean, sorted.back(),
+				std::sqrt(variance), i + 1 < results.size() ? "," : "");
+		}
+		out << "\t]\n}\n";
+	}
+
+
+	void WriteTable(std::ostream& out)
+	{
+		out << std::format("{:<56} {:>12} {:>12} {:>12}\n", "benchmark", "min ns/op", "median ns/op", "max ns/op");
+		for (const Result& result : results) {
+			std::vector<f64> sorted = result.ns_per_op;
+			std::ranges::sort(sorted);
+			out << std::format("{:<56} {:>12.1f} {:>12.1f} {:>12.1f}\n",
+				result.name, sorted.front(), sorted[sorted.size() / 2], sorted.back());
+		}
+	}
+}
+
+
+int main(int argc, char* argv[])
+{
+	if (!Benchmark::ParseArguments(argc, argv) || !Benchmark::Initialize()) {
+		return 1;
+	}
+
+	Benchmark::RunVideoBenchmarks();
+	Benchmark::RunAudioBenchmarks();
+	Benchmark::RunCoreBenchmarks();
+	Benchmark::RunInputBenchmarks();
+	Benchmark::RunResamplerBenchmarks();
+
+	/* With '--json=-', stdout is kept to the json alone so that it can be piped into other tools. */
+	if (Benchmark::options.json_path == "-") {
+		Benchmark::WriteTable(std::cerr);
+		Benchmark::WriteJson(std::cout);
+	}
+	else {
+		Benchmark::WriteTable(std::cout);
+		if (!Benchmark::options.json_path.empty()) {
+			std::ofstream json_file{ Benchmark::options.json_path };
+			Benchmark::WriteJson(json_file);
+		}
+	}
+
+	Benchmark::Shutdown();
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,167 @@
+module SyntheticCore;
+
+import Audio;
+
+void SyntheticCore::ApplyNewSampleRate()
+{
+	sample_rate = Audio::GetSampleRate();
+	/* One video frame's worth of interleaved stereo samples */
+	audio_frame.resize(2 * size_t(std::lround(sample_rate / refresh_rate)));
+}
+
+
+void SyntheticCore::DisableAudio()
+{
+	audio_enabled = false;
+}
+
+
+void SyntheticCore::EnableAudio()
+{
+	audio_enabled = true;
+}
+
+
+void SyntheticCore::GenerateAudio()
+{
+	f64 phase_step = 2.0 * std::numbers::pi * tone_frequency / sample_rate;
+	for (size_t i = 0; i < audio_frame.size(); i += 2) {
+		audio_frame[i] = audio_frame[i + 1] = f32(0.25 * std::sin(tone_phase));
+		tone_phase += phase_step;
+	}
+	tone_phase = std::fmod(tone_phase, 2.0 * std::numbers::pi);
+}
+
+
+std::vector<std::string_view> SyntheticCore::GetActionNames()
+{
+	return { "A", "B", "Select", "Start", "Up", "Down", "Left", "Right" };
+}
+
+
+unsigned SyntheticCore::GetNumberOfInputs()
+{
+	return unsigned(Action::Count);
+}
+
+
+double SyntheticCore::GetRefreshRate()
+{
+	return refresh_rate;
+}
+
+
+void SyntheticCore::Initialize()
+{
+	SetVideoFormat(Video::PixelFormat::RGBA8888, 256, 224);
+}
+
+
+bool SyntheticCore::LoadBios(const std::string& /*path*/)
+{
+	return true;
+}
+
+
+bool SyntheticCore::LoadRom(const std::string& /*path*/)
+{
+	return true;
+}
+
+
+void SyntheticCore::NotifyNewAxisValue(unsigned /*player_index*/, unsigned /*action_index*/, int /*new_axis_value*/)
+{
+	++num_input_events;
+}
+
+
+void SyntheticCore::NotifyButtonPressed(unsigned /*player_index*/, unsigned /*action_index*/)
+{
+	++num_input_events;
+}
+
+
+void SyntheticCore::NotifyButtonReleased(unsigned /*player_index*/, unsigned /*action_index*/)
+{
+	++num_input_events;
+}
+
+
+void SyntheticCore::RenderFrame(u8* framebuffer)
+{
+	/* A pattern that changes every frame, so that nothing downstream can get away with skipping work.
+	   Only a single row is computed; the rest are copies of it, offset by the row number. */
+	size_t pitch = (size_t(width) * bits_per_pixel + 7) / 8;
+	for (size_t x = 0; x < pitch; ++x) {
+		framebuffer[x] = u8(x + frame_number);
+	}
+	for (uint y = 1; y < height; ++y) {
+		u8* row = framebuffer + y * pitch;
+		std::copy_n(framebuffer, pitch, row);
+		row[0] = u8(y);
+	}
+	++frame_number;
+}
+
+
+void SyntheticCore::Reset()
+{
+	frame_number = 0;
+	num_input_events = 0;
+	tone_phase = 0.0;
+}
+
+
+void SyntheticCore::Run()
+{
+	RenderFrame(Video::GetFramebufferPtr());
+	Video::NotifyNewGameFrameReady();
+	if (audio_enabled) {
+		GenerateAudio();
+		Audio::EnqueueSamples(std::span<const f32>{ audio_frame });
+	}
+}
+
+
+void SyntheticCore::RunFrame(FrameOutput& output)
+{
+	/* Renders straight into the frontend's buffer, which it recognizes and does not copy. */
+	u8* framebuffer = Video::GetFramebufferPtr();
+	RenderFrame(framebuffer);
+	uint pitch = (width * bits_per_pixel + 7) / 8;
+	output.pixels = { framebuffer, size_t(pitch) * height };
+	output.width = width;
+	output.height = height;
+	output.pitch = pitch;
+	if (audio_enabled) {
+		GenerateAudio();
+		output.audio_samples_f32 = audio_frame;
+	}
+	output.duration_s = 1.0 / refresh_rate;
+}
+
+
+void SyntheticCore::SetVideoFormat(Video::PixelFormat pixel_format, uint width, uint height)
+{
+	this->pixel_format = pixel_format;
+	this->width = width;
+	this->height = height;
+	bits_per_pixel = [&] {
+		switch (pixel_format) {
+		case Video::PixelFormat::INDEX1LSB:
+			return 1u;
+		case Video::PixelFormat::BGR888:
+		case Video::PixelFormat::RGB888:
+			return 24u;
+		default:
+			return 32u;
+		}
+	}();
+	Video::SetPixelFormat(pixel_format);
+	Video::SetFramebufferSize(width, height);
+}
+
+bool SyntheticCore::SupportsRunFrame()
+{
+	return frame_output_is_enabled;
+}
\ No newline at end of file
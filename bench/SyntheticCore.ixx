@@ -0,0 +1,62 @@
+export module SyntheticCore;
+
+import Core;
+import Types;
+import Video;
+
+import <algorithm>;
+import <cmath>;
+import <numbers>;
+import <span>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+/* A core that does no emulation at all. Every call to 'Run' or 'RunFrame' produces one video frame and
+   one frame's worth of audio, in whatever format it has been configured with, and all input is merely
+   counted. Its own cost is kept to a minimum, so that what is measured around it is the frontend. */
+export struct SyntheticCore : Core
+{
+	enum class Action {
+		A, B, Select, Start, Up, Down, Left, Right, Count
+	};
+
+	void ApplyNewSampleRate() override;
+	void Detach() override {};
+	void DisableAudio() override;
+	void EnableAudio() override;
+	std::vector<std::string_view> GetActionNames() override;
+	unsigned GetNumberOfInputs() override;
+	double GetRefreshRate() override;
+	void Initialize() override;
+	bool LoadBios(const std::string& path) override;
+	bool LoadRom(const std::string& path) override;
+	void NotifyNewAxisValue(unsigned player_index, unsigned action_index, int new_axis_value) override;
+	void NotifyButtonPressed(unsigned player_index, unsigned action_index) override;
+	void NotifyButtonReleased(unsigned player_index, unsigned action_index) override;
+	void Reset() override;
+	void Run() override;
+	void RunFrame(FrameOutput& output) override;
+	bool SupportsRunFrame() override;
+
+	void SetVideoFormat(Video::PixelFormat pixel_format, uint width, uint height);
+
+	bool frame_output_is_enabled; /* hand frames back through 'RunFrame', rather than push them from 'Run' */
+	u64 num_input_events;
+
+private:
+	void GenerateAudio();
+	void RenderFrame(u8* framebuffer);
+
+	static constexpr f64 refresh_rate = 60.0;
+	static constexpr f64 tone_frequency = 440.0;
+
+	bool audio_enabled = true;
+	uint bits_per_pixel;
+	uint frame_number;
+	uint height, width;
+	uint sample_rate;
+	f64 tone_phase;
+	Video::PixelFormat pixel_format;
+	std::vector<f32> audio_frame;
+};
\ No newline at end of file
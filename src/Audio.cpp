@@ -1,3 +1,11 @@
+module;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HUMLA_X86 1
+#include <emmintrin.h>
+#else
+#define HUMLA_X86 0
+#endif
+
 module Audio;
 
 import Emulator;
@@ -5,41 +13,162 @@ import UserMessage;
 
 namespace Audio
 {
-	void EnqueueSample(f32 sample)
+	void AddSamples(std::span<const f32> source, std::span<f32> target)
+	{
+		size_t i = 0;
+#if HUMLA_X86
+		for (; i + 4 <= source.size(); i += 4) {
+			_mm_storeu_ps(target.data() + i, _mm_add_ps(_mm_loadu_ps(target.data() + i), _mm_loadu_ps(source.data() + i)));
+		}
+#endif
+		for (; i < source.size(); ++i) {
+			target[i] += source[i];
+		}
+	}
+
+
+	void SDLCALL AudioCallback(void* /*userdata*/, u8* stream, int len)
 	{
-		//// TODO: in the future, we may have to support samples other than f32
-		//sample_buffer[sample_buffer_index++] = sample;
-		//if (sample_buffer_index == sample_buffer.size()) {
-		//	//auto microsecs_until_next_audio_enqueue =
-		//	//	std::chrono::duration_cast<std::chrono::microseconds>(
-		//	//		std::chrono::steady_clock::now() - last_audio_enqueue_time_point);
-		//	//// TODO: handle this in a better way
-		//	//static constexpr auto time_until_no_sleep = std::chrono::microseconds(1500);
-		//	//if (microsecs_until_next_audio_enqueue > time_until_no_sleep) {
-		//	//	std::this_thread::sleep_for(microsecs_until_next_audio_enqueue - time_until_no_sleep);
-		//	//}
-		//	while (std::chrono::duration_cast<std::chrono::microseconds>(
-		//		std::chrono::steady_clock::now() - last_audio_enqueue_time_point).count() < microsecs_per_audio_enqueue);
-		//	SDL_QueueAudio(audio_device_id, sample_buffer.data(), uint(sample_buffer.size() * sizeof(f32)));
-		//	sample_buffer_index = 0;
-		//	last_audio_enqueue_time_point = std::chrono::steady_clock::now();
-		//}
+		std::span<f32> out{ reinterpret_cast<f32*>(stream), len / sizeof(f32) };
+		size_t num_samples = sample_queue.Pop(out);
+		/* On underrun, output silence for the remainder rather than waiting for the core. */
+		if (num_samples < out.size()) {
+			std::fill(out.begin() + num_samples, out.end(), 0.0f);
+			/* Count each time we run dry, rather than every buffer while nothing is being played at all. */
+			if (!device_is_starved) {
+				num_underruns.fetch_add(1, std::memory_order_relaxed);
+				device_is_starved = true;
+			}
+		}
+		else {
+			device_is_starved = false;
+		}
+		/* Everything else is mixed in on top of the core's samples, a scratch buffer at a time. */
+		for (size_t offset = 0; offset < out.size(); offset += effects_mix.size()) {
+			MixInto(out.subspan(offset, std::min(effects_mix.size(), out.size() - offset)));
+		}
 	}
 
 
 	void CloseFile()
 	{
-		if (mixer_last_opened_file != nullptr) {
-			Mix_FreeChunk(mixer_last_opened_file);
-			mixer_last_opened_file = nullptr;
+		/* The file is read and decoded again if it is opened again. Voices that are playing it are left to
+		   finish. */
+		std::lock_guard lock{ sound_cache_mutex };
+		if (last_opened_sound) {
+			std::erase_if(sound_cache, [](const auto& entry) { return entry.second == last_opened_sound; });
+			last_opened_sound.reset();
+		}
+	}
+
+
+	void CloseStream(uint stream)
+	{
+		if (stream >= max_streams || !stream_is_open[stream]) {
+			return;
 		}
+		/* Whatever was left in the stream must not be played once it is opened again. */
+		SDL_LockAudioDevice(audio_device_id);
+		stream_is_open[stream] = false;
+		streams[stream].Clear();
+		SDL_UnlockAudioDevice(audio_device_id);
+	}
+
+
+	void EnqueueSample(f32 sample)
+	{
+		if (sample_sink) {
+			sample_sink->num_samples += 1;
+			return;
+		}
+		if (output_is_suppressed) {
+			return;
+		}
+		if (discard_samples) {
+			num_discarded_samples.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		Resample(std::span<const f32>{ &sample, 1 });
+		FlushResampledFrames();
+	}
+
+
+	void EnqueueSamples(std::span<const f32> samples)
+	{
+		if (sample_sink) {
+			sample_sink->num_samples += samples.size();
+			return;
+		}
+		if (output_is_suppressed) {
+			return;
+		}
+		if (discard_samples) {
+			num_discarded_samples.fetch_add(samples.size(), std::memory_order_relaxed);
+			return;
+		}
+		Resample(samples);
+		FlushResampledFrames();
+	}
+
+
+	void EnqueueSamples(std::span<const s16> samples)
+	{
+		if (sample_sink) {
+			sample_sink->num_samples += samples.size();
+			return;
+		}
+		if (output_is_suppressed) {
+			return;
+		}
+		if (discard_samples) {
+			num_discarded_samples.fetch_add(samples.size(), std::memory_order_relaxed);
+			return;
+		}
+		/* Convert in blocks small enough to live on the stack, and push each block as a whole. */
+		static constexpr size_t block_size = 256;
+		std::array<f32, block_size> block;
+		while (!samples.empty()) {
+			size_t num_samples = std::min(samples.size(), block_size);
+			std::transform(samples.begin(), samples.begin() + num_samples, block.begin(),
+				[](s16 sample) { return f32(sample) * (1.0f / 32768.0f); });
+			Resample(std::span<const f32>{ block.data(), num_samples });
+			samples = samples.subspan(num_samples);
+		}
+		FlushResampledFrames();
 	}
 
 
 	void Exit()
 	{
 		SDL_CloseAudioDevice(audio_device_id);
-		Mix_CloseAudio();
+		for (Voice& voice : voices) {
+			voice.sound.reset();
+		}
+		std::lock_guard lock{ sound_cache_mutex };
+		sound_cache.clear();
+		last_opened_sound.reset();
+	}
+
+
+	void FlushResampledFrames()
+	{
+		size_t num_pushed_samples = PushFrames(sample_queue, std::span<const f32>{ resampled_frames.data(), num_resampled_samples });
+		if (num_pushed_samples < num_resampled_samples) {
+			num_dropped_samples.fetch_add(num_resampled_samples - num_pushed_samples, std::memory_order_relaxed);
+		}
+		num_resampled_samples = 0;
+	}
+
+
+	f32 GetMixerChannelGain(MixerChannel channel)
+	{
+		return mixer_channel_gains[size_t(channel)].load(std::memory_order_relaxed);
+	}
+
+
+	Resampler::Quality GetResamplingQuality()
+	{
+		return resampling_quality.load(std::memory_order_relaxed);
 	}
 
 
@@ -49,74 +178,226 @@ namespace Audio
 	}
 
 
+	Stats GetStats()
+	{
+		return {
+			.fill_level_ms = stats_fill_level_ms.load(std::memory_order_relaxed),
+			.target_latency_ms = f32(target_latency_ms.load(std::memory_order_relaxed)),
+			.rate_adjustment = stats_rate_adjustment.load(std::memory_order_relaxed),
+			.num_discarded_samples = num_discarded_samples.load(std::memory_order_relaxed),
+			.num_dropped_samples = num_dropped_samples.load(std::memory_order_relaxed),
+			.num_underruns = num_underruns.load(std::memory_order_relaxed)
+		};
+	}
+
+
 	bool Initialize()
 	{
-		if (SDL_Init(SDL_INIT_AUDIO) != 0) {
-			UserMessage::Show(SDL_GetError(), UserMessage::Type::Error);
-			return false;
+		/* Opens the device first unless 'OpenDevice' has already done so, e.g. on another thread while the
+		   window was being created. Telling the core about the sample rate is left to here, since the core
+		   must only be called from one thread at a time. Main thread only. */
+		if (audio_device_id == 0) {
+			if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+				UserMessage::Show(SDL_GetError(), UserMessage::Type::Error);
+				return false;
+			}
+			std::string error;
+			if (!OpenDevice(error)) {
+				UserMessage::Show(error, UserMessage::Type::Warning);
+				return false;
+			}
+		}
+		SetSampleRate(sample_rate);
+		SDL_PauseAudioDevice(audio_device_id, 0);
+		return true;
+	}
+
+
+	bool InitializeHeadless(bool capture_samples)
+	{
+		/* No device is opened. The core is told about a sample rate as usual, but whatever it produces is
+		   only counted, unless it is to be captured; then it goes through the usual resampling and queueing,
+		   and is read back with 'ReadSamples' instead of by a device. */
+		is_headless = true;
+		discard_samples = !capture_samples;
+		num_output_channels = default_num_output_channels;
+		sample_buffer_size_per_channel = default_sample_buffer_size_per_channel;
+		SetSampleRate(default_sample_rate);
+		return true;
+	}
+
+
+	std::shared_ptr<const Sound> LoadSound(std::string_view path)
+	{
+		SDL_AudioSpec spec;
+		u8* buffer;
+		u32 length;
+		if (SDL_LoadWAV(std::string(path).c_str(), &spec, &buffer, &length) == nullptr) {
+			UserMessage::Show(std::format("Failed to open audio file; {}", SDL_GetError()),
+				UserMessage::Type::Warning);
+			return nullptr;
+		}
+		std::shared_ptr<Sound> sound;
+		SDL_AudioStream* stream = SDL_NewAudioStream(spec.format, spec.channels, spec.freq,
+			AUDIO_F32, u8(num_output_channels), int(sample_rate));
+		if (stream && SDL_AudioStreamPut(stream, buffer, int(length)) == 0 && SDL_AudioStreamFlush(stream) == 0) {
+			sound = std::make_shared<Sound>();
+			sound->samples.resize(size_t(SDL_AudioStreamAvailable(stream)) / sizeof(f32));
+			SDL_AudioStreamGet(stream, sound->samples.data(), int(sound->samples.size() * sizeof(f32)));
+		}
+		else {
+			UserMessage::Show(std::format("Failed to convert audio file; {}", SDL_GetError()),
+				UserMessage::Type::Warning);
+		}
+		SDL_FreeAudioStream(stream);
+		SDL_FreeWAV(buffer);
+		return sound;
+	}
+
+
+	void MixChannels(std::span<f32> core, std::span<const f32> effects, std::span<const f32> streamed)
+	{
+		/* core = SoftClip(core * core_gain + effects * effects_gain + streamed * streams_gain) */
+		f32 core_gain = GetMixerChannelGain(MixerChannel::Core);
+		f32 effects_gain = GetMixerChannelGain(MixerChannel::Effects);
+		f32 streams_gain = GetMixerChannelGain(MixerChannel::Streams);
+		size_t i = 0;
+#if HUMLA_X86
+		const __m128 core_gains = _mm_set1_ps(core_gain);
+		const __m128 effects_gains = _mm_set1_ps(effects_gain);
+		const __m128 streams_gains = _mm_set1_ps(streams_gain);
+		const __m128 sign_mask = _mm_set1_ps(-0.0f);
+		const __m128 knee = _mm_set1_ps(soft_clip_knee);
+		const __m128 inverse_headroom = _mm_set1_ps(1.0f / (1.0f - soft_clip_knee));
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (; i + 4 <= core.size(); i += 4) {
+			__m128 sum = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_loadu_ps(core.data() + i), core_gains),
+				_mm_mul_ps(_mm_loadu_ps(effects.data() + i), effects_gains)),
+				_mm_mul_ps(_mm_loadu_ps(streamed.data() + i), streams_gains));
+			/* As 'SoftClip', on the magnitude, after which the sign is put back. */
+			__m128 magnitude = _mm_andnot_ps(sign_mask, sum);
+			__m128 excess = _mm_max_ps(_mm_sub_ps(magnitude, knee), _mm_setzero_ps());
+			__m128 clipped = _mm_add_ps(_mm_sub_ps(magnitude, excess),
+				_mm_div_ps(excess, _mm_add_ps(one, _mm_mul_ps(excess, inverse_headroom))));
+			_mm_storeu_ps(core.data() + i, _mm_or_ps(clipped, _mm_and_ps(sum, sign_mask)));
+		}
+#endif
+		for (; i < core.size(); ++i) {
+			core[i] = SoftClip(core[i] * core_gain + effects[i] * effects_gain + streamed[i] * streams_gain);
+		}
+	}
+
+
+	void MixInto(std::span<f32> output)
+	{
+		/* Runs on the audio thread, with the device locked. 'output' holds the core's samples, and is no
+		   larger than the scratch buffers. */
+		std::span<f32> effects{ effects_mix.data(), output.size() };
+		std::span<f32> streamed{ streams_mix.data(), output.size() };
+		std::ranges::fill(effects, 0.0f);
+		std::ranges::fill(streamed, 0.0f);
+		for (Voice& voice : voices) {
+			if (voice.sound && voice.position < voice.sound->samples.size()) {
+				size_t num_samples = std::min(voice.sound->samples.size() - voice.position, output.size());
+				AddSamples(std::span{ voice.sound->samples }.subspan(voice.position, num_samples), effects);
+				voice.position += num_samples;
+			}
+		}
+		for (uint stream = 0; stream < max_streams; ++stream) {
+			if (stream_is_open[stream]) {
+				size_t num_samples = streams[stream].Pop(std::span{ stream_samples.data(), output.size() });
+				AddSamples(std::span{ stream_samples.data(), num_samples }, streamed);
+			}
 		}
+		MixChannels(output, effects, streamed);
+	}
 
-		static constexpr uint default_sample_rate = 44100;
-		static constexpr uint default_num_output_channels = 2;
-		static constexpr uint default_sample_buffer_size_per_channel = 512;
 
+	bool OpenDevice(std::string& error)
+	{
+		/* Only the device is opened here, so that this can run on another thread while the window is created.
+		   SDL only allows its subsystems to be initialized on the main thread, so the audio subsystem must
+		   already be. The device is left paused, and nothing outside of this module is touched; not even
+		   'UserMessage', so a failure is described in 'error' for the caller to report. */
 		SDL_AudioSpec desired_spec;
 		SDL_zero(desired_spec);
 		desired_spec.freq = default_sample_rate;
 		desired_spec.format = AUDIO_F32;
 		desired_spec.channels = default_num_output_channels;
 		desired_spec.samples = default_sample_buffer_size_per_channel;
-		desired_spec.callback = nullptr;
+		desired_spec.callback = AudioCallback;
 
 		SDL_AudioSpec obtained_spec;
 		audio_device_id = SDL_OpenAudioDevice(nullptr, 0, &desired_spec, &obtained_spec, 0);
 		if (audio_device_id == 0) {
-			const char* error_msg = SDL_GetError();
-			UserMessage::Show(std::format("Could not open an audio device; {}", error_msg), UserMessage::Type::Warning);
+			error = std::format("Could not open an audio device; {}", SDL_GetError());
 			return false;
 		}
 
-		SetSampleRate(obtained_spec.freq);
-		num_output_channels = obtained_spec.channels;
+		num_output_channels = std::min(uint(obtained_spec.channels), max_output_channels);
 		sample_buffer_size_per_channel = obtained_spec.samples;
-		microsecs_per_audio_enqueue = std::lround(f64(sample_buffer_size_per_channel) / f64(sample_rate) * 1e6);
-		sample_buffer.resize(sample_buffer_size_per_channel * num_output_channels);
-
-		SDL_PauseAudioDevice(audio_device_id, 0);
-
-		if (Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 2048) < 0) {
-			UserMessage::Show(std::format("Failed to initialize audio; {}", Mix_GetError()),
-				UserMessage::Type::Warning);
-			return false;
-		}
-
+		sample_rate = obtained_spec.freq;
+		/* The device is still paused, so the audio thread is not using these yet. */
+		size_t mix_buffer_size = size_t(obtained_spec.samples) * obtained_spec.channels;
+		effects_mix.resize(mix_buffer_size);
+		streams_mix.resize(mix_buffer_size);
+		stream_samples.resize(mix_buffer_size);
 		return true;
 	}
 
 
 	void OpenFileForPlaying(std::string_view path)
 	{
-		if (mixer_last_opened_file != nullptr) {
-			CloseFile();
+		/* Only reads the file the first time around; afterwards, it is taken from the cache. */
+		if (is_headless) {
+			return;
 		}
-		mixer_last_opened_file = Mix_LoadWAV(path.data());
-		if (mixer_last_opened_file == nullptr) {
-			UserMessage::Show(std::format("Failed to open audio file; {}", Mix_GetError()),
-				UserMessage::Type::Warning);
+		std::lock_guard lock{ sound_cache_mutex };
+		if (auto it = sound_cache.find(path); it != sound_cache.end()) {
+			last_opened_sound = it->second;
+			return;
+		}
+		if (std::shared_ptr<const Sound> sound = LoadSound(path)) {
+			sound_cache.emplace(path, sound);
+			last_opened_sound = std::move(sound);
 		}
 	}
 
 
+	std::optional<uint> OpenStream()
+	{
+		/* A secondary stream takes interleaved samples at the device rate and with the device's number of
+		   channels, through 'PushStreamSamples' from any one thread, and is mixed in on the 'Streams'
+		   channel. Returns the stream to push to, or nothing if all streams are open. */
+		for (uint stream = 0; stream < max_streams; ++stream) {
+			if (!stream_is_open[stream]) {
+				SDL_LockAudioDevice(audio_device_id);
+				streams[stream].Resize(sample_queue.Capacity());
+				stream_is_open[stream] = true;
+				SDL_UnlockAudioDevice(audio_device_id);
+				return stream;
+			}
+		}
+		return std::nullopt;
+	}
+
+
 	void PlayFile()
 	{
-		if (mixer_last_opened_file == nullptr) {
+		if (is_headless) {
+			return;
+		}
+		std::shared_ptr<const Sound> sound;
+		{
+			std::lock_guard lock{ sound_cache_mutex };
+			sound = last_opened_sound;
+		}
+		if (!sound) {
 			UserMessage::Show("Cannot play audio file that has not been loaded yet", UserMessage::Type::Error);
 		}
 		else {
-			if (Mix_PlayChannel(-1, mixer_last_opened_file, 0) == -1) {
-				UserMessage::Show(std::format("Failed to play audio file; {}", Mix_GetError()),
-					UserMessage::Type::Warning);
-			}
+			StartVoice(std::move(sound));
 		}
 	}
 
@@ -128,27 +409,202 @@ namespace Audio
 	}
 
 
+	size_t PushStreamSamples(uint stream, std::span<const f32> samples)
+	{
+		/* Returns the number of samples taken; the rest did not fit. Nothing is taken by a stream that is
+		   not open. */
+		if (stream >= max_streams || !stream_is_open[stream]) {
+			return 0;
+		}
+		return PushFrames(streams[stream], samples);
+	}
+
+
+	size_t PushFrames(RingBuffer<f32>& queue, std::span<const f32> samples)
+	{
+		/* Only whole frames are pushed. If a nearly full queue took part of a frame, every frame after it
+		   would be shifted by a channel, e.g. with left and right swapped for good. The producer is the only
+		   one to push, so the free space can only grow between checking it and pushing. */
+		if (num_output_channels == 0) {
+			return 0;
+		}
+		size_t num_samples = std::min(samples.size(), queue.FreeSpace());
+		num_samples -= num_samples % num_output_channels;
+		return queue.Push(samples.first(num_samples));
+	}
+
+
+	size_t ReadSamples(std::span<f32> samples)
+	{
+		/* Pulls samples from the queue the way the audio device does, in headless mode with sample capture. */
+		if (!is_headless) {
+			return 0;
+		}
+		return sample_queue.Pop(samples);
+	}
+
+
+	void Resample(std::span<const f32> samples)
+	{
+		if (num_output_channels == 0) {
+			return; /* no audio device */
+		}
+		f64 input_rate = input_sample_rate.load(std::memory_order_relaxed);
+		resampler.Configure(num_output_channels, input_rate > 0.0 ? input_rate : f64(sample_rate), f64(sample_rate),
+			resampling_quality.load(std::memory_order_relaxed));
+		while (!samples.empty()) {
+			std::span<f32> output = std::span{ resampled_frames }.subspan(num_resampled_samples);
+			Resampler::Result result = resampler.Process(samples, output);
+			samples = samples.subspan(result.num_input_samples);
+			num_resampled_samples += uint(result.num_output_samples);
+			frames_since_rate_control_update += uint(result.num_output_samples / num_output_channels);
+			if (frames_since_rate_control_update >= rate_control_interval) {
+				UpdateRateControl();
+			}
+			if (num_resampled_samples + num_output_channels > resampled_frames.size()) {
+				FlushResampledFrames();
+			}
+		}
+	}
+
+
+	void ResetResampler()
+	{
+		frames_since_rate_control_update = 0;
+		num_resampled_samples = 0;
+		rate_control_integral = 0.0;
+		resampler.Reset();
+		resampler.SetRateAdjustment(0.0);
+		smoothed_fill_level = f64(target_latency_ms.load(std::memory_order_relaxed)) * sample_rate / 1000.0;
+		rate_control_interval = std::max(sample_rate / rate_control_updates_per_second, 1u);
+	}
+
+
+	void ResizeSampleQueue()
+	{
+		uint max_target_latency_frames = max_target_latency_ms * sample_rate / 1000;
+		uint num_frames = std::max(sample_queue_size_in_device_buffers * sample_buffer_size_per_channel,
+			sample_queue_size_in_target_latencies * max_target_latency_frames);
+		/* The audio thread must not be popping while the queue is reallocated. */
+		SDL_LockAudioDevice(audio_device_id);
+		sample_queue.Resize(num_frames * num_output_channels);
+		SDL_UnlockAudioDevice(audio_device_id);
+		ResetResampler();
+	}
+
+
+	void SetInputSampleRate(f64 sample_rate)
+	{
+		/* For cores that produce audio at a native rate of their own, e.g. 32040 Hz, rather than at the rate
+		   that 'ApplyNewSampleRate' tells them about; it is converted to the device rate here instead. May be
+		   called again whenever the rate changes, e.g. between a PAL and an NTSC game. 0 means the device rate. */
+		input_sample_rate.store(sample_rate, std::memory_order_relaxed);
+	}
+
+
+	void SetMixerChannelGain(MixerChannel channel, f32 gain)
+	{
+		mixer_channel_gains[size_t(channel)].store(std::max(gain, 0.0f), std::memory_order_relaxed);
+	}
+
+
 	void SetNumberOfOutputChannels(uint num_channels)
 	{
-		num_output_channels = num_channels;
-		sample_buffer.resize(sample_buffer_size_per_channel * num_output_channels);
-		sample_buffer_index = 0;
+		num_output_channels = std::min(num_channels, max_output_channels);
+		ResizeSampleQueue();
 	}
 	
 	
+	void SetResamplingQuality(Resampler::Quality quality)
+	{
+		resampling_quality.store(quality, std::memory_order_relaxed);
+	}
+
+
 	void SetSampleBufferSizePerChannel(uint buffer_size)
 	{
 		sample_buffer_size_per_channel = buffer_size;
-		sample_buffer.resize(sample_buffer_size_per_channel * num_output_channels);
-		sample_buffer_index = 0;
-		microsecs_per_audio_enqueue = std::lround(f64(sample_buffer_size_per_channel) / f64(sample_rate) * 1e6);
+		ResizeSampleQueue();
 	}
 	
 	
 	void SetSampleRate(uint sample_rate)
 	{
 		Audio::sample_rate = sample_rate;
-		microsecs_per_audio_enqueue = std::lround(f64(sample_buffer_size_per_channel) / f64(sample_rate) * 1e6);
+		ResizeSampleQueue();
 		Emulator::GetCore()->ApplyNewSampleRate();
 	}
+
+
+	void SetThreadSampleSink(SampleSink* sink)
+	{
+		sample_sink = sink;
+	}
+
+
+	void SetTargetLatency(uint milliseconds)
+	{
+		/* Takes effect at the next rate control update; the queue is already large enough for any target. */
+		target_latency_ms.store(std::clamp(milliseconds, 1u, max_target_latency_ms), std::memory_order_relaxed);
+	}
+
+
+	f32 SoftClip(f32 sample)
+	{
+		/* Above the knee, the excess is compressed by x / (1 + x / headroom), which has a slope of 1 at the
+		   knee and tends to the headroom, so that full scale is never reached. */
+		f32 magnitude = std::abs(sample);
+		f32 excess = std::max(magnitude - soft_clip_knee, 0.0f);
+		f32 clipped = magnitude - excess + excess / (1.0f + excess / (1.0f - soft_clip_knee));
+		return std::copysign(clipped, sample);
+	}
+
+
+	void StartVoice(std::shared_ptr<const Sound> sound)
+	{
+		/* Takes a free voice, or if there is none, the one that has been playing for the longest. */
+		SDL_LockAudioDevice(audio_device_id);
+		Voice* chosen_voice = &voices[0];
+		for (Voice& voice : voices) {
+			if (!voice.sound || voice.position >= voice.sound->samples.size()) {
+				chosen_voice = &voice;
+				break;
+			}
+			if (voice.position > chosen_voice->position) {
+				chosen_voice = &voice;
+			}
+		}
+		std::swap(chosen_voice->sound, sound);
+		chosen_voice->position = 0;
+		SDL_UnlockAudioDevice(audio_device_id);
+		/* 'sound' now holds the sound that the voice played before, which is released here rather than on
+		   the audio thread. */
+	}
+
+
+	void SuppressOutput(bool suppress)
+	{
+		output_is_suppressed = suppress;
+	}
+
+
+	void UpdateRateControl()
+	{
+		frames_since_rate_control_update = 0;
+		f64 fill_level = f64(sample_queue.Size() / num_output_channels);
+		smoothed_fill_level += fill_level_smoothing * (fill_level - smoothed_fill_level);
+
+		/* PI control: when the queue is below target, produce slightly more output frames per input frame so
+		   that it fills up again, and vice versa. */
+		f64 target_fill_level = std::max(f64(target_latency_ms.load(std::memory_order_relaxed)) * sample_rate / 1000.0, 1.0);
+		f64 error = std::clamp((target_fill_level - smoothed_fill_level) / target_fill_level, -1.0, 1.0);
+		rate_control_integral = std::clamp(rate_control_integral + rate_control_integral_gain * error,
+			-max_rate_adjustment, max_rate_adjustment);
+		f64 rate_adjustment = std::clamp(max_rate_adjustment * error + rate_control_integral,
+			-max_rate_adjustment, max_rate_adjustment);
+		resampler.SetRateAdjustment(rate_adjustment);
+
+		stats_fill_level_ms.store(f32(smoothed_fill_level * 1000.0 / sample_rate), std::memory_order_relaxed);
+		stats_rate_adjustment.store(rate_adjustment, std::memory_order_relaxed);
+	}
 }
\ No newline at end of file
@@ -1,45 +1,199 @@
 export module Audio;
 
+import Resampler;
+import RingBuffer;
 import Types;
 
 import <SDL.h>;
-import <SDL_mixer.h>;
 
-import <chrono>;
+import <algorithm>;
+import <array>;
+import <atomic>;
 import <cmath>;
 import <format>;
+import <map>;
+import <memory>;
+import <mutex>;
+import <optional>;
+import <span>;
+import <string>;
 import <string_view>;
-import <thread>;
+import <utility>;
 import <vector>;
 
 namespace Audio
 {
 	export
 	{
+		struct Stats
+		{
+			f32 fill_level_ms; /* smoothed amount of audio waiting in the sample queue */
+			f32 target_latency_ms;
+			f64 rate_adjustment; /* relative deviation of the resampling ratio from 1, within +-max_rate_adjustment */
+			u64 num_discarded_samples; /* samples received in headless mode */
+			u64 num_dropped_samples; /* samples dropped because the sample queue was full */
+			u64 num_underruns; /* device buffers that could not be completely filled */
+		};
+
+		/* The output is the sum of these, each with a gain of its own, soft clipped to full scale. */
+		enum class MixerChannel {
+			Core,    /* the samples of the running core */
+			Effects, /* files played with 'PlayFile' */
+			Streams, /* secondary streams; see 'OpenStream' */
+			Count
+		};
+
+		/* Takes the samples of a core that does not run on the emulation thread; see 'Video::FrameSink'.
+		   While a sink is set for a thread, samples enqueued on it are only counted. */
+		struct SampleSink
+		{
+			u64 num_samples;
+		};
+
 		void CloseFile();
+		void CloseStream(uint stream);
 		void EnqueueSample(f32 sample);
+		void EnqueueSamples(std::span<const f32> samples);
+		void EnqueueSamples(std::span<const s16> samples);
 		void Exit();
+		f32 GetMixerChannelGain(MixerChannel channel);
+		Resampler::Quality GetResamplingQuality();
 		uint GetSampleRate();
+		Stats GetStats();
 		bool Initialize();
+		bool InitializeHeadless(bool capture_samples = false);
+		bool OpenDevice(std::string& error);
 		void OpenFileForPlaying(std::string_view path);
+		std::optional<uint> OpenStream();
 		void PlayFile();
 		void PlayFile(std::string_view path);
+		size_t PushStreamSamples(uint stream, std::span<const f32> samples);
+		size_t ReadSamples(std::span<f32> samples);
+		void SetInputSampleRate(f64 sample_rate);
+		void SetMixerChannelGain(MixerChannel channel, f32 gain);
 		void SetNumberOfOutputChannels(uint num_channels);
+		void SetResamplingQuality(Resampler::Quality quality);
 		void SetSampleBufferSizePerChannel(uint buffer_size);
 		void SetSampleRate(uint sample_rate);
+		void SetThreadSampleSink(SampleSink* sink);
+		void SetTargetLatency(uint milliseconds);
+		void SuppressOutput(bool suppress);
 	}
 
-	uint microsecs_per_audio_enqueue;
+	/* A file decoded in full and converted to the device format when it is opened, so that playing it is
+	   only a matter of mixing it in. */
+	struct Sound
+	{
+		std::vector<f32> samples; /* interleaved */
+	};
+
+	void AddSamples(std::span<const f32> source, std::span<f32> target);
+	void SDLCALL AudioCallback(void* userdata, u8* stream, int len);
+	void FlushResampledFrames();
+	std::shared_ptr<const Sound> LoadSound(std::string_view path);
+	void MixChannels(std::span<f32> core, std::span<const f32> effects, std::span<const f32> streamed);
+	void MixInto(std::span<f32> output);
+	size_t PushFrames(RingBuffer<f32>& queue, std::span<const f32> samples);
+	void Resample(std::span<const f32> samples);
+	void ResetResampler();
+	void ResizeSampleQueue();
+	f32 SoftClip(f32 sample);
+	void StartVoice(std::shared_ptr<const Sound> sound);
+	void UpdateRateControl();
+
+	/* The minimum number of sample frames (one sample per channel) that 'sample_queue' can hold, expressed
+	   in multiples of the device buffer size and of the largest target latency, respectively. The queue is
+	   sized for the largest target latency, so that the target can be changed while the core is running. */
+	constexpr uint sample_queue_size_in_device_buffers = 16;
+	constexpr uint sample_queue_size_in_target_latencies = 2;
+	constexpr uint max_target_latency_ms = 250;
+
+	/* Dynamic rate control: the core's samples are resampled by a ratio that is nudged by at most this much
+	   in either direction, depending on how far the queue fill level is from the target latency. 0.5% is
+	   well below what is audible as a change in pitch. */
+	constexpr f64 max_rate_adjustment = 0.005;
+	/* Weight of each new measurement in the moving average of the fill level. The device drains the queue
+	   a whole buffer at a time, so the raw level is a sawtooth that must be smoothed before acting on it. */
+	constexpr f64 fill_level_smoothing = 0.05;
+	/* Gain of the integral term, per update. The proportional term alone leaves a constant offset from the
+	   target whenever the core and the device clocks drift apart; the integral term removes it over a few
+	   seconds. */
+	constexpr f64 rate_control_integral_gain = 0.00002;
+	constexpr uint rate_control_updates_per_second = 60;
+	constexpr uint default_num_output_channels = 2;
+	constexpr uint default_sample_buffer_size_per_channel = 512;
+	constexpr uint default_sample_rate = 44100;
+	constexpr uint default_target_latency_ms = 32;
+	constexpr uint max_output_channels = 8;
+
+	bool discard_samples; /* headless, and samples are not captured for 'ReadSamples' */
+	bool is_headless; /* no audio device is open */
+	bool output_is_suppressed; /* samples from the core are ignored, e.g. while running ahead; only touched on the emulation thread */
+
 	uint num_output_channels;
-	uint sample_buffer_index;
+	uint rate_control_interval; /* in sample frames */
 	uint sample_buffer_size_per_channel;
 	uint sample_rate;
+	std::atomic<uint> target_latency_ms = default_target_latency_ms;
+
+	/* Resampler state; only touched on the emulation thread. The core's samples are converted from its own
+	   sample rate to that of the device, and the ratio is adjusted slightly by rate control. */
+	uint frames_since_rate_control_update; /* output frames */
+	f64 rate_control_integral;
+	f64 smoothed_fill_level;
+	std::array<f32, 1024> resampled_frames;
+	uint num_resampled_samples;
+	Resampler resampler;
+
+	/* Set from any thread; applied by 'Resample' before the next samples are converted. */
+	std::atomic<f64> input_sample_rate; /* 0 if the core produces samples at the device rate */
+	std::atomic<Resampler::Quality> resampling_quality = Resampler::Quality::Medium;
+
+	std::atomic<f32> stats_fill_level_ms;
+	std::atomic<f64> stats_rate_adjustment;
+	std::atomic<u64> num_discarded_samples; /* in headless mode */
+	std::atomic<u64> num_dropped_samples;
+	std::atomic<u64> num_underruns;
+
+	bool device_is_starved; /* only touched on the audio thread */
+
+	struct Voice
+	{
+		std::shared_ptr<const Sound> sound;
+		size_t position; /* the next sample to be mixed; the voice is free once it reaches the end */
+	};
+
+	constexpr uint max_voices = 16;
+	constexpr uint max_streams = 4;
+	/* Samples below this level pass through the mixer unchanged; above it, they are bent smoothly towards
+	   full scale, which is approached but never reached. */
+	constexpr f32 soft_clip_knee = 0.8f;
+
+	std::array<std::atomic<f32>, size_t(MixerChannel::Count)> mixer_channel_gains = { 1.0f, 1.0f, 1.0f };
+
+	/* Only changed while the device is locked, and mixed in by 'AudioCallback'. Sounds are never released
+	   on the audio thread; a voice keeps its sound until the voice is taken for another one. */
+	std::array<Voice, max_voices> voices;
+	std::array<bool, max_streams> stream_is_open;
+	/* Interleaved samples of secondary streams, at the device rate; like 'sample_queue', each is pushed to
+	   by one thread and popped in 'AudioCallback'. */
+	std::array<RingBuffer<f32>, max_streams> streams;
+
+	/* Scratch buffers of the audio thread, sized to one device buffer in 'OpenDevice'. */
+	std::vector<f32> effects_mix;
+	std::vector<f32> streams_mix;
+	std::vector<f32> stream_samples;
 
-	Mix_Chunk* mixer_last_opened_file = nullptr;
+	/* Opened files by path, so that a file is only read and decoded the first time that it is played. */
+	std::mutex sound_cache_mutex;
+	std::map<std::string, std::shared_ptr<const Sound>, std::less<>> sound_cache;
+	std::shared_ptr<const Sound> last_opened_sound;
 
 	SDL_AudioDeviceID audio_device_id;
 
-	std::vector<f32> sample_buffer;
+	/* Interleaved samples produced by the core on the emulation thread, consumed by the SDL audio thread
+	   in 'AudioCallback'. If the queue is full, new samples are dropped rather than waiting for space. */
+	RingBuffer<f32> sample_queue;
 
-	std::chrono::steady_clock::time_point last_audio_enqueue_time_point;
+	thread_local SampleSink* sample_sink;
 }
\ No newline at end of file
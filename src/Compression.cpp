@@ -0,0 +1,366 @@
+module Compression;
+
+namespace Compression
+{
+	void BitReader::Consume(uint count)
+	{
+		bits >>= count;
+		num_bits -= count;
+	}
+
+
+	bool BitReader::HasOverrun() const
+	{
+		/* True if more bits have been consumed than the input holds. */
+		return position * 8 - num_bits > input.size() * 8;
+	}
+
+
+	u64 BitReader::Peek(uint count) const
+	{
+		return bits & ((u64(1) << count) - 1);
+	}
+
+
+	u64 BitReader::Read(uint count)
+	{
+		if (num_bits < count) {
+			Refill();
+		}
+		u64 value = Peek(count);
+		Consume(count);
+		return value;
+	}
+
+
+	void BitReader::Refill()
+	{
+		/* Leaves at least 57 bits in the buffer, enough for a length and a distance with their extra bits. */
+		while (num_bits <= 56) {
+			u64 byte = position < input.size() ? input[position] : 0;
+			bits |= byte << num_bits;
+			++position;
+			num_bits += 8;
+		}
+	}
+
+
+	bool Huffman::Build(std::span<const u8> code_lengths)
+	{
+		/* Fails if the lengths describe more codes than fit in their bits. Incomplete codes are accepted;
+		   DEFLATE uses them for distance codes with a single symbol. */
+		counts.fill(0);
+		for (u8 length : code_lengths) {
+			++counts[length];
+		}
+		counts[0] = 0;
+		int num_unused_codes = 1;
+		for (uint length = 1; length <= huffman_max_bits; ++length) {
+			num_unused_codes = 2 * num_unused_codes - counts[length];
+			if (num_unused_codes < 0) {
+				return false;
+			}
+		}
+		std::array<u16, huffman_max_bits + 1> offsets;
+		offsets[1] = 0;
+		for (uint length = 1; length < huffman_max_bits; ++length) {
+			offsets[length + 1] = offsets[length] + counts[length];
+		}
+		for (size_t symbol = 0; symbol < code_lengths.size(); ++symbol) {
+			if (code_lengths[symbol] != 0) {
+				symbols[offsets[code_lengths[symbol]]++] = u16(symbol);
+			}
+		}
+		/* The codes are stored starting with their most significant bit, but the bit reader yields the
+		   least significant bit first, so the table is indexed by the reversed code. */
+		fast_table.fill(0);
+		uint code = 0;
+		uint index = 0;
+		for (uint length = 1; length <= huffman_fast_bits; ++length) {
+			for (uint i = 0; i < counts[length]; ++i) {
+				uint reversed_code = 0;
+				for (uint bit = 0; bit < length; ++bit) {
+					reversed_code |= (code >> bit & 1) << (length - 1 - bit);
+				}
+				u16 entry = u16(symbols[index++] << 4 | length);
+				for (uint j = reversed_code; j < fast_table.size(); j += 1 << length) {
+					fast_table[j] = entry;
+				}
+				++code;
+			}
+			code <<= 1;
+		}
+		return true;
+	}
+
+
+	int Huffman::Decode(BitReader& reader) const
+	{
+		/* Returns -1 for a code that is not part of an incomplete code. The caller refills the reader. */
+		if (u16 entry = fast_table[reader.Peek(huffman_fast_bits)]) {
+			reader.Consume(entry & 15);
+			return entry >> 4;
+		}
+		u64 peeked_bits = reader.Peek(huffman_max_bits);
+		int code = 0;
+		int first_code = 0; /* of the current length */
+		int index = 0; /* into 'symbols', of the first code of the current length */
+		for (uint length = 1; length <= huffman_max_bits; ++length) {
+			code |= int(peeked_bits >> (length - 1) & 1);
+			int count = counts[length];
+			if (code - first_code < count) {
+				reader.Consume(length);
+				return symbols[index + code - first_code];
+			}
+			index += count;
+			first_code = (first_code + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+
+
+	bool Inflate(std::span<const u8> input, std::span<u8> output, const ProgressCallback& on_progress)
+	{
+		/* Fails if the input is malformed, or does not decompress to exactly the size of 'output'. */
+		static const std::array<Huffman, 2> fixed_codes = [] {
+			std::array<u8, 288> literal_lengths;
+			std::fill(literal_lengths.begin(), literal_lengths.begin() + 144, u8(8));
+			std::fill(literal_lengths.begin() + 144, literal_lengths.begin() + 256, u8(9));
+			std::fill(literal_lengths.begin() + 256, literal_lengths.begin() + 280, u8(7));
+			std::fill(literal_lengths.begin() + 280, literal_lengths.end(), u8(8));
+			std::array<u8, 30> distance_lengths;
+			distance_lengths.fill(5);
+			std::array<Huffman, 2> codes;
+			codes[0].Build(literal_lengths);
+			codes[1].Build(distance_lengths);
+			return codes;
+		}();
+
+		BitReader reader{ .input = input };
+		size_t output_position = 0;
+		size_t next_progress_report = inflate_progress_interval;
+		bool is_final_block = false;
+		while (!is_final_block) {
+			reader.Refill();
+			is_final_block = reader.Read(1) != 0;
+			switch (reader.Read(2)) {
+			case 0: { /* stored */
+				/* Skip to the next byte boundary, and read straight from the input from there on. */
+				reader.Consume(reader.num_bits % 8);
+				size_t position = reader.position - reader.num_bits / 8;
+				reader.bits = 0;
+				reader.num_bits = 0;
+				if (position > input.size() || input.size() - position < 4) {
+					return false;
+				}
+				size_t length = input[position] | input[position + 1] << 8;
+				size_t inverted_length = input[position + 2] | input[position + 3] << 8;
+				position += 4;
+				if (length != (~inverted_length & 0xFFFF) || length > input.size() - position
+					|| length > output.size() - output_position) {
+					return false;
+				}
+				std::copy_n(input.data() + position, length, output.data() + output_position);
+				output_position += length;
+				reader.position = position + length;
+				break;
+			}
+
+			case 1: /* fixed codes */
+				if (!InflateBlock(reader, fixed_codes[0], fixed_codes[1], output, output_position)) {
+					return false;
+				}
+				break;
+
+			case 2: { /* dynamic codes */
+				Huffman literals, distances;
+				if (!InflateDynamicTables(reader, literals, distances)
+					|| !InflateBlock(reader, literals, distances, output, output_position)) {
+					return false;
+				}
+				break;
+			}
+
+			default:
+				return false;
+			}
+			if (on_progress && output_position >= next_progress_report) {
+				if (!on_progress(output_position)) {
+					return false;
+				}
+				next_progress_report = output_position + inflate_progress_interval;
+			}
+		}
+		return output_position == output.size();
+	}
+
+
+	bool InflateBlock(BitReader& reader, const Huffman& literals, const Huffman& distances, std::span<u8> output,
+		size_t& output_position)
+	{
+		while (true) {
+			reader.Refill();
+			int symbol = literals.Decode(reader);
+			if (symbol < 0) {
+				return false;
+			}
+			if (symbol < 256) {
+				if (output_position == output.size()) {
+					return false;
+				}
+				output[output_position++] = u8(symbol);
+				continue;
+			}
+			if (symbol == 256) {
+				return !reader.HasOverrun();
+			}
+			uint length_symbol = symbol - 257;
+			if (length_symbol >= length_bases.size()) {
+				return false;
+			}
+			size_t length = length_bases[length_symbol] + reader.Read(length_extra_bits[length_symbol]);
+			int distance_symbol = distances.Decode(reader);
+			if (distance_symbol < 0 || distance_symbol >= int(distance_bases.size())) {
+				return false;
+			}
+			size_t distance = distance_bases[distance_symbol] + reader.Read(distance_extra_bits[distance_symbol]);
+			if (distance > output_position || length > output.size() - output_position) {
+				return false;
+			}
+			/* A match may overlap its own output, e.g. a run of one repeated byte has a distance of 1. */
+			u8* target = output.data() + output_position;
+			const u8* source = target - distance;
+			if (distance >= length) {
+				std::memcpy(target, source, length);
+			}
+			else {
+				for (size_t i = 0; i < length; ++i) {
+					target[i] = source[i];
+				}
+			}
+			output_position += length;
+		}
+	}
+
+
+	bool InflateDynamicTables(BitReader& reader, Huffman& literals, Huffman& distances)
+	{
+		uint num_literal_codes = uint(reader.Read(5)) + 257;
+		uint num_distance_codes = uint(reader.Read(5)) + 1;
+		uint num_code_length_codes = uint(reader.Read(4)) + 4;
+		if (num_literal_codes > 286 || num_distance_codes > 30) {
+			return false;
+		}
+		std::array<u8, 19> code_length_code_lengths{};
+		for (uint i = 0; i < num_code_length_codes; ++i) {
+			code_length_code_lengths[code_length_order[i]] = u8(reader.Read(3));
+		}
+		Huffman code_length_code;
+		if (!code_length_code.Build(code_length_code_lengths)) {
+			return false;
+		}
+		/* The lengths of both codes form one sequence, in which runs may cross from one code to the other. */
+		std::array<u8, 286 + 30> code_lengths{};
+		uint num_code_lengths = num_literal_codes + num_distance_codes;
+		uint index = 0;
+		while (index < num_code_lengths) {
+			reader.Refill();
+			int symbol = code_length_code.Decode(reader);
+			if (symbol < 0) {
+				return false;
+			}
+			if (symbol < 16) {
+				code_lengths[index++] = u8(symbol);
+				continue;
+			}
+			u8 repeated_length = 0;
+			uint num_repeats;
+			if (symbol == 16) {
+				if (index == 0) {
+					return false;
+				}
+				repeated_length = code_lengths[index - 1];
+				num_repeats = 3 + uint(reader.Read(2));
+			}
+			else if (symbol == 17) {
+				num_repeats = 3 + uint(reader.Read(3));
+			}
+			else {
+				num_repeats = 11 + uint(reader.Read(7));
+			}
+			if (num_repeats > num_code_lengths - index) {
+				return false;
+			}
+			std::fill_n(code_lengths.begin() + index, num_repeats, repeated_length);
+			index += num_repeats;
+		}
+		if (code_lengths[256] == 0) {
+			return false; /* there must be an end-of-block code */
+		}
+		std::span<const u8> all_lengths = code_lengths;
+		return literals.Build(all_lengths.first(num_literal_codes))
+			&& distances.Build(all_lengths.subspan(num_literal_codes, num_distance_codes))
+			&& !reader.HasOverrun();
+	}
+
+
+	void RleCompress(std::span<const u8> input, std::vector<u8>& output)
+	{
+		output.clear();
+		output.reserve(input.size() + input.size() / max_literal_length + 1);
+		size_t index = 0;
+		while (index < input.size()) {
+			size_t run_length = 1;
+			while (index + run_length < input.size() && run_length < max_run_length
+				&& input[index + run_length] == input[index]) {
+				++run_length;
+			}
+			if (run_length >= min_run_length) {
+				output.push_back(u8(run_length + 126));
+				output.push_back(input[index]);
+				index += run_length;
+				continue;
+			}
+			/* Gather literals until the next run that is long enough to be worth a packet of its own. */
+			size_t literal_start = index;
+			while (index < input.size() && index - literal_start < max_literal_length) {
+				if (index + 2 < input.size() && input[index] == input[index + 1] && input[index] == input[index + 2]) {
+					break;
+				}
+				++index;
+			}
+			output.push_back(u8(index - literal_start - 1));
+			output.insert(output.end(), input.begin() + literal_start, input.begin() + index);
+		}
+	}
+
+
+	bool RleDecompress(std::span<const u8> input, std::span<u8> output)
+	{
+		/* Fails if the input is malformed, or does not decompress to exactly the size of 'output'. */
+		size_t input_index = 0;
+		size_t output_index = 0;
+		while (input_index < input.size()) {
+			u8 control = input[input_index++];
+			if (control < 128) {
+				size_t length = size_t(control) + 1;
+				if (length > input.size() - input_index || length > output.size() - output_index) {
+					return false;
+				}
+				std::memcpy(output.data() + output_index, input.data() + input_index, length);
+				input_index += length;
+				output_index += length;
+			}
+			else {
+				size_t length = size_t(control) - 126;
+				if (input_index == input.size() || length > output.size() - output_index) {
+					return false;
+				}
+				std::memset(output.data() + output_index, input[input_index++], length);
+				output_index += length;
+			}
+		}
+		return output_index == output.size();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+export module Compression;
+
+import Types;
+
+import <algorithm>;
+import <array>;
+import <cstring>;
+import <functional>;
+import <span>;
+import <vector>;
+
+namespace Compression
+{
+	export
+	{
+		/* Called now and then during 'Inflate' with the number of bytes output so far; returning false
+		   aborts the decompression. */
+		using ProgressCallback = std::function<bool(size_t num_output_bytes)>;
+
+		bool Inflate(std::span<const u8> input, std::span<u8> output, const ProgressCallback& on_progress = {});
+		void RleCompress(std::span<const u8> input, std::vector<u8>& output);
+		bool RleDecompress(std::span<const u8> input, std::span<u8> output);
+	}
+
+	/* A raw DEFLATE stream (RFC 1951), as found in zip files, read through a 64-bit bit buffer that is
+	   refilled a byte at a time. Reads past the end of the input produce zeroes and are counted, so that
+	   decoding never needs to check for the end of the input per symbol; the overrun is checked per block. */
+	struct BitReader
+	{
+		std::span<const u8> input;
+		size_t position = 0; /* of the next byte to go into 'bits', possibly beyond the end of 'input' */
+		u64 bits = 0;
+		uint num_bits = 0;
+
+		void Consume(uint count);
+		bool HasOverrun() const;
+		u64 Peek(uint count) const;
+		u64 Read(uint count);
+		void Refill();
+	};
+
+	/* A canonical Huffman code. Codes of up to 'huffman_fast_bits' bits are decoded by a single table
+	   lookup; longer ones, which are rare, are decoded a bit at a time from the code counts. */
+	constexpr uint huffman_fast_bits = 10;
+	constexpr uint huffman_max_bits = 15;
+
+	struct Huffman
+	{
+		std::array<u16, huffman_max_bits + 1> counts; /* the number of codes of each length */
+		std::array<u16, 288> symbols; /* ordered by code */
+		std::array<u16, 1 << huffman_fast_bits> fast_table; /* symbol << 4 | code length; 0 if longer */
+
+		bool Build(std::span<const u8> code_lengths);
+		int Decode(BitReader& reader) const;
+	};
+
+	bool InflateBlock(BitReader& reader, const Huffman& literals, const Huffman& distances, std::span<u8> output,
+		size_t& output_position);
+	bool InflateDynamicTables(BitReader& reader, Huffman& literals, Huffman& distances);
+
+	constexpr size_t inflate_progress_interval = 1 << 20; /* output bytes between calls to the progress callback */
+
+	constexpr std::array<u16, 29> length_bases = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+	};
+	constexpr std::array<u8, 29> length_extra_bits = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+	};
+	constexpr std::array<u16, 30> distance_bases = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+		4097, 6145, 8193, 12289, 16385, 24577
+	};
+	constexpr std::array<u8, 30> distance_extra_bits = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+	};
+	/* The order in which the lengths of the code length code are stored. */
+	constexpr std::array<u8, 19> code_length_order = {
+		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+	};
+
+	/* Run-length encoding in the style of PackBits. Each packet starts with a control byte 'c':
+	   - c < 128: the next c + 1 bytes are copied as they are.
+	   - c >= 128: the next byte is repeated c - 126 times.
+	   Emulator states are mostly zero-filled or otherwise repetitive memory, which this shrinks well at a
+	   speed close to that of a copy, and it can never grow the input by more than one byte in 128. */
+	constexpr size_t max_literal_length = 128;
+	constexpr size_t min_run_length = 3;
+	constexpr size_t max_run_length = 129;
+}
\ No newline at end of file
@@ -1,27 +1,64 @@
 export module Core;
 
+import <cstddef>;
+import <cstdint>;
+import <span>;
 import <string>;
 import <string_view>;
 import <vector>;
 
+/* What a core produced during one call to 'Core::RunFrame'. The spans refer to memory owned by the core,
+   which it may reuse once it runs again. */
+export struct FrameOutput
+{
+	/* The frame, in the format last given to 'Video::SetPixelFormat'. Empty if the core produced no new
+	   image, in which case the previous one stays on screen. Rendering into 'Video::GetFramebufferPtr' and
+	   returning a view of that memory saves the frontend a copy. */
+	std::span<const std::uint8_t> pixels;
+	unsigned width, height;
+	unsigned pitch; /* in bytes */
+	/* Interleaved samples, as for 'Audio::EnqueueSamples'; at most one of the two is used. */
+	std::span<const float> audio_samples_f32;
+	std::span<const std::int16_t> audio_samples_s16;
+	/* Emulated time covered by the frame, for frame pacing; 0 means 1 / 'Core::GetRefreshRate'. */
+	double duration_s;
+};
+
+
+/* Cores implement either 'Run', which runs for "some amount of time" and hands video and audio to the
+   frontend through 'Video' and 'Audio' as they are produced, or 'RunFrame' along with 'SupportsRunFrame',
+   which runs exactly one frame and hands it back all at once. */
 export struct Core
 {
+	/* Called when the device sample rate ('Audio::GetSampleRate') changes. Cores with a native sample rate of
+	   their own can ignore it, and pass that rate to 'Audio::SetInputSampleRate' instead. */
 	virtual void ApplyNewSampleRate() = 0;
 	virtual void Detach() = 0;
 	virtual void DisableAudio() = 0;
 	virtual void EnableAudio() = 0;
 	virtual std::vector<std::string_view> GetActionNames() = 0;
 	virtual unsigned GetNumberOfInputs() = 0;
+	virtual double GetRefreshRate() { return 60.0; }; /* native video refresh rate (Hz), used for frame pacing */
+	virtual std::size_t GetStateSize() { return 0; }; /* size of an in-memory state snapshot; 0 if snapshots are not supported */
 	virtual void Initialize() = 0;
 	virtual bool LoadBios(const std::string& path) = 0;
 	virtual bool LoadRom(const std::string& path) = 0;
+	/* For cores that set 'SupportsLoadRomFromMemory': the rom image itself, instead of its path. The memory
+	   is read-only, and stays valid until the next rom is loaded. 'name' is the file name of the rom, which
+	   may have been inside an archive. */
+	virtual bool LoadRomFromMemory(std::span<const std::uint8_t> rom, const std::string& name) { return false; };
 	virtual void LoadState() {};
+	virtual bool LoadStateFromMemory(std::span<const std::uint8_t> state) { return false; };
 	virtual void NotifyNewAxisValue(unsigned player_index, unsigned action_index, int new_axis_value) {};
 	virtual void NotifyButtonPressed(unsigned player_index, unsigned action_index) = 0;
 	virtual void NotifyButtonReleased(unsigned player_index, unsigned action_index) = 0;
 	virtual void Reset() = 0;
-	virtual void Run() = 0;
+	virtual void Run() {};
+	virtual void RunFrame(FrameOutput& output) {};
 	virtual void SaveState() {};
+	virtual bool SaveStateToMemory(std::span<std::uint8_t> state) { return false; };
+	virtual bool SupportsLoadRomFromMemory() { return false; };
+	virtual bool SupportsRunFrame() { return false; };
 
 	void SetupCommunicationWithFrontend();
 };
\ No newline at end of file
@@ -1,7 +1,12 @@
 module Emulator;
 
 import Audio;
+import FramePacer;
 import Input;
+import Movie;
+import Profiler;
+import Rewind;
+import StateStorage;
 import UserMessage;
 import Video;
 
@@ -13,93 +18,493 @@ namespace Emulator
 	}
 
 
+	void DisableRewind()
+	{
+		rewind_is_enabled = false;
+	}
+
+
+	void EmulationThreadMain(std::stop_token stop_token)
+	{
+		while (!stop_token.stop_requested()) {
+			/* Read before taking the commands, so that one sent in the meantime ends the wait below at once. */
+			u32 prev_num_sent_commands = num_sent_commands.load(std::memory_order_acquire);
+			ProcessCommands();
+			if (is_running && !is_paused) {
+				RunIteration();
+			}
+			else {
+				num_sent_commands.wait(prev_num_sent_commands, std::memory_order_acquire);
+			}
+		}
+	}
+
+
 	void EnableAudio()
 	{
 		core->EnableAudio();
 	}
 
 
+	void EnableRewind()
+	{
+		rewind_is_enabled = true;
+	}
+
+
 	std::shared_ptr<Core> GetCore()
 	{
 		return core;
 	}
 
 
-	std::string GetSaveStatePath()
+	u64 GetFrameCount()
+	{
+		return frame_count.load(std::memory_order_relaxed);
+	}
+
+
+	RunAheadStats GetRunAheadStats()
+	{
+		f32 time_ms = run_ahead_time_ms.load(std::memory_order_relaxed);
+		f32 target_frame_time_ms = FramePacer::GetStats().target_frame_time_ms;
+		return {
+			.num_frames = run_ahead_frames.load(std::memory_order_relaxed),
+			.time_ms = time_ms,
+			.frame_budget_usage = target_frame_time_ms > 0.0f ? time_ms / target_frame_time_ms : 0.0f
+		};
+	}
+
+
+	std::string GetMoviePath()
+	{
+		return (std::filesystem::path(movie_directory) / std::format("{}.movie", current_rom_name)).string();
+	}
+
+
+	std::string GetSaveStatePath(uint slot)
 	{
-		// TODO
-		return {};
+		return (std::filesystem::path(save_state_directory) / std::format("{}.state{}", current_rom_name, slot)).string();
+	}
+
+
+	std::shared_ptr<Core> GetSecondaryCore()
+	{
+		return secondary_core;
 	}
 
 
 	bool LoadBios(const std::string& bios_path)
 	{
+		if (secondary_core && !secondary_core->LoadBios(bios_path)) {
+			secondary_core.reset();
+		}
 		return core->LoadBios(bios_path);
 	}
 
 
 	bool LoadRom(const std::string& rom_path)
 	{
-		return core->LoadRom(rom_path);
+		/* Reads the rom on the calling thread, while the game is not running; see also 'StartGame'. Tells
+		   the user if it fails. */
+		std::string error;
+		std::shared_ptr<const RomLoader::Rom> rom = RomLoader::Load(rom_path, error);
+		if (!rom) {
+			UserMessage::Show(std::format("Could not read rom at path \"{}\": {}.", rom_path, error),
+				UserMessage::Type::Warning);
+			return false;
+		}
+		if (!LoadRomIntoCores(std::move(rom))) {
+			UserMessage::Show(std::format("Could not load rom at path \"{}\"", rom_path),
+				UserMessage::Type::Warning);
+			return false;
+		}
+		return true;
 	}
 
 
-	void LockFramerate()
+	bool LoadRomIntoCores(std::shared_ptr<const RomLoader::Rom> rom)
 	{
+		/* Cores that take a path are given the file itself, or, for a rom that was inside an archive, a copy
+		   of it unpacked to a temporary file. */
+		std::string path = rom->path;
+		auto LoadInto = [&](Core& target) {
+			if (target.SupportsLoadRomFromMemory()) {
+				return target.LoadRomFromMemory(rom->data, rom->name);
+			}
+			if (rom->is_from_archive && path == rom->path) {
+				std::optional<std::filesystem::path> copy_path = RomLoader::WriteTemporaryCopy(*rom);
+				if (!copy_path) {
+					return false;
+				}
+				path = copy_path->string();
+			}
+			return target.LoadRom(path);
+		};
+		/* The primary core goes first, so that the secondary one is left on the rom that is still loaded
+		   should it fail. */
+		if (!LoadInto(*core)) {
+			return false;
+		}
+		if (secondary_core && !LoadInto(*secondary_core)) {
+			secondary_core.reset();
+		}
+		/* The previous rom is no longer loaded, so neither are any copies of it. */
+		RomLoader::DeleteTemporaryCopies(path);
+		current_rom = std::move(rom);
+		current_rom_path = current_rom->path;
+		current_rom_name = std::filesystem::path(current_rom->path).stem().string();
+		return true;
+	}
 
+
+	void LoadState(uint slot)
+	{
+		/* A movie would no longer replay the way it was recorded. */
+		Movie::Stop();
+		SendCommand(CommandType::LoadState, slot);
 	}
 
 
-	void Loop()
+	bool LoadStateFromFile(uint slot)
 	{
-		is_running = true;
-		is_paused = false;
-		while (is_running && !is_paused) {
-			// Run the core for "some amount of time".
-			// The core itself should be telling the audio and video frontends what to do.
-			core->Run();
+		size_t state_size = core->GetStateSize();
+		if (state_size == 0) {
+			/* Cores without in-memory states take care of save states by themselves. */
+			core->LoadState();
+			return true;
+		}
+		std::string path = GetSaveStatePath(slot);
+		std::vector<u8> state = StateStorage::AcquireBuffer(state_size);
+		bool success = StateStorage::Load(path, state) && core->LoadStateFromMemory(state);
+		StateStorage::ReleaseBuffer(std::move(state));
+		if (!success) {
+			UserMessage::Post(std::format("Could not load state from {}.", path), UserMessage::Type::Warning);
 		}
+		return success;
 	}
 
 
-	void LoadState()
+	void LockFramerate()
 	{
-		if (!is_running) {
-			return;
+		FramePacer::SetUncapped(false);
+	}
+
+
+	void OnNewGameFrame()
+	{
+		/* Called on the emulation thread every time the core has completed a frame. */
+		++num_core_frames;
+		if (is_running_ahead) {
+			return; /* Speculative frames are neither paced nor counted, and take no new input. */
 		}
-		core->LoadState();
+		frame_count.fetch_add(1, std::memory_order_relaxed);
+		FramePacer::WaitForNextFrame();
+		/* Latch input as late as possible before the next frame starts. */
+		Input::OnNewFrame();
 	}
 
 
 	void Pause()
 	{
-		is_paused = true;
+		SendCommand(CommandType::Pause);
 	}
 
 
-	void Reset()
+	bool PlayMovie()
+	{
+		/* Plays back the movie recorded last for the current rom, from where its recording started. */
+		return Movie::StartPlayback(GetMoviePath());
+	}
+
+
+	bool PopCommand(Command& command)
+	{
+		std::lock_guard lock{ command_queue_mutex };
+		if (command_queue.empty()) {
+			return false;
+		}
+		command = command_queue.front();
+		command_queue.pop_front();
+		return true;
+	}
+
+
+	bool PrepareRunAhead()
 	{
-		if (is_running) {
-			core->Reset();
-			Loop();
+		size_t state_size = core->GetStateSize();
+		if (state_size == 0) {
+			StopRunAhead("The core does not support in-memory save states.");
+			return false;
 		}
+		if (run_ahead_state.size() != state_size) {
+			run_ahead_state.resize(state_size);
+		}
+		return true;
+	}
+
+
+	void ProcessCommands()
+	{
+		/* Called on the emulation thread, between frames. */
+		Command command;
+		while (PopCommand(command)) {
+			switch (command.type) {
+			case CommandType::LoadRom: {
+				std::shared_ptr<const RomLoader::Rom> rom;
+				{
+					std::lock_guard lock{ pending_rom_mutex };
+					rom = std::move(pending_rom);
+				}
+				if (!rom) {
+					break;
+				}
+				is_running = false;
+				std::string rom_path = rom->path;
+				if (!LoadRomIntoCores(std::move(rom))) {
+					UserMessage::Post(std::format("Could not load rom at path \"{}\"", rom_path),
+						UserMessage::Type::Warning);
+					break;
+				}
+				/* The rewind buffer holds states of the previous game. */
+				Rewind::Clear();
+				rewind_buffer_is_active = false;
+				is_running = true;
+				StartRunning();
+				break;
+			}
+
+			case CommandType::LoadState:
+				if (is_running) {
+					LoadStateFromFile(command.slot);
+				}
+				break;
+
+			case CommandType::Pause:
+				is_paused = true;
+				break;
+
+			case CommandType::Reset:
+				if (is_running) {
+					if (secondary_core) {
+						secondary_core->Reset();
+					}
+					core->Reset();
+					StartRunning();
+				}
+				break;
+
+			case CommandType::Resume:
+				if (is_running && is_paused) {
+					StartRunning();
+				}
+				break;
+
+			case CommandType::SaveState:
+				if (is_running) {
+					SaveStateToFile(command.slot);
+				}
+				break;
+
+			case CommandType::Start:
+				is_running = true;
+				StartRunning();
+				break;
+
+			case CommandType::Stop:
+				is_running = false;
+				break;
+
+			case CommandType::TogglePause:
+				/* Decided here rather than when the command is sent, as a command sent before it that is
+				   still queued may change whether the game is paused. */
+				if (!is_paused) {
+					is_paused = true;
+				}
+				else if (is_running) {
+					StartRunning();
+				}
+				break;
+			}
+		}
+	}
+
+
+	void RecordMovie()
+	{
+		Movie::StartRecording(GetMoviePath());
+	}
+
+
+	void Reset()
+	{
+		/* A movie would no longer replay the way it was recorded. */
+		Movie::Stop();
+		SendCommand(CommandType::Reset);
 	}
 
 
 	void Resume()
 	{
-		if (is_running) {
-			Loop();
+		SendCommand(CommandType::Resume);
+	}
+
+
+	void RewindFrame()
+	{
+		/* Step back one snapshot, and run a single frame from it, without sound, to have something to show.
+		   The rewind buffer still holds the snapshot itself, so the next step continues from there. */
+		Rewind::StepBack(*core);
+		Audio::SuppressOutput(true);
+		RunFrame(*core);
+		Audio::SuppressOutput(false);
+	}
+
+
+	void RunAhead(uint num_frames)
+	{
+		/* The real frame. Its audio is kept, and its input is latched when it completes, but its video is
+		   replaced by that of the last frame run ahead. */
+		Video::SuppressOutput(true);
+		RunFrame(*core);
+
+		Profiler::Clock::time_point run_ahead_start = Profiler::Now();
+		if (!core->SaveStateToMemory(run_ahead_state)) {
+			Video::SuppressOutput(false);
+			StopRunAhead("Could not snapshot the core state.");
+			return;
+		}
+		Core& run_ahead_core = secondary_core ? *secondary_core : *core;
+		if (secondary_core && !secondary_core->LoadStateFromMemory(run_ahead_state)) {
+			Video::SuppressOutput(false);
+			StopRunAhead("Could not load the core state into the secondary core.");
+			return;
+		}
+
+		/* Run ahead with the input that was just latched, and show only the last frame. */
+		is_running_ahead = true;
+		Audio::SuppressOutput(true);
+		for (uint i = 0; i < num_frames; ++i) {
+			Video::SuppressOutput(i + 1 < num_frames);
+			RunFrame(run_ahead_core);
+		}
+		Audio::SuppressOutput(false);
+		Video::SuppressOutput(false);
+		is_running_ahead = false;
+
+		if (!secondary_core && !core->LoadStateFromMemory(run_ahead_state)) {
+			StopRunAhead("Could not restore the core state.");
+		}
+
+		f32 time_ms = std::chrono::duration<f32, std::milli>(
+			Profiler::Record(Profiler::Stage::RunAhead, run_ahead_start) - run_ahead_start).count();
+		f32 smoothed_time_ms = run_ahead_time_ms.load(std::memory_order_relaxed);
+		run_ahead_time_ms.store(smoothed_time_ms + run_ahead_time_smoothing * (time_ms - smoothed_time_ms),
+			std::memory_order_relaxed);
+	}
+
+
+	void RunCore(Core& core)
+	{
+		if (!core.SupportsRunFrame()) {
+			// Run the core for "some amount of time".
+			// The core itself should be telling the audio and video frontends what to do.
+			core.Run();
+			return;
+		}
+		/* The frame's output is handed on in one go: the audio first, so that it is queued before the frame
+		   pacer waits, and then the video, which completes the frame. */
+		FrameOutput output{};
+		core.RunFrame(output);
+		FramePacer::SetRefreshRate(output.duration_s > 0.0 ? 1.0 / output.duration_s : core.GetRefreshRate());
+		if (!output.audio_samples_f32.empty()) {
+			Audio::EnqueueSamples(output.audio_samples_f32);
+		}
+		else if (!output.audio_samples_s16.empty()) {
+			Audio::EnqueueSamples(output.audio_samples_s16);
+		}
+		if (!output.pixels.empty()) {
+			Video::SubmitFrame(output.pixels.data(), output.width, output.height, output.pitch);
+		}
+		else {
+			OnNewGameFrame();
 		}
 	}
 
 
-	void SaveState()
+	void RunFrame(Core& core)
 	{
-		if (!is_running) {
+		/* 'Run' may complete less or more than a frame; keep calling it until at least one is done. A core
+		   may also complete none for a long time, e.g. with its display turned off, so give up as soon as a
+		   command is sent; 'Shutdown' sends one as well. Commands are only processed between iterations. */
+		u64 prev_num_core_frames = num_core_frames;
+		u32 prev_num_sent_commands = num_sent_commands.load(std::memory_order_acquire);
+		while (num_core_frames == prev_num_core_frames
+			&& num_sent_commands.load(std::memory_order_acquire) == prev_num_sent_commands) {
+			RunCore(core);
+		}
+	}
+
+
+	void RunIteration()
+	{
+		Movie::Begin(*core, secondary_core.get());
+		if (is_rewinding && rewind_buffer_is_active) {
+			RewindFrame();
 			return;
 		}
-		core->SaveState();
+		u64 prev_num_core_frames = num_core_frames;
+		uint num_run_ahead_frames = run_ahead_frames.load(std::memory_order_relaxed);
+		if (num_run_ahead_frames > 0 && PrepareRunAhead()) {
+			RunAhead(num_run_ahead_frames);
+		}
+		else {
+			RunCore(*core);
+		}
+		if (num_core_frames != prev_num_core_frames) {
+			UpdateRewind();
+		}
+	}
+
+
+	void SaveState(uint slot)
+	{
+		SendCommand(CommandType::SaveState, slot);
+	}
+
+
+	bool SaveStateToFile(uint slot)
+	{
+		size_t state_size = core->GetStateSize();
+		if (state_size == 0) {
+			/* Cores without in-memory states take care of save states by themselves. */
+			core->SaveState();
+			return true;
+		}
+		/* Only the snapshot itself happens here, into a recycled buffer; compressing and writing it is left
+		   to the i/o thread. */
+		std::vector<u8> state = StateStorage::AcquireBuffer(state_size);
+		if (!core->SaveStateToMemory(state)) {
+			StateStorage::ReleaseBuffer(std::move(state));
+			UserMessage::Post("Could not save state.", UserMessage::Type::Warning);
+			return false;
+		}
+		StateStorage::SaveAsync(std::move(state), GetSaveStatePath(slot));
+		return true;
+	}
+
+
+	void SendCommand(CommandType type, uint slot)
+	{
+		if (!emulation_thread.joinable()) {
+			emulation_thread = std::jthread{ EmulationThreadMain };
+		}
+		{
+			std::lock_guard lock{ command_queue_mutex };
+			command_queue.push_back({ .type = type, .slot = slot });
+		}
+		num_sent_commands.fetch_add(1, std::memory_order_release);
+		num_sent_commands.notify_one();
 	}
 
 
@@ -110,28 +515,125 @@ namespace Emulator
 	}
 
 
+	void SetRunAheadFrames(uint num_frames)
+	{
+		run_ahead_frames.store(std::min(num_frames, max_run_ahead_frames), std::memory_order_relaxed);
+		if (num_frames == 0) {
+			run_ahead_time_ms.store(0.0f, std::memory_order_relaxed);
+		}
+	}
+
+
+	void SetSecondaryCore(std::shared_ptr<Core> core)
+	{
+		/* 'core' must be an initialized instance of the same core as the primary one. */
+		secondary_core = std::move(core);
+	}
+
+
+	void SetSpeedMultiplier(f64 multiplier)
+	{
+		FramePacer::SetSpeedMultiplier(multiplier);
+	}
+
+
+	void Shutdown()
+	{
+		/* Waits for the current frame, if any, to complete. */
+		if (emulation_thread.joinable()) {
+			emulation_thread.request_stop();
+			num_sent_commands.fetch_add(1, std::memory_order_release);
+			num_sent_commands.notify_one();
+			emulation_thread.join();
+		}
+	}
+
+
+	void StartGame(std::shared_ptr<const RomLoader::Rom> rom)
+	{
+		/* The rom is loaded into the cores on the emulation thread, between frames, so that a game that is
+		   running need not be stopped first. */
+		Movie::Stop();
+		{
+			std::lock_guard lock{ pending_rom_mutex };
+			pending_rom = std::move(rom);
+		}
+		SendCommand(CommandType::LoadRom);
+	}
+
+
+	void StartRewinding()
+	{
+		/* A movie would no longer replay the way it was recorded. */
+		Movie::Stop();
+		is_rewinding = true;
+	}
+
+
+	void StartRunning()
+	{
+		is_paused = false;
+		/* Do not try to catch up on the time spent paused, or count it towards the next frame. */
+		FramePacer::SetRefreshRate(core->GetRefreshRate());
+		FramePacer::Reset();
+		Video::ResetCoreRunTimer();
+	}
+
+
+	void StopMovie()
+	{
+		Movie::Stop();
+	}
+
+
+	void StopRewinding()
+	{
+		is_rewinding = false;
+	}
+
+
+	void StopRunAhead(std::string_view reason)
+	{
+		run_ahead_frames.store(0, std::memory_order_relaxed);
+		run_ahead_time_ms.store(0.0f, std::memory_order_relaxed);
+		UserMessage::Post(std::format("Run-ahead was disabled. {}", reason), UserMessage::Type::Warning);
+	}
+
+
 	void StartGame()
 	{
-		Loop();
+		SendCommand(CommandType::Start);
 	}
 
 
 	void Stop()
 	{
-		is_running = false;
+		SendCommand(CommandType::Stop);
 	}
 
 
 	void TogglePaused()
 	{
-		if (is_running) {
-			is_paused = !is_paused;
-		}
+		SendCommand(CommandType::TogglePause);
 	}
 
 
 	void UnlockFramerate()
 	{
+		FramePacer::SetUncapped(true);
+	}
+
 
+	void UpdateRewind()
+	{
+		/* Called on the emulation thread after the core has completed one or more frames. */
+		if (rewind_is_enabled) {
+			Rewind::Capture(*core);
+			rewind_buffer_is_active = true;
+		}
+		else if (rewind_buffer_is_active) {
+			Rewind::Clear();
+			rewind_buffer_is_active = false;
+		}
 	}
-}
+}
\ No newline at end of file
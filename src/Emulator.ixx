@@ -1,45 +1,147 @@
 export module Emulator;
 
 import Core;
+import RomLoader;
+import Types;
 
+import <algorithm>;
 import <atomic>;
 import <cassert>;
 import <chrono>;
+import <deque>;
 import <filesystem>;
+import <format>;
 import <memory>;
+import <mutex>;
+import <optional>;
+import <span>;
+import <stop_token>;
 import <string>;
 import <string_view>;
+import <thread>;
+import <vector>;
 
 namespace Emulator
 {
 	export
 	{
+		constexpr uint max_run_ahead_frames = 4;
+		constexpr uint num_save_state_slots = 10;
+
+		struct RunAheadStats
+		{
+			uint num_frames;
+			f32 time_ms; /* moving average of the time spent per frame on snapshotting, running ahead and restoring */
+			f32 frame_budget_usage; /* 'time_ms' as a fraction of the target frame time */
+		};
+
 		void DisableAudio();
+		void DisableRewind();
 		void EnableAudio();
+		void EnableRewind();
 		std::shared_ptr<Core> GetCore();
+		u64 GetFrameCount();
+		RunAheadStats GetRunAheadStats();
+		std::shared_ptr<Core> GetSecondaryCore();
 		bool LoadBios(const std::string& bios_path);
 		bool LoadRom(const std::string& rom_path);
-		void LoadState();
+		void LoadState(uint slot = 0);
 		void LockFramerate();
+		void OnNewGameFrame();
 		void Pause();
+		bool PlayMovie();
+		void RecordMovie();
 		void Reset();
 		void Resume();
-		void SaveState();
+		void RunCore(Core& core);
+		void SaveState(uint slot = 0);
 		void SetCore(std::shared_ptr<Core> core);
+		void SetRunAheadFrames(uint num_frames);
+		void SetSecondaryCore(std::shared_ptr<Core> core);
+		void SetSpeedMultiplier(f64 multiplier);
+		void Shutdown();
 		void StartGame();
+		void StartGame(std::shared_ptr<const RomLoader::Rom> rom);
+		void StartRewinding();
 		void Stop();
+		void StopMovie();
+		void StopRewinding();
 		void TogglePaused();
 		void UnlockFramerate();
 	}
 
 	std::shared_ptr<Core> core;
+	/* Optional second instance of the same core, used for running ahead so that the primary instance never
+	   has its state rolled back, which keeps its audio free of artifacts. Set by whoever creates the core. */
+	std::shared_ptr<Core> secondary_core;
+
+	/* Commands sent from the gui thread to the emulation thread. */
+	enum class CommandType {
+		LoadRom, LoadState, Pause, Reset, Resume, SaveState, Start, Stop, TogglePause
+	};
+
+	struct Command
+	{
+		CommandType type;
+		uint slot; /* for 'LoadState' and 'SaveState' */
+	};
+
+	void EmulationThreadMain(std::stop_token stop_token);
+	std::string GetMoviePath();
+	std::string GetSaveStatePath(uint slot);
+	bool LoadRomIntoCores(std::shared_ptr<const RomLoader::Rom> rom);
+	bool LoadStateFromFile(uint slot);
+	bool PopCommand(Command& command);
+	bool PrepareRunAhead();
+	void ProcessCommands();
+	void RunAhead(uint num_frames);
+	void RewindFrame();
+	void RunFrame(Core& core);
+	void RunIteration();
+	bool SaveStateToFile(uint slot);
+	void SendCommand(CommandType type, uint slot = 0);
+	void StartRunning();
+	void UpdateRewind();
+	void StopRunAhead(std::string_view reason);
+
+	/* Weight of each new measurement in the moving average of the run-ahead time. */
+	constexpr f32 run_ahead_time_smoothing = 0.05f;
 
-	std::string GetSaveStatePath();
-	void Loop();
+	constexpr std::string_view movie_directory = "movies";
+	constexpr std::string_view save_state_directory = "states";
 
+	std::atomic<u64> frame_count; /* frames completed by the core since it was set */
+
+	/* Only changed on the emulation thread, in response to commands. */
 	std::atomic<bool> is_paused;
 	std::atomic<bool> is_running;
 
+	/* The emulation thread is started along with the first command, and lives until 'Shutdown'. Commands
+	   are taken between frames, so that they take effect within a frame; while the game is paused or
+	   stopped, the thread sleeps on 'num_sent_commands' until the next one. The gui thread is the only
+	   one that sends commands. The queue is unbounded, so that sending a command never waits for the
+	   emulation thread; its mutex is only ever held to push or pop one command. */
+	std::jthread emulation_thread;
+	std::mutex command_queue_mutex;
+	std::deque<Command> command_queue;
+	std::atomic<u32> num_sent_commands;
+
+	std::mutex pending_rom_mutex;
+	std::shared_ptr<const RomLoader::Rom> pending_rom; /* for the next 'LoadRom' command */
+
+	std::atomic<bool> is_rewinding; /* the rewind hotkey is held */
+	std::atomic<bool> rewind_is_enabled;
+
+	std::atomic<uint> run_ahead_frames;
+	std::atomic<f32> run_ahead_time_ms;
+
+	/* Only touched on the emulation thread. */
+	bool is_running_ahead; /* the frames being completed are speculative and will be rolled back */
+	bool rewind_buffer_is_active;
+	u64 num_core_frames; /* frames completed by either core, including the ones run ahead */
+	std::vector<u8> run_ahead_state;
+
+	std::shared_ptr<const RomLoader::Rom> current_rom; /* keeps the memory that the cores were given valid */
 	std::string current_rom_name;
 	std::string current_rom_path;
 }
\ No newline at end of file
@@ -0,0 +1,120 @@
+module FramePacer;
+
+namespace FramePacer
+{
+	Stats GetStats()
+	{
+		return {
+			.target_frame_time_ms = stats_target_frame_time_ms.load(std::memory_order_relaxed),
+			.mean_frame_time_ms = stats_mean_frame_time_ms.load(std::memory_order_relaxed),
+			.min_frame_time_ms = stats_min_frame_time_ms.load(std::memory_order_relaxed),
+			.max_frame_time_ms = stats_max_frame_time_ms.load(std::memory_order_relaxed),
+			.jitter_ms = stats_jitter_ms.load(std::memory_order_relaxed)
+		};
+	}
+
+
+	void RecordFrameTime(Clock::time_point now)
+	{
+		if (prev_frame_time_is_valid) {
+			f64 frame_time_ms = std::chrono::duration<f64, std::milli>(now - prev_frame_time).count();
+			if (stats_window_num_frames == 0) {
+				stats_window_sum = stats_window_sum_of_squares = 0.0;
+				stats_window_min = stats_window_max = frame_time_ms;
+			}
+			stats_window_sum += frame_time_ms;
+			stats_window_sum_of_squares += frame_time_ms * frame_time_ms;
+			stats_window_min = std::min(stats_window_min, frame_time_ms);
+			stats_window_max = std::max(stats_window_max, frame_time_ms);
+			if (++stats_window_num_frames == stats_window_size) {
+				f64 mean = stats_window_sum / stats_window_size;
+				f64 variance = std::max(stats_window_sum_of_squares / stats_window_size - mean * mean, 0.0);
+				stats_mean_frame_time_ms.store(mean, std::memory_order_relaxed);
+				stats_min_frame_time_ms.store(stats_window_min, std::memory_order_relaxed);
+				stats_max_frame_time_ms.store(stats_window_max, std::memory_order_relaxed);
+				stats_jitter_ms.store(std::sqrt(variance), std::memory_order_relaxed);
+				stats_window_num_frames = 0;
+			}
+		}
+		prev_frame_time = now;
+		prev_frame_time_is_valid = true;
+	}
+
+
+	void Reset()
+	{
+		/* Must be called from the emulation thread, or while it is not running. */
+		prev_frame_time_is_valid = false;
+		schedule_is_started = false;
+		stats_window_num_frames = 0;
+	}
+
+
+	void SetRefreshRate(f64 refresh_rate)
+	{
+		if (refresh_rate > 0.0) {
+			FramePacer::refresh_rate.store(refresh_rate, std::memory_order_relaxed);
+		}
+	}
+
+
+	void SetSpeedMultiplier(f64 multiplier)
+	{
+		if (multiplier > 0.0) {
+			speed_multiplier.store(multiplier, std::memory_order_relaxed);
+		}
+	}
+
+
+	void SetUncapped(bool uncapped)
+	{
+		FramePacer::uncapped.store(uncapped, std::memory_order_relaxed);
+	}
+
+
+	void WaitForNextFrame()
+	{
+		Clock::time_point now = Clock::now();
+		if (uncapped.load(std::memory_order_relaxed)) {
+			stats_target_frame_time_ms.store(0.0, std::memory_order_relaxed);
+			schedule_is_started = false;
+		}
+		else {
+			/* The target is re-read every frame so that speed changes made from the gui apply immediately. */
+			f64 frame_time_s = 1.0 / (refresh_rate.load(std::memory_order_relaxed) * speed_multiplier.load(std::memory_order_relaxed));
+			auto frame_time = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(frame_time_s));
+			stats_target_frame_time_ms.store(frame_time_s * 1000.0, std::memory_order_relaxed);
+			if (!schedule_is_started) {
+				next_frame_time = now + frame_time;
+				schedule_is_started = true;
+			}
+			else {
+				next_frame_time += frame_time;
+			}
+			if (now - next_frame_time > max_lag) {
+				next_frame_time = now;
+			}
+			else {
+				WaitUntil(next_frame_time);
+				now = Clock::now();
+			}
+		}
+		RecordFrameTime(now);
+	}
+
+
+	void WaitUntil(Clock::time_point deadline)
+	{
+		Clock::time_point sleep_deadline = deadline - spin_period;
+		if (Clock::now() < sleep_deadline) {
+			std::this_thread::sleep_until(sleep_deadline);
+			/* Track the worst recent oversleep, decaying slowly, and spin for a little longer than that. */
+			Clock::duration overshoot = std::max(Clock::now() - sleep_deadline, Clock::duration::zero());
+			sleep_overshoot_estimate = std::max(overshoot, sleep_overshoot_estimate - sleep_overshoot_estimate / 64);
+			spin_period = std::clamp(sleep_overshoot_estimate + sleep_overshoot_estimate / 4, min_spin_period, max_spin_period);
+		}
+		while (Clock::now() < deadline) {
+			std::this_thread::yield();
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+export module FramePacer;
+
+import Types;
+
+import <algorithm>;
+import <atomic>;
+import <chrono>;
+import <cmath>;
+import <thread>;
+
+namespace FramePacer
+{
+	export
+	{
+		struct Stats
+		{
+			f64 target_frame_time_ms; /* zero if uncapped */
+			f64 mean_frame_time_ms;
+			f64 min_frame_time_ms;
+			f64 max_frame_time_ms;
+			f64 jitter_ms; /* standard deviation of the frame time */
+		};
+
+		Stats GetStats();
+		void Reset();
+		void SetRefreshRate(f64 refresh_rate);
+		void SetSpeedMultiplier(f64 multiplier);
+		void SetUncapped(bool uncapped);
+		void WaitForNextFrame();
+	}
+
+	using Clock = std::chrono::steady_clock;
+
+	void RecordFrameTime(Clock::time_point now);
+	void WaitUntil(Clock::time_point deadline);
+
+	/* Sleeping is only accurate to within a millisecond or so (more on some systems), so the last part of
+	   each wait is spent spinning instead. The spin period tracks the worst recent oversleep, within these
+	   bounds. */
+	constexpr Clock::duration min_spin_period = std::chrono::microseconds(100);
+	constexpr Clock::duration max_spin_period = std::chrono::milliseconds(4);
+	/* If we fall further behind schedule than this, the schedule is restarted from the current time
+	   rather than running frames back-to-back to catch up. */
+	constexpr Clock::duration max_lag = std::chrono::milliseconds(100);
+	constexpr uint stats_window_size = 120; /* frames */
+
+	std::atomic<bool> uncapped;
+	std::atomic<f64> refresh_rate = 60.0;
+	std::atomic<f64> speed_multiplier = 1.0;
+
+	/* Only touched on the emulation thread. */
+	bool prev_frame_time_is_valid;
+	bool schedule_is_started;
+	Clock::duration spin_period = std::chrono::milliseconds(2);
+	Clock::duration sleep_overshoot_estimate;
+	Clock::time_point next_frame_time;
+	Clock::time_point prev_frame_time;
+
+	uint stats_window_num_frames;
+	f64 stats_window_sum, stats_window_sum_of_squares;
+	f64 stats_window_min, stats_window_max;
+
+	std::atomic<f64> stats_target_frame_time_ms;
+	std::atomic<f64> stats_mean_frame_time_ms;
+	std::atomic<f64> stats_min_frame_time_ms;
+	std::atomic<f64> stats_max_frame_time_ms;
+	std::atomic<f64> stats_jitter_ms;
+}
\ No newline at end of file
@@ -7,12 +7,40 @@ module Frontend;
 
 import Audio;
 import Emulator;
+import FramePacer;
 import Input;
+import Movie;
+import Profiler;
+import Rewind;
+import RomLibrary;
+import RomLoader;
+import StateStorage;
 import UserMessage;
 import Video;
 
 namespace Frontend
 {
+	void FinishStartup()
+	{
+		/* Called once the first frame has been presented. Whatever was put off so as to get there sooner is
+		   brought up now. */
+		startup_is_complete = true;
+		Profiler::Clock::time_point first_frame_time = Profiler::RecordStartupPhase("Cold start to first frame",
+			Profiler::GetProcessStartTime());
+		Profiler::Clock::time_point start = Profiler::Now();
+		Input::InitializeGameControllers();
+		Profiler::RecordStartupPhase("Game controllers", start);
+
+		/* A gui build has no console, so an overrun is pointed out in the frame timings window, which lists
+		   the phases. */
+		startup_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+			first_frame_time - Profiler::GetProcessStartTime());
+		if (startup_time > startup_budget) {
+			show_frame_timings_window = true;
+		}
+	}
+
+
 	float GetImGuiMenuBarHeight()
 	{
 		// TODO
@@ -22,12 +50,31 @@ namespace Frontend
 
 	bool Initialize(std::shared_ptr<Core> core)
 	{
+		/* Only what is needed to show the first frame is brought up here, and whatever does not depend on
+		   the window is done on worker threads while the window is created. Game controllers are put off
+		   until the first frame has been shown; see 'FinishStartup'. Each phase is recorded, so that the
+		   time from the process start to the first frame can be seen in the frame timings window. */
+		Profiler::Clock::time_point phase_start = Profiler::Now();
+
 		/* Setup SDL */
 		SDL_SetMainReady();
-		if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
+		if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_AUDIO) != 0) {
 			std::cerr << SDL_GetError();
 			return false;
 		}
+		phase_start = Profiler::RecordStartupPhase("SDL video and audio", phase_start);
+
+		/* Opening an audio device may take a while with some drivers, and does not involve the core. SDL
+		   only lets subsystems be initialized on the main thread, which is why the audio subsystem is brought
+		   up above. A failure is reported here once the window exists, rather than on the worker. */
+		std::future<std::string> audio_device_error = std::async(std::launch::async, [] {
+			Profiler::Clock::time_point start = Profiler::Now();
+			std::string error;
+			Audio::OpenDevice(error);
+			Profiler::RecordStartupPhase("Audio device", start);
+			return error;
+		});
+
 		sdl_window = SDL_CreateWindow(
 			"Emulator",
 			SDL_WINDOWPOS_CENTERED,
@@ -46,6 +93,7 @@ namespace Frontend
 			UserMessage::Show(SDL_GetError(), UserMessage::Type::Fatal);
 			return false;
 		}
+		phase_start = Profiler::RecordStartupPhase("Window and renderer", phase_start);
 
 		/* Setup ImGui */
 		IMGUI_CHECKVERSION();
@@ -63,36 +111,69 @@ namespace Frontend
 			return false;
 		}
 		auto menubar_height = GetImGuiMenuBarHeight();
+		phase_start = Profiler::RecordStartupPhase("ImGui", phase_start);
+
+		/* Otherwise, the font atlas is built on the first 'ImGui::NewFrame'. ImGui is not thread-safe, so
+		   nothing else may call into it until this is done. */
+		std::future<void> fonts_built = std::async(std::launch::async, [&io] {
+			Profiler::Clock::time_point start = Profiler::Now();
+			unsigned char* pixels;
+			int width, height;
+			io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+			Profiler::RecordStartupPhase("Font atlas", start);
+		});
 
 		Emulator::SetCore(core);
 		core->Initialize();
 		core->SetupCommunicationWithFrontend();
-
-		/* Setup Audio/Video/Input */
-		if (!Audio::Initialize()) {
+		phase_start = Profiler::RecordStartupPhase("Core", phase_start);
+
+		/* Setup Audio/Video/Input. Loading the bindings only needs the action names of the core. */
+		std::future<bool> input_initialized = std::async(std::launch::async, [] {
+			Profiler::Clock::time_point start = Profiler::Now();
+			bool success = Input::Initialize();
+			Profiler::RecordStartupPhase("Input bindings", start);
+			return success;
+		});
+		if (std::string error = audio_device_error.get(); !error.empty()) {
+			UserMessage::Show(error, UserMessage::Type::Warning);
 			UserMessage::Show("Failed to initialize audio.", UserMessage::Type::Fatal);
 			return false;
 		}
-		if (!Input::Initialize()) {
-			UserMessage::Show("Failed to initialize input.", UserMessage::Type::Fatal);
+		if (!Audio::Initialize()) {
+			UserMessage::Show("Failed to initialize audio.", UserMessage::Type::Fatal);
 			return false;
 		}
 		if (!Video::Initialize(sdl_renderer, sdl_window)) {
 			UserMessage::Show("Failed to initialize video.", UserMessage::Type::Fatal);
 			return false;
 		}
+		if (!input_initialized.get()) {
+			UserMessage::Show("Failed to initialize input.", UserMessage::Type::Fatal);
+			return false;
+		}
+		fonts_built.wait();
+		Profiler::RecordStartupPhase("Audio, video and input", phase_start);
+
 		Video::SetGameRenderAreaSize(500, 500);
 		Video::SetGameRenderAreaOffsetX(0);
 		Video::SetGameRenderAreaOffsetY(19);
 
 		input_window_button_pressed = false;
 		menu_enable_audio = true;
+		menu_enable_rewind = false;
 		menu_fullscreen = false;
 		menu_lock_framerate = true;
 		menu_pause_emulation = false;
+		menu_speed_multiplier = 1.0;
+		menu_resampling_quality = Audio::GetResamplingQuality();
+		menu_run_ahead_frames = 0;
+		menu_save_state_slot = 0;
 		quit = false;
+		show_frame_timings_window = false;
 		show_gui = true;
 		show_input_bindings_window = false;
+		startup_is_complete = false;
 
 		core_action_names = Input::GetCoreActionNames();
 
@@ -113,15 +194,23 @@ namespace Frontend
 
 	bool LoadGame(std::string rom_path)
 	{
+		/* 'Emulator::LoadRom' tells the user why, if it fails. */
 		if (!Emulator::LoadRom(rom_path)) {
-			UserMessage::Show(std::format("Could not load rom at path \"{}\"", rom_path),
-				UserMessage::Type::Warning);
 			return false;
 		}
+		RomLibrary::AddRecent(rom_path);
 		return true;
 	}
 
 
+	void LoadGameAsync(std::string rom_path)
+	{
+		/* The rom is read in the background, and the game switched over to it once it is ready; see
+		   'PollRomLoader'. The gui keeps running meanwhile. */
+		RomLoader::LoadAsync(std::move(rom_path));
+	}
+
+
 	void OnCtrlKeyPress(SDL_Keycode keycode)
 	{
 		switch (keycode) {
@@ -192,6 +281,12 @@ namespace Frontend
 	}
 
 
+	void OnMenuEnableRewind()
+	{
+		menu_enable_rewind ? Emulator::EnableRewind() : Emulator::DisableRewind();
+	}
+
+
 	void OnMenuFullscreen()
 	{
 		menu_fullscreen ? Video::EnableFullscreen() : Video::DisableFullscreen();
@@ -200,7 +295,7 @@ namespace Frontend
 
 	void OnMenuLoadState()
 	{
-		Emulator::LoadState();
+		Emulator::LoadState(menu_save_state_slot);
 	}
 
 
@@ -212,7 +307,9 @@ namespace Frontend
 
 	void OnMenuOpen()
 	{
-		// TODO
+		/* Shows the library as it was indexed last, and brings it up to date in the background. */
+		show_rom_library_window = true;
+		RomLibrary::Rescan();
 	}
 
 
@@ -222,37 +319,66 @@ namespace Frontend
 	}
 
 
-	void OnMenuOpenRecent()
+	void OnMenuOpenRecent(const std::string& rom_path)
 	{
-		// TODO
+		LoadGameAsync(rom_path);
 	}
 
 
 	void OnMenuPause()
 	{
-		menu_pause_emulation ? Emulator::Pause() : ScheduleEmuThread(Emulator::Resume);
+		menu_pause_emulation ? Emulator::Pause() : Emulator::Resume();
+	}
+
+
+	void OnMenuPlayMovie()
+	{
+		Emulator::PlayMovie();
 	}
 
 
 	void OnMenuQuit()
 	{
 		Emulator::Stop();
-		if (emu_thread.joinable()) {
-			emu_thread.join();
-		}
 		quit = true;
 	}
 
 
+	void OnMenuRecordMovie()
+	{
+		Emulator::RecordMovie();
+	}
+
+
+	void OnMenuResamplingQuality()
+	{
+		Audio::SetResamplingQuality(menu_resampling_quality);
+	}
+
+
 	void OnMenuReset()
 	{
-		ScheduleEmuThread(Emulator::Reset);
+		/* Resetting also resumes a paused game. */
+		menu_pause_emulation = false;
+		Emulator::Reset();
+	}
+
+
+	void OnMenuRunAhead()
+	{
+		Emulator::SetRunAheadFrames(menu_run_ahead_frames);
 	}
 
 
 	void OnMenuSaveState()
 	{
-		Emulator::SaveState();
+		Emulator::SaveState(menu_save_state_slot);
+	}
+
+
+	void OnMenuSpeed()
+	{
+		Emulator::SetSpeedMultiplier(menu_speed_multiplier);
 	}
 
 
@@ -262,12 +388,53 @@ namespace Frontend
 	}
 
 
+	void OnMenuStopMovie()
+	{
+		Emulator::StopMovie();
+	}
+
+
+	void OnMenuVideoFilters()
+	{
+		/* Upscalers work best on the original pixels, and scanlines on the upscaled ones. Sharp bilinear
+		   scaling comes last, as it scales to the size of the game render area. */
+		std::vector<VideoFilters::Filter> chain;
+		if (menu_upscale_filter) {
+			chain.push_back(*menu_upscale_filter);
+		}
+		if (menu_enable_crt_scanlines) {
+			chain.push_back(VideoFilters::Filter::CrtScanlines);
+		}
+		if (menu_enable_sharp_bilinear) {
+			chain.push_back(VideoFilters::Filter::SharpBilinear);
+		}
+		Video::SetFilterChain(chain);
+	}
+
+
 	void OnMenuWindowScale()
 	{
 		// TODO
 	}
 
 
+	void PollRomLoader()
+	{
+		std::optional<RomLoader::Completion> completion = RomLoader::PollCompletion();
+		if (!completion) {
+			return;
+		}
+		if (!completion->rom) {
+			UserMessage::Show(std::format("Could not read rom at path \"{}\": {}.", completion->path, completion->error),
+				UserMessage::Type::Warning);
+			return;
+		}
+		RomLibrary::AddRecent(completion->path);
+		menu_pause_emulation = false;
+		Emulator::StartGame(std::move(completion->rom));
+	}
+
+
 	void RenderGui()
 	{
 		if (ImGui::BeginMainMenuBar()) {
@@ -275,8 +442,13 @@ namespace Frontend
 				if (ImGui::MenuItem("Open", "Ctrl+O")) {
 					OnMenuOpen();
 				}
-				if (ImGui::MenuItem("Open recent")) {
-					OnMenuOpenRecent();
+				if (ImGui::BeginMenu("Open recent")) {
+					for (const std::string& rom_path : RomLibrary::GetRecent()) {
+						if (ImGui::MenuItem(rom_path.c_str())) {
+							OnMenuOpenRecent(rom_path);
+						}
+					}
+					ImGui::EndMenu();
 				}
 				if (ImGui::MenuItem("Open BIOS")) {
 					OnMenuOpenBios();
@@ -287,6 +459,28 @@ namespace Frontend
 				if (ImGui::MenuItem("Save state", "Ctrl+S")) {
 					OnMenuSaveState();
 				}
+				if (ImGui::BeginMenu("State slot")) {
+					for (uint slot = 0; slot < Emulator::num_save_state_slots; ++slot) {
+						std::string label = std::format("Slot {}", slot);
+						if (ImGui::MenuItem(label.c_str(), nullptr, menu_save_state_slot == slot)) {
+							menu_save_state_slot = slot;
+						}
+					}
+					ImGui::EndMenu();
+				}
+				if (ImGui::BeginMenu("Movie")) {
+					Movie::Mode movie_mode = Movie::GetMode();
+					if (ImGui::MenuItem("Record", nullptr, movie_mode == Movie::Mode::Recording)) {
+						OnMenuRecordMovie();
+					}
+					if (ImGui::MenuItem("Play", nullptr, movie_mode == Movie::Mode::Playing)) {
+						OnMenuPlayMovie();
+					}
+					if (ImGui::MenuItem("Stop", nullptr, false, movie_mode != Movie::Mode::Off)) {
+						OnMenuStopMovie();
+					}
+					ImGui::EndMenu();
+				}
 				if (ImGui::MenuItem("Quit", "Ctrl+Q")) {
 					OnMenuQuit();
 				}
@@ -305,12 +499,47 @@ namespace Frontend
 				if (ImGui::MenuItem("Lock framerate", "Ctrl+F", &menu_lock_framerate, true)) {
 					OnMenuLockFramerate();
 				}
+				if (ImGui::MenuItem("Rewind", "Hold Backspace", &menu_enable_rewind, true)) {
+					OnMenuEnableRewind();
+				}
+				if (ImGui::BeginMenu("Speed")) {
+					for (double speed_multiplier : { 0.5, 1.0, 2.0, 4.0 }) {
+						std::string label = std::format("{}x", speed_multiplier);
+						if (ImGui::MenuItem(label.c_str(), nullptr, menu_speed_multiplier == speed_multiplier)) {
+							menu_speed_multiplier = speed_multiplier;
+							OnMenuSpeed();
+						}
+					}
+					ImGui::EndMenu();
+				}
+				if (ImGui::BeginMenu("Run-ahead")) {
+					/* The menu may be stale if run-ahead was turned off because the core does not support it. */
+					menu_run_ahead_frames = Emulator::GetRunAheadStats().num_frames;
+					for (uint num_frames = 0; num_frames <= Emulator::max_run_ahead_frames; ++num_frames) {
+						std::string label = num_frames == 0 ? "Off" : std::format("{} frame{}", num_frames, num_frames > 1 ? "s" : "");
+						if (ImGui::MenuItem(label.c_str(), nullptr, menu_run_ahead_frames == num_frames)) {
+							menu_run_ahead_frames = num_frames;
+							OnMenuRunAhead();
+						}
+					}
+					ImGui::EndMenu();
+				}
 				ImGui::EndMenu();
 			}
 			if (ImGui::BeginMenu("Audio")) {
 				if (ImGui::MenuItem("Enable", "Ctrl+A", &menu_enable_audio, true)) {
 					OnMenuEnableAudio();
 				}
+				if (ImGui::BeginMenu("Resampling quality")) {
+					for (size_t i = 0; i < size_t(Resampler::Quality::Count); ++i) {
+						auto quality = Resampler::Quality(i);
+						if (ImGui::MenuItem(Resampler::GetQualityName(quality).data(), nullptr, menu_resampling_quality == quality)) {
+							menu_resampling_quality = quality;
+							OnMenuResamplingQuality();
+						}
+					}
+					ImGui::EndMenu();
+				}
 				ImGui::EndMenu();
 			}
 			if (ImGui::BeginMenu("Video")) {
@@ -320,6 +549,27 @@ namespace Frontend
 				if (ImGui::MenuItem("Fullscreen", "Ctrl+Enter", &menu_fullscreen, true)) {
 					OnMenuFullscreen();
 				}
+				if (ImGui::BeginMenu("Filters")) {
+					bool chain_changed = false;
+					if (ImGui::MenuItem("No upscaling", nullptr, !menu_upscale_filter)) {
+						menu_upscale_filter.reset();
+						chain_changed = true;
+					}
+					using enum VideoFilters::Filter;
+					for (auto [filter, label] : { std::pair{ Scale2x, "Scale2x" }, std::pair{ Scale3x, "Scale3x" }, std::pair{ Xbr, "xBR" } }) {
+						if (ImGui::MenuItem(label, nullptr, menu_upscale_filter == filter)) {
+							menu_upscale_filter = filter;
+							chain_changed = true;
+						}
+					}
+					ImGui::Separator();
+					chain_changed |= ImGui::MenuItem("CRT scanlines", nullptr, &menu_enable_crt_scanlines);
+					chain_changed |= ImGui::MenuItem("Sharp bilinear", nullptr, &menu_enable_sharp_bilinear);
+					if (chain_changed) {
+						OnMenuVideoFilters();
+					}
+					ImGui::EndMenu();
+				}
 				ImGui::EndMenu();
 			}
 			if (ImGui::BeginMenu("Input")) {
@@ -329,15 +579,74 @@ namespace Frontend
 				ImGui::EndMenu();
 			}
 			if (ImGui::BeginMenu("Debug")) {
-				// TODO
+				ImGui::MenuItem("Frame timings", nullptr, &show_frame_timings_window);
 				ImGui::EndMenu();
 			}
+			RenderStatusMessage();
 			ImGui::EndMainMenuBar();
 		}
 
 		if (show_input_bindings_window) {
 			RenderInputBindingsWindow();
 		}
+		if (show_frame_timings_window) {
+			RenderFrameTimingsWindow();
+		}
+		if (show_rom_library_window) {
+			RenderRomLibraryWindow();
+		}
+	}
+
+
+	void RenderFrameTimingsWindow()
+	{
+		if (ImGui::Begin("Frame timings", &show_frame_timings_window)) {
+			for (size_t i = 0; i < size_t(Profiler::Stage::Count); ++i) {
+				auto stage = Profiler::Stage(i);
+				std::array<f32, Profiler::num_samples_per_stage> samples;
+				Profiler::CopySamples(stage, samples);
+				Profiler::Stats stats = Profiler::GetStats(stage);
+				std::string overlay = std::format("min {:.2f}  avg {:.2f}  p99 {:.2f}  max {:.2f} ms",
+					stats.min_ms, stats.avg_ms, stats.p99_ms, stats.max_ms);
+				/* Scale the graph to the worst sample, but never below a 60 Hz frame, so that small stages do
+				   not look dramatic. */
+				f32 scale_max = std::max(stats.max_ms, 1000.0f / 60.0f);
+				ImGui::PlotLines(Profiler::GetStageName(stage).data(), samples.data(), int(samples.size()), 0,
+					overlay.c_str(), 0.0f, scale_max, ImVec2(0, 48));
+			}
+
+			FramePacer::Stats pacer_stats = FramePacer::GetStats();
+			ImGui::Text("Frame pacing: target %.2f ms, mean %.2f ms, jitter %.3f ms",
+				pacer_stats.target_frame_time_ms, pacer_stats.mean_frame_time_ms, pacer_stats.jitter_ms);
+			Audio::Stats audio_stats = Audio::GetStats();
+			ImGui::Text("Audio: fill %.1f / %.0f ms, rate adjustment %+.3f%%, underruns %llu",
+				audio_stats.fill_level_ms, audio_stats.target_latency_ms, audio_stats.rate_adjustment * 100.0,
+				(unsigned long long)audio_stats.num_underruns);
+			Rewind::Stats rewind_stats = Rewind::GetStats();
+			ImGui::Text("Rewind: %zu snapshots, %zu frames, %.1f MiB, capture %.3f ms",
+				rewind_stats.num_snapshots, rewind_stats.num_frames, rewind_stats.memory_used / (1024.0 * 1024.0),
+				rewind_stats.capture_time_ms);
+			Emulator::RunAheadStats run_ahead_stats = Emulator::GetRunAheadStats();
+			ImGui::Text("Run-ahead: %u frames, %.2f ms, %.0f%% of frame budget%s",
+				run_ahead_stats.num_frames, run_ahead_stats.time_ms, run_ahead_stats.frame_budget_usage * 100.0f,
+				Emulator::GetSecondaryCore() ? " (secondary core)" : "");
+
+			bool startup_is_over_budget = startup_time > startup_budget;
+			if (ImGui::CollapsingHeader("Startup", startup_is_over_budget ? ImGuiTreeNodeFlags_DefaultOpen : 0)) {
+				for (const Profiler::StartupPhase& phase : Profiler::GetStartupPhases()) {
+					ImGui::Text("%-28.*s %8.1f ms at %8.1f ms", int(phase.name.size()), phase.name.data(),
+						phase.duration_ms, phase.start_ms);
+				}
+				if (startup_is_over_budget) {
+					ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Startup took %lld ms, which is over the budget of %lld ms",
+						(long long)startup_time.count(), (long long)startup_budget.count());
+				}
+				else {
+					ImGui::Text("Budget to first frame: %lld ms", (long long)startup_budget.count());
+				}
+			}
+		}
+		ImGui::End();
 	}
 
 
@@ -357,6 +666,85 @@ namespace Frontend
 	}
 
 
+	void RenderRomLibraryWindow()
+	{
+		ImGui::SetNextWindowSize(ImVec2(720, 480), ImGuiCond_FirstUseEver);
+		if (ImGui::Begin("Rom library", &show_rom_library_window)) {
+			ImGui::InputTextWithHint("##directory", "Folder", rom_library_directory_input.data(), rom_library_directory_input.size());
+			ImGui::SameLine();
+			if (ImGui::Button("Add folder") && rom_library_directory_input[0] != '\0') {
+				RomLibrary::AddDirectory(rom_library_directory_input.data());
+				rom_library_directory_input[0] = '\0';
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Rescan")) {
+				RomLibrary::Rescan();
+			}
+			RomLibrary::ScanStatus scan_status = RomLibrary::GetScanStatus();
+			if (scan_status.is_scanning) {
+				ImGui::SameLine();
+				ImGui::Text("Scanning: %llu / %llu files, %llu new or changed", (unsigned long long)scan_status.num_checked_files,
+					(unsigned long long)scan_status.num_files, (unsigned long long)scan_status.num_hashed_files);
+			}
+			if (ImGui::TreeNode("Folders")) {
+				for (const std::string& directory : RomLibrary::GetDirectories()) {
+					ImGui::PushID(directory.c_str());
+					if (ImGui::SmallButton("Remove")) {
+						RomLibrary::RemoveDirectory(directory);
+					}
+					ImGui::SameLine();
+					ImGui::TextUnformatted(directory.c_str());
+					ImGui::PopID();
+				}
+				ImGui::TreePop();
+			}
+			ImGui::InputTextWithHint("##filter", "Filter", rom_library_filter.data(), rom_library_filter.size());
+
+			UpdateRomLibraryRows();
+			ImGuiTableFlags table_flags = ImGuiTableFlags_ScrollY | ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable
+				| ImGuiTableFlags_BordersOuter;
+			if (ImGui::BeginTable("##roms", 4, table_flags)) {
+				ImGui::TableSetupScrollFreeze(0, 1);
+				ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch);
+				ImGui::TableSetupColumn("System", ImGuiTableColumnFlags_WidthFixed);
+				ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_WidthFixed);
+				ImGui::TableSetupColumn("CRC32", ImGuiTableColumnFlags_WidthFixed);
+				ImGui::TableHeadersRow();
+				/* Only the rows in view are submitted, so that the cost of a frame does not depend on the size
+				   of the library. */
+				ImGuiListClipper clipper;
+				clipper.Begin(int(rom_library_rows.size()));
+				while (clipper.Step()) {
+					for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+						u32 entry_index = rom_library_rows[row];
+						const RomLibrary::Entry& entry = (*rom_library_entries)[entry_index];
+						const char* file_name = entry.path.c_str() + entry.path.find_last_of("/\\") + 1;
+						ImGui::TableNextRow();
+						ImGui::TableNextColumn();
+						ImGui::PushID(row);
+						if (ImGui::Selectable(file_name, rom_library_selected_entry == entry_index,
+							ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_AllowDoubleClick)) {
+							rom_library_selected_entry = entry_index;
+							if (ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left)) {
+								LoadGameAsync(entry.path);
+							}
+						}
+						ImGui::PopID();
+						ImGui::TableNextColumn();
+						ImGui::TextUnformatted(RomLibrary::GetSystemName(entry.system).data());
+						ImGui::TableNextColumn();
+						ImGui::Text("%.2f MiB", entry.file_size / (1024.0 * 1024.0));
+						ImGui::TableNextColumn();
+						ImGui::Text("%08X", entry.crc32);
+					}
+				}
+				ImGui::EndTable();
+			}
+		}
+		ImGui::End();
+	}
+
+
 	void RunGui(bool boot_game_immediately)
 	{
 		if (boot_game_immediately) {
@@ -364,6 +752,7 @@ namespace Frontend
 		}
 
 		SDL_Event event;
+		Profiler::Clock::time_point gui_frame_start = Profiler::Now();
 		while (!quit) {
 			while (SDL_PollEvent(&event)) {
 				ImGui_ImplSDL2_ProcessEvent(&event);
@@ -377,27 +766,48 @@ namespace Frontend
 					if ((SDL_GetModState() & SDL_Keymod::KMOD_CTRL) != 0 && keycode != SDLK_LCTRL && keycode != SDLK_RCTRL) { /* LCTRL/RCTRL is held */
 						OnCtrlKeyPress(keycode);
 					}
+					else if (keycode == rewind_keycode) {
+						Emulator::StartRewinding();
+					}
 					else {
 						Input::ProcessEvent(event);
 					}
 				}
+				else if (event.type == SDL_KEYUP && event.key.keysym.sym == rewind_keycode) {
+					Emulator::StopRewinding();
+				}
+				else if (event.type == SDL_DROPFILE) {
+					LoadGameAsync(event.drop.file);
+					SDL_free(event.drop.file);
+				}
 				else {
 					Input::ProcessEvent(event);
 				}
 			}
 
-			SDL_RenderClear(sdl_renderer);
+			PollRomLoader();
+			UserMessage::ShowPosted();
+
+			Profiler::Clock::time_point imgui_build_start = Profiler::Now();
 			ImGui_ImplSDLRenderer_NewFrame();
 			ImGui_ImplSDL2_NewFrame(sdl_window);
 			ImGui::NewFrame();
-			Video::RenderGame();
 			if (show_gui) {
 				RenderGui();
 			}
 			ImGui::Render();
+			Profiler::Clock::time_point render_start = Profiler::Record(Profiler::Stage::ImGuiBuild, imgui_build_start);
+			SDL_RenderClear(sdl_renderer);
+			Video::RenderGame();
 			ImGui_ImplSDLRenderer_RenderDrawData(ImGui::GetDrawData());
+			Profiler::Clock::time_point present_start = Profiler::Record(Profiler::Stage::Render, render_start);
 			SDL_RenderPresent(sdl_renderer);
 			SDL_GL_SwapWindow(sdl_window);
+			Profiler::Record(Profiler::Stage::Present, present_start);
+			gui_frame_start = Profiler::Record(Profiler::Stage::GuiFrame, gui_frame_start);
+			if (!startup_is_complete) {
+				FinishStartup();
+			}
 
 			/* SDL will automatically block so that the number of frames rendered per second is
 			   equal to the display's refresh rate. */
@@ -405,19 +815,54 @@ namespace Frontend
 	}
 
 
-	void ScheduleEmuThread(void(*function)())
+	void RenderStatusMessage()
 	{
-		Emulator::Stop();
-		if (emu_thread.joinable()) {
-			emu_thread.join();
+		/* Save states are written in the background; their outcome is shown in the menu bar for a while. */
+		while (std::optional<StateStorage::Completion> completion = StateStorage::PollCompletion()) {
+			status_message = completion->success
+				? std::format("Saved state to {}", completion->path)
+				: std::format("Could not save state to {}", completion->path);
+			status_message_time = std::chrono::steady_clock::now();
+		}
+		if (!status_message.empty() && std::chrono::steady_clock::now() - status_message_time < status_message_duration) {
+			ImGui::Separator();
+			ImGui::TextUnformatted(status_message.c_str());
+		}
+		RomLoader::Progress rom_loader_progress = RomLoader::GetProgress();
+		if (rom_loader_progress.phase != RomLoader::Phase::Idle) {
+			std::string_view phase_name = [&] {
+				switch (rom_loader_progress.phase) {
+				case RomLoader::Phase::Decompressing: return "Decompressing";
+				case RomLoader::Phase::Hashing: return "Hashing";
+				default: return "Opening";
+				}
+			}();
+			ImGui::Separator();
+			ImGui::TextUnformatted(std::format("{} {}: {:.0f}%", phase_name,
+				std::filesystem::path(rom_loader_progress.path).filename().string(), 100.0f * rom_loader_progress.fraction).c_str());
+		}
+		Movie::Status movie_status = Movie::GetStatus();
+		if (movie_status.mode == Movie::Mode::Recording) {
+			ImGui::Separator();
+			ImGui::TextUnformatted(std::format("Recording movie: frame {}", movie_status.frame).c_str());
+		}
+		else if (movie_status.mode == Movie::Mode::Playing) {
+			ImGui::Separator();
+			ImGui::TextUnformatted(std::format("Playing movie: frame {}/{}", movie_status.frame, movie_status.num_frames).c_str());
 		}
-		emu_thread = std::jthread{ function };
 	}
 
 
 	void Shutdown()
 	{
-		Emulator::Stop();
+		Emulator::Shutdown();
+		RomLoader::Shutdown();
+		RomLibrary::Shutdown();
+		Emulator::StopMovie();
+		Input::SaveBindings();
+		StateStorage::Shutdown();
+		/* E.g. that the movie could not be saved, while there is still a window to show it over. */
+		UserMessage::ShowPosted();
 		ImGui_ImplSDLRenderer_Shutdown();
 		ImGui_ImplSDL2_Shutdown();
 		ImGui::DestroyContext();
@@ -429,7 +874,7 @@ namespace Frontend
 
 	void StartGame()
 	{
-		ScheduleEmuThread(Emulator::StartGame);
+		Emulator::StartGame();
 	}
 
 
@@ -437,4 +882,28 @@ namespace Frontend
 	{
 		Emulator::Stop();
 	}
+
+
+	void UpdateRomLibraryRows()
+	{
+		/* Matches the filter against file names, ignoring case. Filtering a large library takes a moment,
+		   so it is only done when the filter or the library has changed. */
+		std::shared_ptr<const std::vector<RomLibrary::Entry>> entries = RomLibrary::GetEntries();
+		std::string_view filter = rom_library_filter.data();
+		if (entries == rom_library_entries && filter == rom_library_applied_filter) {
+			return;
+		}
+		rom_library_entries = std::move(entries);
+		rom_library_applied_filter = filter;
+		rom_library_selected_entry.reset();
+		rom_library_rows.clear();
+		auto EqualIgnoringCase = [](char a, char b) { return std::tolower(u8(a)) == std::tolower(u8(b)); };
+		for (u32 i = 0; i < u32(rom_library_entries->size()); ++i) {
+			const std::string& path = (*rom_library_entries)[i].path;
+			std::string_view file_name = std::string_view{ path }.substr(path.find_last_of("/\\") + 1);
+			if (filter.empty() || !std::ranges::search(file_name, filter, EqualIgnoringCase).empty()) {
+				rom_library_rows.push_back(i);
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -1,16 +1,25 @@
 export module Frontend;
 
 import Core;
+import Resampler;
+import RomLibrary;
+import Types;
+import VideoFilters;
 
 import <SDL.h>;
 
+import <algorithm>;
+import <array>;
+import <cctype>;
 import <chrono>;
+import <filesystem>;
 import <format>;
+import <future>;
 import <iostream>;
 import <memory>;
+import <optional>;
 import <string>;
 import <string_view>;
-import <thread>;
 import <utility>;
 import <vector>;
 
@@ -25,40 +34,84 @@ namespace Frontend
 		void Shutdown();
 	}
 
+	void FinishStartup();
 	float GetImGuiMenuBarHeight();
+	void LoadGameAsync(std::string rom_path);
 	void OnCtrlKeyPress(SDL_Keycode keycode);
 	void OnMenuConfigureBindings();
 	void OnMenuEnableAudio();
+	void OnMenuEnableRewind();
 	void OnMenuFullscreen();
 	void OnMenuLoadState();
 	void OnMenuLockFramerate();
 	void OnMenuOpen();
 	void OnMenuOpenBios();
-	void OnMenuOpenRecent();
+	void OnMenuOpenRecent(const std::string& rom_path);
 	void OnMenuPause();
+	void OnMenuPlayMovie();
 	void OnMenuQuit();
+	void OnMenuRecordMovie();
+	void OnMenuResamplingQuality();
 	void OnMenuReset();
+	void OnMenuRunAhead();
 	void OnMenuSaveState();
+	void OnMenuSpeed();
 	void OnMenuStop();
+	void OnMenuStopMovie();
+	void OnMenuVideoFilters();
 	void OnMenuWindowScale();
+	void PollRomLoader();
+	void RenderFrameTimingsWindow();
 	void RenderGui();
 	void RenderInputBindingsWindow();
-	void ScheduleEmuThread(void(*function)());
+	void RenderRomLibraryWindow();
+	void RenderStatusMessage();
 	void StartGame();
 	void StopGame();
+	void UpdateRomLibraryRows();
+
+	constexpr SDL_Keycode rewind_keycode = SDLK_BACKSPACE; /* held to rewind */
+	constexpr std::chrono::seconds status_message_duration{ 3 };
+	constexpr std::chrono::milliseconds startup_budget{ 500 }; /* from the process start to the first frame being presented */
 
 	bool input_window_button_pressed;
 	bool menu_enable_audio;
+	bool menu_enable_crt_scanlines;
+	bool menu_enable_rewind;
+	bool menu_enable_sharp_bilinear;
 	bool menu_fullscreen;
 	bool menu_lock_framerate;
 	bool menu_pause_emulation;
 	bool quit;
+	bool show_frame_timings_window;
 	bool show_gui;
 	bool show_input_bindings_window;
+	bool show_rom_library_window;
+	bool startup_is_complete; /* the first frame has been presented */
+
+	double menu_speed_multiplier;
+
+	uint menu_run_ahead_frames;
+	uint menu_save_state_slot;
+
+	std::optional<VideoFilters::Filter> menu_upscale_filter; /* Scale2x, Scale3x or xBR, if any */
+
+	Resampler::Quality menu_resampling_quality;
+
+	std::array<char, 256> rom_library_filter;
+	std::array<char, 1024> rom_library_directory_input;
+	/* The rows of the rom library window: the entries that pass the filter, as indices into the entries that
+	   they were filtered from. Only redone when either changes. */
+	std::shared_ptr<const std::vector<RomLibrary::Entry>> rom_library_entries;
+	std::string rom_library_applied_filter;
+	std::vector<u32> rom_library_rows;
+	std::optional<u32> rom_library_selected_entry;
 
 	std::string prev_core_action_binding;
+	std::string status_message;
 
-	std::jthread emu_thread;
+	std::chrono::steady_clock::time_point status_message_time;
+	std::chrono::milliseconds startup_time{}; /* from the process start to the first frame being presented */
 
 	std::vector<std::string_view> core_action_names;
 	std::vector<std::string_view> core_action_bindings;
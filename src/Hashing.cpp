@@ -0,0 +1,114 @@
+module Hashing;
+
+namespace Hashing
+{
+	u32 Crc32(std::span<const u8> data, u32 crc)
+	{
+		crc = ~crc;
+		const u8* bytes = data.data();
+		size_t size = data.size();
+		while (size >= 8) {
+			u32 low, high;
+			std::memcpy(&low, bytes, 4);
+			std::memcpy(&high, bytes + 4, 4);
+			if constexpr (std::endian::native == std::endian::big) {
+				low = std::byteswap(low);
+				high = std::byteswap(high);
+			}
+			low ^= crc;
+			crc = crc32_tables[7][low & 0xFF] ^ crc32_tables[6][low >> 8 & 0xFF]
+				^ crc32_tables[5][low >> 16 & 0xFF] ^ crc32_tables[4][low >> 24]
+				^ crc32_tables[3][high & 0xFF] ^ crc32_tables[2][high >> 8 & 0xFF]
+				^ crc32_tables[1][high >> 16 & 0xFF] ^ crc32_tables[0][high >> 24];
+			bytes += 8;
+			size -= 8;
+		}
+		while (size-- > 0) {
+			crc = crc >> 8 ^ crc32_tables[0][(crc ^ *bytes++) & 0xFF];
+		}
+		return ~crc;
+	}
+
+
+	Sha1Digest Sha1::Finish()
+	{
+		/* Pads the message with a 1 bit, zeroes, and its length in bits, big-endian, to a whole number of
+		   blocks. The object should not be used afterwards. */
+		u64 num_bits = num_bytes * 8;
+		static constexpr std::array<u8, 64> padding = { 0x80 };
+		Update(std::span{ padding }.first(buffer_size < 56 ? 56 - buffer_size : 120 - buffer_size));
+		std::array<u8, 8> length;
+		for (int i = 0; i < 8; ++i) {
+			length[i] = u8(num_bits >> (56 - 8 * i));
+		}
+		Update(length);
+		Sha1Digest digest;
+		for (int i = 0; i < 20; ++i) {
+			digest[i] = u8(state[i / 4] >> (24 - 8 * (i % 4)));
+		}
+		return digest;
+	}
+
+
+	void Sha1::ProcessBlock(const u8* block)
+	{
+		std::array<u32, 80> words;
+		for (int i = 0; i < 16; ++i) {
+			words[i] = u32(block[4 * i]) << 24 | u32(block[4 * i + 1]) << 16 | u32(block[4 * i + 2]) << 8 | block[4 * i + 3];
+		}
+		for (int i = 16; i < 80; ++i) {
+			words[i] = std::rotl(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+		}
+		u32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+		auto Round = [&](u32 f, u32 k, u32 word) {
+			u32 temp = std::rotl(a, 5) + f + e + k + word;
+			e = d;
+			d = c;
+			c = std::rotl(b, 30);
+			b = a;
+			a = temp;
+		};
+		/* Four separate loops, rather than one with a branch on the round, so that each can be unrolled. */
+		for (int i = 0; i < 20; ++i) {
+			Round(d ^ b & (c ^ d), 0x5A82'7999, words[i]);
+		}
+		for (int i = 20; i < 40; ++i) {
+			Round(b ^ c ^ d, 0x6ED9'EBA1, words[i]);
+		}
+		for (int i = 40; i < 60; ++i) {
+			Round(b & c | d & (b | c), 0x8F1B'BCDC, words[i]);
+		}
+		for (int i = 60; i < 80; ++i) {
+			Round(b ^ c ^ d, 0xCA62'C1D6, words[i]);
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+
+
+	void Sha1::Update(std::span<const u8> data)
+	{
+		num_bytes += data.size();
+		if (buffer_size > 0) {
+			size_t num_copied = std::min(data.size(), buffer.size() - buffer_size);
+			std::memcpy(buffer.data() + buffer_size, data.data(), num_copied);
+			buffer_size += num_copied;
+			data = data.subspan(num_copied);
+			if (buffer_size < buffer.size()) {
+				return;
+			}
+			ProcessBlock(buffer.data());
+			buffer_size = 0;
+		}
+		/* Whole blocks are hashed where they are, without being copied into the buffer first. */
+		while (data.size() >= 64) {
+			ProcessBlock(data.data());
+			data = data.subspan(64);
+		}
+		std::memcpy(buffer.data(), data.data(), data.size());
+		buffer_size = data.size();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+export module Hashing;
+
+import Types;
+
+import <algorithm>;
+import <array>;
+import <bit>;
+import <cstring>;
+import <span>;
+
+namespace Hashing
+{
+	export
+	{
+		using Sha1Digest = std::array<u8, 20>;
+
+		/* The CRC-32 of zip files, cartridge databases etc. (polynomial 0xEDB88320). Large inputs may be
+		   hashed in pieces, by passing the result for one piece as 'crc' for the next. */
+		u32 Crc32(std::span<const u8> data, u32 crc = 0);
+
+		/* SHA-1, fed in pieces of any size through 'Update'. */
+		class Sha1
+		{
+		public:
+			Sha1Digest Finish();
+			void Update(std::span<const u8> data);
+
+		private:
+			void ProcessBlock(const u8* block);
+
+			std::array<u32, 5> state = { 0x6745'2301, 0xEFCD'AB89, 0x98BA'DCFE, 0x1032'5476, 0xC3D2'E1F0 };
+			std::array<u8, 64> buffer; /* a partial block */
+			size_t buffer_size = 0;
+			u64 num_bytes = 0;
+		};
+	}
+
+	/* Slicing-by-8: eight bytes are folded into the crc per step, through eight tables of which table k
+	   gives the crc of a byte followed by k zero bytes. */
+	constexpr std::array<std::array<u32, 256>, 8> crc32_tables = [] {
+		std::array<std::array<u32, 256>, 8> tables{};
+		for (u32 i = 0; i < 256; ++i) {
+			u32 crc = i;
+			for (int bit = 0; bit < 8; ++bit) {
+				crc = crc & 1 ? crc >> 1 ^ 0xEDB8'8320 : crc >> 1;
+			}
+			tables[0][i] = crc;
+		}
+		for (u32 i = 0; i < 256; ++i) {
+			for (size_t k = 1; k < 8; ++k) {
+				tables[k][i] = tables[k - 1][i] >> 8 ^ tables[0][tables[k - 1][i] & 0xFF];
+			}
+		}
+		return tables;
+	}();
+}
\ No newline at end of file
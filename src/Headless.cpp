@@ -0,0 +1,207 @@
+module Headless;
+
+import Audio;
+import Emulator;
+import Input;
+import Movie;
+import UserMessage;
+import Video;
+
+namespace Headless
+{
+	bool Initialize(std::shared_ptr<Core> core)
+	{
+		/* Unlike 'Frontend::Initialize', no window, renderer, audio device or input device is opened, and
+		   SDL itself is never initialized. */
+		Emulator::SetCore(core);
+		core->Initialize();
+		core->SetupCommunicationWithFrontend();
+
+		if (!Audio::InitializeHeadless()) {
+			UserMessage::Show("Failed to initialize headless audio.", UserMessage::Type::Fatal);
+			return false;
+		}
+		if (!Input::InitializeHeadless()) {
+			UserMessage::Show("Failed to initialize headless input.", UserMessage::Type::Fatal);
+			return false;
+		}
+		Video::InitializeHeadless();
+
+		/* Run as fast as possible. */
+		Emulator::UnlockFramerate();
+
+		return true;
+	}
+
+
+	bool LoadBios(const std::string& bios_path)
+	{
+		if (!Emulator::LoadBios(bios_path)) {
+			UserMessage::Show(std::format("Could not load bios at path \"{}\"", bios_path),
+				UserMessage::Type::Warning);
+			return false;
+		}
+		return true;
+	}
+
+
+	bool LoadGame(const std::string& rom_path)
+	{
+		/* 'Emulator::LoadRom' tells the user why, if it fails. */
+		return Emulator::LoadRom(rom_path);
+	}
+
+
+	RunResults Run(const RunOptions& options)
+	{
+		/* The core runs on the calling thread; there is no gui thread to hand frames to. A movie makes the
+		   input, and thereby the work done, the same from one run to the next. */
+		std::shared_ptr<Core> core = Emulator::GetCore();
+		std::shared_ptr<Core> secondary_core = Emulator::GetSecondaryCore();
+		bool plays_movie = !options.movie_path.empty();
+		if (plays_movie && !Movie::StartPlayback(options.movie_path)) {
+			return {};
+		}
+		u64 start_frame = Emulator::GetFrameCount();
+		auto start_time = std::chrono::steady_clock::now();
+
+		u64 num_frames = 0;
+		while (num_frames < options.num_frames && !(options.stop_condition && options.stop_condition())) {
+			Movie::Begin(*core, secondary_core.get());
+			if (plays_movie && Movie::GetMode() == Movie::Mode::Off) {
+				break; /* the movie has ended */
+			}
+			Emulator::RunCore(*core);
+			num_frames = Emulator::GetFrameCount() - start_frame;
+		}
+
+		RunResults results;
+		results.num_frames = num_frames;
+		results.wall_time_s = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start_time).count();
+		results.frames_per_second = results.wall_time_s > 0.0 ? f64(num_frames) / results.wall_time_s : 0.0;
+		results.emulated_time_ratio = results.frames_per_second / core->GetRefreshRate();
+
+		if (options.print_results) {
+			std::cout << std::format("{} frames in {:.3f} s: {:.1f} fps, {:.2f}x real time\n",
+				results.num_frames, results.wall_time_s, results.frames_per_second, results.emulated_time_ratio);
+		}
+		return results;
+	}
+
+
+	std::vector<RomResult> RunBatch(const BatchOptions& options)
+	{
+		/* Every rom is one task. Tasks are handed out one at a time as threads become free, so that long and
+		   short runs even out over the threads. */
+		std::vector<RomResult> results(options.rom_paths.size());
+		std::mutex result_mutex;
+		std::unique_ptr<ThreadPool> thread_pool = options.num_threads > 0
+			? std::make_unique<ThreadPool>(options.num_threads)
+			: std::make_unique<ThreadPool>();
+
+		thread_pool->ParallelFor(uint(options.rom_paths.size()), [&](uint rom_index) {
+			RomResult result = RunInstance(options, options.rom_paths[rom_index]);
+			std::lock_guard lock{ result_mutex };
+			if (options.print_results) {
+				std::cout << std::format("{}: {}, {} frames in {:.3f} s: {:.1f} fps, frame hash {:016x}{}{}\n",
+					result.rom_path, ToString(result.status), result.num_frames, result.wall_time_s,
+					result.frames_per_second, result.frame_hash, result.error.empty() ? "" : ": ", result.error);
+			}
+			if (options.on_result) {
+				options.on_result(result);
+			}
+			results[rom_index] = std::move(result);
+		});
+		return results;
+	}
+
+
+	RomResult RunInstance(const BatchOptions& options, const std::string& rom_path)
+	{
+		/* Runs on a pool thread. The instance is created, run and destroyed on that thread, while its sinks
+		   are set, so that everything it hands to 'Video' and 'Audio' ends up in them rather than in the
+		   state shared with the emulation thread. The frame counter of 'Emulator' is not touched either. */
+		using Status = RomResult::Status;
+		RomResult result{};
+		result.rom_path = rom_path;
+		Video::FrameSink frame_sink{};
+		Audio::SampleSink sample_sink{};
+		Video::SetThreadFrameSink(&frame_sink);
+		Audio::SetThreadSampleSink(&sample_sink);
+		auto start_time = std::chrono::steady_clock::now();
+		auto GetElapsedTime = [&] {
+			return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start_time).count();
+		};
+
+		try {
+			std::shared_ptr<Core> core = options.create_core();
+			core->Initialize();
+			if (!options.bios_path.empty() && !core->LoadBios(options.bios_path)) {
+				result.status = Status::BiosError;
+			}
+			else if (!core->LoadRom(rom_path)) {
+				result.status = Status::LoadError;
+			}
+			else {
+				result.status = Status::Ok;
+				bool frame_output_is_supported = core->SupportsRunFrame();
+				while (frame_sink.num_frames < options.num_frames) {
+					if (GetElapsedTime() > options.timeout_s) {
+						result.status = Status::TimedOut;
+						break;
+					}
+					if (!frame_output_is_supported) {
+						core->Run();
+						continue;
+					}
+					/* As in 'Emulator::RunCore', minus the frame pacing. */
+					FrameOutput output{};
+					core->RunFrame(output);
+					if (!output.audio_samples_f32.empty()) {
+						Audio::EnqueueSamples(output.audio_samples_f32);
+					}
+					else if (!output.audio_samples_s16.empty()) {
+						Audio::EnqueueSamples(output.audio_samples_s16);
+					}
+					if (!output.pixels.empty()) {
+						Video::SubmitFrame(output.pixels.data(), output.width, output.height, output.pitch);
+					}
+					else {
+						++frame_sink.num_frames;
+					}
+				}
+			}
+		}
+		catch (const std::exception& e) {
+			result.status = Status::Crashed;
+			result.error = e.what();
+		}
+		catch (...) {
+			result.status = Status::Crashed;
+			result.error = "unknown exception";
+		}
+
+		Video::SetThreadFrameSink(nullptr);
+		Audio::SetThreadSampleSink(nullptr);
+		result.num_frames = frame_sink.num_frames;
+		result.wall_time_s = GetElapsedTime();
+		result.frames_per_second = result.wall_time_s > 0.0 ? f64(result.num_frames) / result.wall_time_s : 0.0;
+		result.frame_hash = frame_sink.frame_hash;
+		result.num_audio_samples = sample_sink.num_samples;
+		return result;
+	}
+
+
+	std::string_view ToString(RomResult::Status status)
+	{
+		using enum RomResult::Status;
+		switch (status) {
+		case Ok: return "ok";
+		case BiosError: return "bios error";
+		case LoadError: return "load error";
+		case TimedOut: return "timed out";
+		case Crashed: return "crashed";
+		default: return "";
+		}
+	}
+}
\ No newline at end of file
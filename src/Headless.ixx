@@ -0,0 +1,82 @@
+export module Headless;
+
+import Core;
+import ThreadPool;
+import Types;
+
+import <chrono>;
+import <exception>;
+import <format>;
+import <functional>;
+import <iostream>;
+import <limits>;
+import <memory>;
+import <mutex>;
+import <string>;
+import <string_view>;
+import <vector>;
+
+namespace Headless
+{
+	export
+	{
+		struct RunOptions
+		{
+			u64 num_frames = std::numeric_limits<u64>::max(); /* stop after this many frames... */
+			std::function<bool()> stop_condition; /* ...or once this returns true, checked between calls to Core::Run */
+			std::string movie_path; /* if set, the input of this movie is played back, and the run stops when it ends */
+			bool print_results = true;
+		};
+
+		struct RunResults
+		{
+			u64 num_frames;
+			f64 wall_time_s;
+			f64 frames_per_second;
+			f64 emulated_time_ratio; /* emulated time divided by wall time */
+		};
+
+		struct RomResult
+		{
+			enum class Status {
+				Ok,
+				BiosError,
+				LoadError,
+				TimedOut,
+				Crashed
+			};
+
+			std::string rom_path;
+			Status status;
+			std::string error; /* what was thrown, if the core crashed */
+			u64 num_frames;
+			f64 wall_time_s;
+			f64 frames_per_second;
+			u64 frame_hash; /* of every frame, in order; equal for two runs that rendered the same frames */
+			u64 num_audio_samples;
+		};
+
+		/* Runs many roms at once, each in an instance of its own: a core made by 'create_core', with its
+		   own framebuffer and audio, and no input. Instances are spread over a pool of threads. */
+		struct BatchOptions
+		{
+			std::function<std::shared_ptr<Core>()> create_core;
+			std::vector<std::string> rom_paths;
+			std::string bios_path; /* loaded into every instance, if set */
+			u64 num_frames = 3600; /* per rom */
+			uint num_threads = 0; /* 0 for one per hardware thread */
+			f64 timeout_s = std::numeric_limits<f64>::infinity(); /* per rom, checked between frames */
+			std::function<void(const RomResult&)> on_result; /* called as each rom finishes, one call at a time */
+			bool print_results = true;
+		};
+
+		bool Initialize(std::shared_ptr<Core> core);
+		bool LoadBios(const std::string& bios_path);
+		bool LoadGame(const std::string& rom_path);
+		RunResults Run(const RunOptions& options);
+		std::vector<RomResult> RunBatch(const BatchOptions& options);
+	}
+
+	RomResult RunInstance(const BatchOptions& options, const std::string& rom_path);
+	std::string_view ToString(RomResult::Status status);
+}
\ No newline at end of file
@@ -3,6 +3,8 @@ module Input;
 import Frontend;
 import UserMessage;
 
+import <format>;
+
 namespace Input
 {
 	SDL_Event event;
@@ -15,19 +17,19 @@ namespace Input
 				switch (event.type) {
 
 				case SDL_CONTROLLERAXISMOTION:
-					if (MatchInput<HostInputType::ControllerAxis>(event.caxis.axis, event.caxis.which, event.caxis.value)) {
+					if (MatchInput<HostInputType::ControllerAxis>(event.caxis.timestamp, event.caxis.axis, event.caxis.value, event.caxis.which)) {
 						return;
 					}
 					break;
 
 				case SDL_CONTROLLERBUTTONDOWN:
-					if (MatchInput<HostInputType::ControllerButton, ButtonEvent::Press>(event.cbutton.button, event.cbutton.which)) {
+					if (MatchInput<HostInputType::ControllerButton, ButtonEvent::Press>(event.cbutton.timestamp, event.cbutton.button, 0, event.cbutton.which)) {
 						return;
 					}
 					break;
 
 				case SDL_CONTROLLERBUTTONUP:
-					if (MatchInput<HostInputType::ControllerButton, ButtonEvent::Release>(event.cbutton.button, event.cbutton.which)) {
+					if (MatchInput<HostInputType::ControllerButton, ButtonEvent::Release>(event.cbutton.timestamp, event.cbutton.button, 0, event.cbutton.which)) {
 						return;
 					}
 					break;
@@ -38,25 +40,25 @@ namespace Input
 					break;
 
 				case SDL_KEYDOWN:
-					if (MatchInput<HostInputType::Key, ButtonEvent::Press>(event.key.keysym.sym)) {
+					if (MatchInput<HostInputType::Key, ButtonEvent::Press>(event.key.timestamp, event.key.keysym.sym)) {
 						return;
 					}
 					break;
 
 				case SDL_KEYUP:
-					if (MatchInput<HostInputType::Key, ButtonEvent::Release>(event.key.keysym.sym)) {
+					if (MatchInput<HostInputType::Key, ButtonEvent::Release>(event.key.timestamp, event.key.keysym.sym)) {
 						return;
 					}
 					break;
 
 				case SDL_MOUSEBUTTONDOWN:
-					if (MatchInput<HostInputType::MouseButton, ButtonEvent::Press>(event.button.button)) {
+					if (MatchInput<HostInputType::MouseButton, ButtonEvent::Press>(event.button.timestamp, event.button.button)) {
 						return;
 					}
 					break;
 
 				case SDL_MOUSEBUTTONUP:
-					if (MatchInput<HostInputType::MouseButton, ButtonEvent::Release>(event.button.button)) {
+					if (MatchInput<HostInputType::MouseButton, ButtonEvent::Release>(event.button.timestamp, event.button.button)) {
 						return;
 					}
 					break;
@@ -80,6 +82,82 @@ namespace Input
 	void ClearBindings(uint player_index)
 	{
 		std::ranges::fill(players.at(player_index).core_bindings, unbound_host_input);
+		RebuildDispatchTable();
+	}
+
+
+	void Deliver(const InputEvent& input_event, Core& core, Core* secondary_core)
+	{
+		/* The secondary core, if any, is used for running ahead, and must see the same input. */
+		for (Core* target : { &core, secondary_core }) {
+			if (!target) {
+				continue;
+			}
+			switch (input_event.type) {
+			case InputEventType::AxisMotion:
+				target->NotifyNewAxisValue(input_event.player_index, input_event.core_action_index, input_event.axis_value);
+				break;
+
+			case InputEventType::ButtonPress:
+				target->NotifyButtonPressed(input_event.player_index, input_event.core_action_index);
+				break;
+
+			case InputEventType::ButtonRelease:
+				target->NotifyButtonReleased(input_event.player_index, input_event.core_action_index);
+				break;
+			}
+		}
+	}
+
+
+	void DeliverQueuedEvents(Core& core, Core* secondary_core, Movie::Mode movie_mode)
+	{
+		InputEvent input_event;
+		while (event_queue.Pop(input_event)) {
+			bool deliver = true;
+			if (movie_mode == Movie::Mode::Playing) {
+				deliver = false; /* the movie is in control */
+			}
+			else if (movie_mode == Movie::Mode::Recording) {
+				deliver = input_event.type == InputEventType::AxisMotion
+					? Movie::RecordAxis(input_event.player_index, input_event.core_action_index, input_event.axis_value)
+					: Movie::RecordButton(input_event.player_index, input_event.core_action_index,
+						input_event.type == InputEventType::ButtonPress);
+			}
+			if (deliver) {
+				Deliver(input_event, core, secondary_core);
+				Profiler::Record(Profiler::Stage::InputLatch, input_event.queue_time);
+			}
+		}
+	}
+
+
+	size_t DispatchHash(HostInputType type, s32 value, SDL_JoystickID joystick_id)
+	{
+		u64 key = u64(u32(value)) | u64(u32(joystick_id)) << 32;
+		key ^= u64(type) * 0x9E37'79B9'7F4A'7C15;
+		key ^= key >> 33;
+		key *= 0xFF51'AFD7'ED55'8CCD;
+		key ^= key >> 33;
+		return size_t(key);
+	}
+
+
+	const DispatchEntry* FindDispatchEntry(HostInputType type, s32 value, SDL_JoystickID joystick_id)
+	{
+		if (dispatch_table.empty()) {
+			return nullptr;
+		}
+		size_t index_mask = dispatch_table.size() - 1;
+		for (size_t i = DispatchHash(type, value, joystick_id) & index_mask; ; i = (i + 1) & index_mask) {
+			const DispatchEntry& entry = dispatch_table[i];
+			if (!entry.occupied) {
+				return nullptr;
+			}
+			if (entry.type == type && entry.value == value && entry.joystick_id == joystick_id) {
+				return &entry;
+			}
+		}
 	}
 
 
@@ -91,47 +169,117 @@ namespace Input
 
 	bool Initialize()
 	{
-		for (Player& player : players) {
-			player.active = true;
-			player.core_bindings.resize(num_core_inputs);
-			for (HostInputBinding& binding : player.core_bindings) {
-				binding = unbound_host_input;
-			}
+		/* Game controllers are not opened here; see 'InitializeGameControllers'. Nothing is asked of SDL, so
+		   this may run on another thread while the window is created. */
+		ResetPlayers();
+		LoadBindings();
+		return true;
+	}
+
+
+	bool InitializeGameControllers()
+	{
+		/* Bringing up the game controller subsystem enumerates every HID device, which can take a good part
+		   of a second on some systems. The frontend therefore puts it off until the first frame is shown. */
+		if (SDL_InitSubSystem(SDL_INIT_GAMECONTROLLER) != 0) {
+			UserMessage::Show(std::format("Could not initialize game controllers; {}", SDL_GetError()),
+				UserMessage::Type::Warning);
+			return false;
 		}
 		OpenGameControllers();
-		LoadBindings();
 		return true;
 	}
 
 
+	bool InitializeHeadless()
+	{
+		/* There are no host input devices; all bindings stay unbound. */
+		ResetPlayers();
+		return true;
+	}
+
+
+	void InsertDispatchEntry(const DispatchEntry& entry)
+	{
+		size_t index_mask = dispatch_table.size() - 1;
+		for (size_t i = DispatchHash(entry.type, entry.value, entry.joystick_id) & index_mask; ; i = (i + 1) & index_mask) {
+			DispatchEntry& slot = dispatch_table[i];
+			if (!slot.occupied) {
+				slot = entry;
+				slot.occupied = true;
+				return;
+			}
+			if (slot.type == entry.type && slot.value == entry.value && slot.joystick_id == entry.joystick_id) {
+				return; /* The same host input is bound more than once; the first binding wins, as with the linear scan. */
+			}
+		}
+	}
+
+
 	std::string JoystickIdToGuid(SDL_JoystickID joystick_id)
 	{
+		/* An empty guid means that the binding is not tied to a specific controller. */
 		SDL_Joystick* joystick = SDL_JoystickFromInstanceID(joystick_id);
+		if (!joystick) {
+			return {};
+		}
 		SDL_JoystickGUID joystick_guid = SDL_JoystickGetGUID(joystick); /* typedef struct { Uint8 data[16]; } */
 		/* SDL_joystick.h: "You should supply at least 33 bytes [for the buffer] [for SDL_JoystickGetGUIDString]" */
-		std::string joystick_guid_str;
-		joystick_guid_str.reserve(33);
-		SDL_JoystickGetGUIDString(joystick_guid, joystick_guid_str.data(), 33);
-		return joystick_guid_str;
+		std::array<char, 33> joystick_guid_str;
+		SDL_JoystickGetGUIDString(joystick_guid, joystick_guid_str.data(), int(joystick_guid_str.size()));
+		return joystick_guid_str.data();
 	}
 
 
 	void LoadBindings()
 	{
-		//if (!std::filesystem::exists(bindings_file_path)) {
-		//	return;
-		//}
-		//SerializationStream stream{ SerializationMode::Read, bindings_file_path };
-		//if (stream.HasError()) {
-		//	UserMessage::Show("Could not load input bindings.", UserMessage::Type::Warning);
-		//	return;
-		//}
-		// TODO
+		if (!std::filesystem::exists(bindings_file_path)) {
+			return;
+		}
+		SerializationStream stream{ SerializationMode::Read, bindings_file_path };
+		/* Read into a copy, so that a bad file leaves the current bindings as they are. */
+		std::array<Player, max_players> loaded_players = players;
+		StreamPlayers(stream, loaded_players);
+		if (stream.HasError()) {
+			UserMessage::Show("Could not load input bindings.", UserMessage::Type::Warning);
+			return;
+		}
+		players = std::move(loaded_players);
+		RebuildDispatchTable();
+	}
+
+
+	void OnNewFrame()
+	{
+		/* Called on the emulation thread at the end of every frame, to latch the input of the next one. */
+		std::shared_ptr<Core> core = Emulator::GetCore();
+		std::shared_ptr<Core> secondary_core = Emulator::GetSecondaryCore();
+		Movie::Mode movie_mode = Movie::GetMode();
+		DeliverQueuedEvents(*core, secondary_core.get(), movie_mode);
+		if (movie_mode == Movie::Mode::Recording) {
+			Movie::EndRecordedFrame();
+		}
+		else if (movie_mode == Movie::Mode::Playing) {
+			for (const Movie::FrameInput& frame_input : Movie::PlayFrame()) {
+				InputEvent input_event = {
+					.type = frame_input.type == Movie::InputType::AxisMotion ? InputEventType::AxisMotion
+						: frame_input.type == Movie::InputType::ButtonPress ? InputEventType::ButtonPress
+						: InputEventType::ButtonRelease,
+					.axis_value = frame_input.axis_value,
+					.core_action_index = frame_input.core_action_index,
+					.player_index = frame_input.player_index
+				};
+				Deliver(input_event, *core, secondary_core.get());
+			}
+		}
 	}
 
 
 	void OpenGameControllers()
 	{
+		for (SDL_GameController* controller : controllers) {
+			SDL_GameControllerClose(controller);
+		}
 		controllers.clear();
 		for (int i = 0; i < SDL_NumJoysticks(); ++i) {
 			if (SDL_IsGameController(i)) {
@@ -141,6 +289,22 @@ namespace Input
 				}
 			}
 		}
+		/* Instance ids are assigned anew whenever a device is connected. */
+		RebuildDispatchTable();
+	}
+
+
+	void Poll()
+	{
+		/* Hands all queued input to the core. May be called by a core that wants to latch input at a specific
+		   point during 'Run'. While a movie is recorded or played back, input only ever reaches the core at
+		   the end of a frame, in 'OnNewFrame', so that it can be replayed at exactly the same point. */
+		Movie::Mode movie_mode = Movie::GetMode();
+		if (movie_mode == Movie::Mode::Off) {
+			std::shared_ptr<Core> core = Emulator::GetCore();
+			std::shared_ptr<Core> secondary_core = Emulator::GetSecondaryCore();
+			DeliverQueuedEvents(*core, secondary_core.get(), movie_mode);
+		}
 	}
 
 
@@ -149,15 +313,15 @@ namespace Input
 		switch (event.type) {
 
 		case SDL_CONTROLLERAXISMOTION:
-			MatchInput<HostInputType::ControllerAxis>(event.caxis.axis, event.caxis.which, event.caxis.value);
+			MatchInput<HostInputType::ControllerAxis>(event.caxis.timestamp, event.caxis.axis, event.caxis.value, event.caxis.which);
 			break;
 
 		case SDL_CONTROLLERBUTTONDOWN:
-			MatchInput<HostInputType::ControllerButton, ButtonEvent::Press>(event.cbutton.button, event.cbutton.which);
+			MatchInput<HostInputType::ControllerButton, ButtonEvent::Press>(event.cbutton.timestamp, event.cbutton.button, 0, event.cbutton.which);
 			break;
 
 		case SDL_CONTROLLERBUTTONUP:
-			MatchInput<HostInputType::ControllerButton, ButtonEvent::Release>(event.cbutton.button, event.cbutton.which);
+			MatchInput<HostInputType::ControllerButton, ButtonEvent::Release>(event.cbutton.timestamp, event.cbutton.button, 0, event.cbutton.which);
 			break;
 
 		case SDL_CONTROLLERDEVICEADDED:
@@ -166,20 +330,20 @@ namespace Input
 			break;
 
 		case SDL_KEYDOWN: {
-			MatchInput<HostInputType::Key, ButtonEvent::Press>(event.key.keysym.sym);
+			MatchInput<HostInputType::Key, ButtonEvent::Press>(event.key.timestamp, event.key.keysym.sym);
 			break;
 		}
 
 		case SDL_KEYUP:
-			MatchInput<HostInputType::Key, ButtonEvent::Release>(event.key.keysym.sym);
+			MatchInput<HostInputType::Key, ButtonEvent::Release>(event.key.timestamp, event.key.keysym.sym);
 			break;
 
 		case SDL_MOUSEBUTTONDOWN:
-			MatchInput<HostInputType::MouseButton, ButtonEvent::Press>(event.button.button);
+			MatchInput<HostInputType::MouseButton, ButtonEvent::Press>(event.button.timestamp, event.button.button);
 			break;
 
 		case SDL_MOUSEBUTTONUP:
-			MatchInput<HostInputType::MouseButton, ButtonEvent::Release>(event.button.button);
+			MatchInput<HostInputType::MouseButton, ButtonEvent::Release>(event.button.timestamp, event.button.button);
 			break;
 
 		default:
@@ -188,14 +352,89 @@ namespace Input
 	}
 
 
+	void RebuildDispatchTable()
+	{
+		/* Controller bindings refer to devices by guid, which is stable across sessions, while events refer to
+		   them by instance id, which is not. Resolve the one to the other here, rather than on every event. */
+		std::vector<std::pair<SDL_JoystickID, std::string>> joysticks;
+		joysticks.reserve(controllers.size());
+		for (SDL_GameController* controller : controllers) {
+			SDL_JoystickID joystick_id = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(controller));
+			joysticks.emplace_back(joystick_id, JoystickIdToGuid(joystick_id));
+		}
+
+		auto is_controller_input = [](HostInputType type) {
+			return type == HostInputType::ControllerAxis || type == HostInputType::ControllerButton;
+		};
+
+		size_t num_entries = 0;
+		for (const Player& player : players) {
+			if (!player.active) {
+				continue;
+			}
+			for (const HostInputBinding& binding : player.core_bindings) {
+				if (binding.value != unbound_host_action_value) {
+					num_entries += is_controller_input(binding.type) ? joysticks.size() : 1;
+				}
+			}
+		}
+		dispatch_table.assign(std::bit_ceil(std::max(2 * num_entries, size_t(16))), {});
+
+		for (uint player_index = 0; player_index < max_players; ++player_index) {
+			const Player& player = players[player_index];
+			if (!player.active) {
+				continue;
+			}
+			for (size_t core_action_index = 0; core_action_index < player.core_bindings.size(); ++core_action_index) {
+				const HostInputBinding& binding = player.core_bindings[core_action_index];
+				if (binding.value == unbound_host_action_value) {
+					continue;
+				}
+				DispatchEntry entry = {
+					.type = binding.type,
+					.value = binding.value,
+					.joystick_id = default_joystick_id,
+					.core_action_index = u16(core_action_index),
+					.player_index = u8(player_index),
+					.occupied = true
+				};
+				if (is_controller_input(binding.type)) {
+					for (const auto& [joystick_id, joystick_guid] : joysticks) {
+						if (binding.joystick_guid.empty() || binding.joystick_guid == joystick_guid) {
+							entry.joystick_id = joystick_id;
+							InsertDispatchEntry(entry);
+						}
+					}
+				}
+				else {
+					InsertDispatchEntry(entry);
+				}
+			}
+		}
+	}
+
+
+	void ResetPlayers()
+	{
+		for (Player& player : players) {
+			player.active = true;
+			player.core_bindings.resize(num_core_inputs);
+			for (HostInputBinding& binding : player.core_bindings) {
+				binding = unbound_host_input;
+			}
+		}
+		RebuildDispatchTable();
+	}
+
+
 	void SaveBindings()
 	{
-		/*SerializationStream stream{ SerializationMode::Write, bindings_file_path };
-		if (stream.HasError()) {
+		SerializationStream stream{ SerializationMode::Write, bindings_file_path };
+		StreamPlayers(stream, players);
+		if (!stream.Flush()) {
 			UserMessage::Show("Could not save input bindings.", UserMessage::Type::Warning);
 			return;
-		}*/
-		// TODO
+		}
 	}
 
 
@@ -215,11 +454,34 @@ namespace Input
 	void SetPlayerActive(uint player_index)
 	{
 		players.at(player_index).active = true;
+		RebuildDispatchTable();
 	}
 
 
 	void SetPlayerInactive(uint player_index)
 	{
 		players.at(player_index).active = false;
+		RebuildDispatchTable();
+	}
+
+
+	void StreamPlayers(SerializationStream& stream, std::array<Player, max_players>& players_to_stream)
+	{
+		stream.StreamHeader("BIND", bindings_file_version);
+		for (Player& player : players_to_stream) {
+			stream.Stream(player.active);
+			u64 num_bindings = player.core_bindings.size();
+			stream.Stream(num_bindings);
+			if (num_bindings != player.core_bindings.size()) {
+				/* Made for a core with a different set of actions. Reading the rest would only fail anyway. */
+				stream.SetError();
+				return;
+			}
+			for (HostInputBinding& binding : player.core_bindings) {
+				stream.Stream(binding.type);
+				stream.Stream(binding.value);
+				stream.Stream(binding.joystick_guid);
+			}
+		}
 	}
 }
\ No newline at end of file
@@ -2,14 +2,20 @@ export module Input;
 
 import Core;
 import Emulator;
+import Movie;
+import Profiler;
+import RingBuffer;
+import Serialization;
 import Types;
 
 import <SDL.h>;
 
 import <algorithm>;
 import <array>;
+import <bit>;
 import <cassert>;
 import <filesystem>;
+import <memory>;
 import <string>;
 import <string_view>;
 import <type_traits>;
@@ -22,6 +28,7 @@ namespace Input
 	export
 	{
 		constexpr SDL_JoystickID default_joystick_id = -1;
+		constexpr uint max_players = 4;
 
 		enum class HostInputType { /* As of SDL2.0.22: */
 			ControllerAxis,   /* SDL_ControllerAxisEvent; axis enumeration accessed from event.caxis.axis; typedef of Uint8. */
@@ -36,9 +43,13 @@ namespace Input
 		void ClearBindings(uint player_index);
 		std::vector<std::string_view> GetCoreActionNames();
 		bool Initialize();
+		bool InitializeGameControllers();
+		bool InitializeHeadless();
 		std::string JoystickIdToGuid(SDL_JoystickID joystick_id);
 		void LoadBindings();
+		void OnNewFrame();
 		void OpenGameControllers();
+		void Poll();
 		void ProcessEvent(SDL_Event event);
 		void RemoveBinding(uint player_index, auto core_action);
 		void SaveBindings();
@@ -52,6 +63,21 @@ namespace Input
 		Press, Release
 	};
 
+	enum class InputEventType {
+		AxisMotion, ButtonPress, ButtonRelease
+	};
+
+	/* A matched host input, on its way from the gui thread to the core. */
+	struct InputEvent
+	{
+		Profiler::Clock::time_point queue_time;
+		u32 timestamp; /* SDL_Event timestamp; milliseconds since SDL initialization */
+		InputEventType type;
+		s16 axis_value;
+		u16 core_action_index;
+		u8 player_index;
+	};
+
 	struct HostInputBinding
 	{
 		HostInputType type;
@@ -65,10 +91,36 @@ namespace Input
 		std::vector<HostInputBinding> core_bindings;
 	};
 
+	/* An entry in the dispatch table: the host input (type, value, device instance) that an event carries,
+	   and the player and core action it is bound to. */
+	struct DispatchEntry
+	{
+		HostInputType type;
+		s32 value;
+		SDL_JoystickID joystick_id;
+		u16 core_action_index;
+		u8 player_index;
+		bool occupied;
+	};
+
+	void Deliver(const InputEvent& input_event, Core& core, Core* secondary_core);
+	void DeliverQueuedEvents(Core& core, Core* secondary_core, Movie::Mode movie_mode);
+	size_t DispatchHash(HostInputType type, s32 value, SDL_JoystickID joystick_id);
+	const DispatchEntry* FindDispatchEntry(HostInputType type, s32 value, SDL_JoystickID joystick_id);
+	void InsertDispatchEntry(const DispatchEntry& entry);
+	void RebuildDispatchTable();
+	void ResetPlayers();
+
 	template<HostInputType host_input_type, ButtonEvent button_event = ButtonEvent::Press>
-	bool MatchInput(s32 value, s16 axis_value = 0, SDL_JoystickID joystick_id = default_joystick_id);
+	bool MatchInput(u32 timestamp, s32 value, s16 axis_value = 0, SDL_JoystickID joystick_id = default_joystick_id);
+
+	void StreamPlayers(SerializationStream& stream, std::array<Player, max_players>& players_to_stream);
 
-	constexpr uint max_players = 4;
+	constexpr u32 bindings_file_version = 1;
+
+	const std::filesystem::path bindings_file_path = "bindings.bin";
+
+	constexpr size_t event_queue_capacity = 1024;
 
 	constexpr s32 unbound_host_action_value = -1;
 
@@ -84,87 +136,79 @@ namespace Input
 
 	std::vector<SDL_GameController*> controllers;
 
+	/* All bindings of all active players, compiled into an open addressing hash table, so that matching an
+	   event is a single probe sequence without any allocations or string comparisons. The table is at most
+	   half full, which keeps probe sequences short. It is rebuilt whenever the bindings, the active players
+	   or the connected controllers change. */
+	std::vector<DispatchEntry> dispatch_table;
+
+	/* Events are matched on the gui thread, but only handed to the core on the emulation thread, between
+	   frames or when the core polls, so that the core never sees its input change in the middle of 'Run'.
+	   If the emulation thread stops draining the queue, e.g. while paused, new events are dropped once it
+	   is full. */
+	RingBuffer<InputEvent> event_queue{ event_queue_capacity };
+
 	std::vector<std::string_view> core_action_names;
 
 	/// Template definitions ////////////////////////////
 	void AddBinding(uint player_index, auto core_action, HostInputType host_input_type, s32 host_value, SDL_JoystickID joystick_id)
 	{
 		auto core_action_index = std::to_underlying(core_action);
-		std::vector<HostInputBinding> input_set = players.at(player_index).core_bindings;
+		std::vector<HostInputBinding>& input_set = players.at(player_index).core_bindings;
 		input_set[core_action_index] = {
 			.type = host_input_type,
 			.value = host_value,
 			.joystick_guid = JoystickIdToGuid(joystick_id)
 		};
+		RebuildDispatchTable();
 	}
 
 
 	template<HostInputType host_input_type, ButtonEvent button_event>
-	bool MatchInput(s32 value, s16 axis_value, SDL_JoystickID joystick_id)
+	bool MatchInput(u32 timestamp, s32 value, s16 axis_value, SDL_JoystickID joystick_id)
 	{
 		static constexpr bool controller_input = 
 			host_input_type == HostInputType::ControllerAxis || host_input_type == HostInputType::ControllerButton;
 
-		std::string_view joystick_guid;
-		if constexpr (controller_input) {
-			joystick_guid = JoystickIdToGuid(joystick_id);
+		/* Keyboard and mouse bindings are not tied to a device. */
+		const DispatchEntry* entry = FindDispatchEntry(host_input_type, value,
+			controller_input ? joystick_id : default_joystick_id);
+		if (!entry) {
+			return false;
 		}
 
-		auto core = Emulator::GetCore();
-		uint core_action_index;
-		uint player_index = 0;
-		for ( ; player_index < max_players; ++player_index) {
-			const Player& player = players[player_index];
-			if (!player.active) {
-				continue;
-			}
-			const std::vector<HostInputBinding> input_set = player.core_bindings;
-			auto it_core_action_index = std::ranges::find_if(input_set, [&](HostInputBinding binding) {
-				return binding.type == host_input_type
-					&& binding.value == value
-					&& [&] {
-						if constexpr (controller_input) {
-							return binding.joystick_guid.compare(joystick_guid) == 0;
-						}
-						else {
-							return true;
-						}
-					}();
-				});
-			if (it_core_action_index != input_set.end()) {
-				core_action_index = (uint)std::distance(input_set.begin(), it_core_action_index);
-				break;
-			}
+		InputEventType type;
+		if constexpr (host_input_type == HostInputType::ControllerAxis) {
+			type = InputEventType::AxisMotion;
 		}
-
-		bool binding_found = player_index < max_players;
-		if (binding_found) {
-			if constexpr (host_input_type == HostInputType::ControllerAxis) {
-				core->NotifyNewAxisValue(player_index, core_action_index, axis_value);
+		else { /* ControllerButton, Key, or MouseButton */
+			if constexpr (button_event == ButtonEvent::Press) {
+				type = InputEventType::ButtonPress;
 			}
-			else { /* ControllerButton, Key, or MouseButton */
-				if constexpr (button_event == ButtonEvent::Press) {
-					core->NotifyButtonPressed(player_index, core_action_index);
-				}
-				else if constexpr (button_event == ButtonEvent::Release) {
-					core->NotifyButtonReleased(player_index, core_action_index);
-				}
-				else {
-					static_assert(AlwaysFalse<host_input_type>);
-				}
+			else if constexpr (button_event == ButtonEvent::Release) {
+				type = InputEventType::ButtonRelease;
+			}
+			else {
+				static_assert(AlwaysFalse<host_input_type>);
 			}
-			return true;
-		}
-		else {
-			return false;
 		}
+		event_queue.Push({
+			.queue_time = Profiler::Now(),
+			.timestamp = timestamp,
+			.type = type,
+			.axis_value = axis_value,
+			.core_action_index = entry->core_action_index,
+			.player_index = entry->player_index
+		});
+		return true;
 	}
 
 
 	void RemoveBinding(uint player_index, auto core_action /* enum */)
 	{
 		auto core_action_index = std::to_underlying(core_action);
-		std::vector<HostInputBinding> input_set = players.at(player_index).core_bindings;
+		std::vector<HostInputBinding>& input_set = players.at(player_index).core_bindings;
 		input_set[core_action_index] = unbound_host_input;
+		RebuildDispatchTable();
 	}
 }
\ No newline at end of file
@@ -0,0 +1,120 @@
+module;
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+module MappedFile;
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+	Open(path);
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (data) {
+		UnmapViewOfFile(data);
+	}
+	if (mapping_handle) {
+		CloseHandle(mapping_handle);
+	}
+	if (file_handle) {
+		CloseHandle(file_handle);
+	}
+	file_handle = mapping_handle = nullptr;
+#else
+	if (data) {
+		munmap(const_cast<u8*>(data), size);
+	}
+	if (file_descriptor != -1) {
+		close(file_descriptor);
+	}
+	file_descriptor = -1;
+#endif
+	data = nullptr;
+	size = 0;
+	is_open = false;
+}
+
+
+std::span<const u8> MappedFile::Data() const
+{
+	return { data, size };
+}
+
+
+bool MappedFile::IsOpen() const
+{
+	return is_open;
+}
+
+
+bool MappedFile::Open(const std::filesystem::path& path)
+{
+	Close();
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	file_handle = file;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		Close();
+		return false;
+	}
+	size = size_t(file_size.QuadPart);
+	if (size > 0) {
+		/* Files of size zero cannot be mapped, but are perfectly valid to open. */
+		mapping_handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping_handle) {
+			Close();
+			return false;
+		}
+		data = static_cast<const u8*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+		if (!data) {
+			Close();
+			return false;
+		}
+	}
+#else
+	file_descriptor = open(path.c_str(), O_RDONLY);
+	if (file_descriptor == -1) {
+		return false;
+	}
+	struct stat file_status;
+	if (fstat(file_descriptor, &file_status) != 0) {
+		Close();
+		return false;
+	}
+	size = size_t(file_status.st_size);
+	if (size > 0) {
+		/* Files of size zero cannot be mapped, but are perfectly valid to open. */
+		void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+		if (mapping == MAP_FAILED) {
+			size = 0;
+			Close();
+			return false;
+		}
+		data = static_cast<const u8*>(mapping);
+	}
+#endif
+	is_open = true;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+export module MappedFile;
+
+import Types;
+
+import <filesystem>;
+import <span>;
+
+/* A read-only view of a whole file, mapped into memory. Reading through the mapping costs no more than
+   the copy out of it; there are no intermediate buffers and no system call per read. */
+export class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::filesystem::path& path);
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	void Close();
+	std::span<const u8> Data() const;
+	bool IsOpen() const;
+	bool Open(const std::filesystem::path& path);
+
+private:
+	bool is_open = false;
+	const u8* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
\ No newline at end of file
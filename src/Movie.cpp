@@ -0,0 +1,401 @@
+module Movie;
+
+import Input;
+import Serialization;
+import UserMessage;
+
+import <format>;
+import <limits>;
+import <string>;
+
+namespace Movie
+{
+	void Begin(Core& core, Core* secondary_core)
+	{
+		/* Starts a pending movie. Called on the emulation thread between calls to 'Core::Run', where the
+		   core state may be saved, loaded or reset. */
+		if (!start_is_pending.load(std::memory_order_acquire)) {
+			return;
+		}
+		std::string error_message;
+		{
+			std::lock_guard lock{ mutex };
+			if (!start_is_pending) {
+				return; /* stopped in the meantime */
+			}
+			start_is_pending = false;
+			/* Every button starts out released, so that the movie need not know what was held before it. */
+			for (Core* target : { &core, secondary_core }) {
+				if (target) {
+					for (uint player_index = 0; player_index < num_players; ++player_index) {
+						for (uint core_action_index = 0; core_action_index < num_core_inputs; ++core_action_index) {
+							target->NotifyButtonReleased(player_index, core_action_index);
+						}
+					}
+				}
+			}
+			ResetPlayers();
+			frame = 0;
+			if (pending_mode == Mode::Recording) {
+				initial_state.resize(core.GetStateSize());
+				frame_data.clear();
+				num_frames_without_input = 0;
+				if (initial_state.empty() || core.SaveStateToMemory(initial_state)) {
+					mode = Mode::Recording;
+				}
+				else {
+					error_message = "Could not record a movie; the core state could not be saved.";
+				}
+			}
+			else {
+				frame_data_position = 0;
+				frame_data_error = false;
+				num_frames_without_input = frame_data.empty() ? num_frames : ReadVarint();
+				if (initial_state.empty() || core.LoadStateFromMemory(initial_state)) {
+					mode = Mode::Playing;
+				}
+				else {
+					error_message = std::format("Could not play the movie at {}; its initial core state could not be loaded.",
+						path.string());
+				}
+			}
+			if (initial_state.empty() && mode != Mode::Off) {
+				core.Reset();
+				if (secondary_core) {
+					secondary_core->Reset();
+				}
+			}
+		}
+		if (!error_message.empty()) {
+			UserMessage::Post(error_message, UserMessage::Type::Warning);
+		}
+	}
+
+
+	bool DecodeFrame()
+	{
+		/* Decodes the input of the next stored frame into 'frame_inputs', and the number of frames without
+		   input that follow it. Returns false if the frame data is malformed. */
+		if (frame_data_position == frame_data.size()) {
+			return false;
+		}
+		u8 changed_players = frame_data[frame_data_position++];
+		if (changed_players >> num_players) {
+			return false;
+		}
+		for (uint player_index = 0; player_index < num_players; ++player_index) {
+			if (!(changed_players & 1 << player_index)) {
+				continue;
+			}
+			PlayerInput& player = players[player_index];
+			u64 num_toggled_buttons = ReadVarint();
+			for (u64 i = 0; i < num_toggled_buttons && !frame_data_error; ++i) {
+				u64 core_action_index = ReadVarint();
+				if (core_action_index >= num_core_inputs) {
+					return false;
+				}
+				TogglePressed(player, uint(core_action_index));
+				frame_inputs.push_back({
+					.type = IsPressed(player, uint(core_action_index)) ? InputType::ButtonPress : InputType::ButtonRelease,
+					.axis_value = 0,
+					.core_action_index = u16(core_action_index),
+					.player_index = u8(player_index)
+				});
+			}
+			u64 num_moved_axes = ReadVarint();
+			for (u64 i = 0; i < num_moved_axes && !frame_data_error; ++i) {
+				u64 core_action_index = ReadVarint();
+				u64 zigzag_difference = ReadVarint();
+				if (core_action_index >= num_core_inputs) {
+					return false;
+				}
+				s32 difference = s32(zigzag_difference >> 1) ^ -s32(zigzag_difference & 1);
+				s16& axis_value = player.axis_values[core_action_index];
+				axis_value = s16(axis_value + difference);
+				frame_inputs.push_back({
+					.type = InputType::AxisMotion,
+					.axis_value = axis_value,
+					.core_action_index = u16(core_action_index),
+					.player_index = u8(player_index)
+				});
+			}
+		}
+		num_frames_without_input = frame_data_position < frame_data.size()
+			? ReadVarint()
+			: std::numeric_limits<u64>::max(); /* no input until the end */
+		return !frame_data_error;
+	}
+
+
+	void EndRecordedFrame()
+	{
+		/* Called on the emulation thread at the end of every frame, once its input has been recorded. */
+		std::lock_guard lock{ mutex };
+		if (mode != Mode::Recording) {
+			return;
+		}
+		++frame;
+		u8 changed_players = 0;
+		for (uint player_index = 0; player_index < num_players; ++player_index) {
+			const PlayerInput& player = players[player_index];
+			if (!player.toggled_buttons.empty() || !player.moved_axes.empty()) {
+				changed_players |= 1 << player_index;
+			}
+		}
+		if (changed_players == 0) {
+			++num_frames_without_input;
+			return;
+		}
+		WriteVarint(num_frames_without_input);
+		num_frames_without_input = 0;
+		frame_data.push_back(changed_players);
+		for (uint player_index = 0; player_index < num_players; ++player_index) {
+			if (!(changed_players & 1 << player_index)) {
+				continue;
+			}
+			PlayerInput& player = players[player_index];
+			WriteVarint(player.toggled_buttons.size());
+			for (u16 core_action_index : player.toggled_buttons) {
+				WriteVarint(core_action_index);
+			}
+			WriteVarint(player.moved_axes.size());
+			for (u16 core_action_index : player.moved_axes) {
+				s32 difference = player.axis_values[core_action_index] - player.recorded_axis_values[core_action_index];
+				WriteVarint(core_action_index);
+				WriteVarint(u32(difference) << 1 ^ u32(difference >> 31));
+				player.recorded_axis_values[core_action_index] = player.axis_values[core_action_index];
+			}
+			player.toggled_buttons.clear();
+			player.moved_axes.clear();
+		}
+	}
+
+
+	Mode GetMode()
+	{
+		return mode.load(std::memory_order_relaxed);
+	}
+
+
+	Status GetStatus()
+	{
+		std::lock_guard lock{ mutex };
+		return {
+			.mode = mode,
+			.frame = frame,
+			.num_frames = mode == Mode::Recording ? frame : num_frames
+		};
+	}
+
+
+	bool IsPressed(const PlayerInput& player, uint core_action_index)
+	{
+		return player.pressed_buttons[core_action_index / 64] >> (core_action_index % 64) & 1;
+	}
+
+
+	std::span<const FrameInput> PlayFrame()
+	{
+		/* Called on the emulation thread at the end of every frame. Returns the input that the core got at
+		   this point during the recording, which stays valid until the next call. */
+		bool is_corrupt = false;
+		u64 corrupt_frame = 0;
+		frame_inputs.clear();
+		{
+			std::lock_guard lock{ mutex };
+			if (mode != Mode::Playing) {
+				return {};
+			}
+			if (frame == num_frames) {
+				mode = Mode::Off;
+				return {};
+			}
+			if (num_frames_without_input > 0) {
+				--num_frames_without_input;
+			}
+			else if (!DecodeFrame()) {
+				mode = Mode::Off;
+				is_corrupt = true;
+				corrupt_frame = frame;
+			}
+			++frame;
+		}
+		if (is_corrupt) {
+			UserMessage::Post(std::format("Movie playback was stopped at frame {}; the movie file is corrupt.", corrupt_frame),
+				UserMessage::Type::Warning);
+			return {};
+		}
+		return frame_inputs;
+	}
+
+
+	u64 ReadVarint()
+	{
+		u64 value = 0;
+		for (uint shift = 0; shift < 64 && frame_data_position < frame_data.size(); shift += 7) {
+			u8 byte = frame_data[frame_data_position++];
+			value |= u64(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) {
+				return value;
+			}
+		}
+		frame_data_error = true;
+		return 0;
+	}
+
+
+	bool RecordAxis(uint player_index, uint core_action_index, s16 axis_value)
+	{
+		/* Called on the emulation thread for every axis event about to be delivered to the core. Returns
+		   false if the axis already has this value, in which case the event need not be delivered. */
+		std::lock_guard lock{ mutex };
+		if (mode != Mode::Recording || player_index >= num_players || core_action_index >= num_core_inputs) {
+			return true;
+		}
+		PlayerInput& player = players[player_index];
+		if (player.axis_values[core_action_index] == axis_value) {
+			return false;
+		}
+		player.axis_values[core_action_index] = axis_value;
+		if (std::ranges::find(player.moved_axes, core_action_index) == player.moved_axes.end()) {
+			player.moved_axes.push_back(u16(core_action_index));
+		}
+		return true;
+	}
+
+
+	bool RecordButton(uint player_index, uint core_action_index, bool pressed)
+	{
+		/* Called on the emulation thread for every button event about to be delivered to the core. Returns
+		   false if the button is already in this state, e.g. for repeated key presses, in which case the
+		   event must not be delivered, since it is not recorded. */
+		std::lock_guard lock{ mutex };
+		if (mode != Mode::Recording || player_index >= num_players || core_action_index >= num_core_inputs) {
+			return true;
+		}
+		PlayerInput& player = players[player_index];
+		if (IsPressed(player, core_action_index) == pressed) {
+			return false;
+		}
+		TogglePressed(player, core_action_index);
+		player.toggled_buttons.push_back(u16(core_action_index));
+		return true;
+	}
+
+
+	void ResetPlayers()
+	{
+		players.resize(num_players);
+		for (PlayerInput& player : players) {
+			player.pressed_buttons.assign((num_core_inputs + 63) / 64, 0);
+			player.axis_values.assign(num_core_inputs, 0);
+			player.recorded_axis_values.assign(num_core_inputs, 0);
+			player.toggled_buttons.clear();
+			player.moved_axes.clear();
+		}
+	}
+
+
+	bool StartPlayback(const std::filesystem::path& path)
+	{
+		/* The movie starts at the next opportunity of the emulation thread; see 'Begin'. */
+		SerializationStream stream{ SerializationMode::Read, path };
+		stream.StreamHeader(movie_kind, movie_version);
+		u32 movie_num_players = 0;
+		u32 movie_num_core_inputs = 0;
+		u64 movie_num_frames = 0;
+		std::vector<u8> movie_initial_state;
+		std::vector<u8> movie_frame_data;
+		stream.Stream(movie_num_players);
+		stream.Stream(movie_num_core_inputs);
+		stream.Stream(movie_num_frames);
+		stream.Stream(movie_initial_state);
+		stream.Stream(movie_frame_data);
+		if (stream.HasError()) {
+			UserMessage::Show(std::format("Could not load the movie at {}.", path.string()), UserMessage::Type::Warning);
+			return false;
+		}
+		if (movie_num_players > max_players || movie_num_core_inputs != Input::GetCoreActionNames().size()) {
+			UserMessage::Show(std::format("The movie at {} was recorded with another core.", path.string()),
+				UserMessage::Type::Warning);
+			return false;
+		}
+
+		Stop();
+		std::lock_guard lock{ mutex };
+		Movie::path = path;
+		num_players = movie_num_players;
+		num_core_inputs = movie_num_core_inputs;
+		num_frames = movie_num_frames;
+		initial_state = std::move(movie_initial_state);
+		frame_data = std::move(movie_frame_data);
+		pending_mode = Mode::Playing;
+		start_is_pending.store(true, std::memory_order_release);
+		return true;
+	}
+
+
+	void StartRecording(const std::filesystem::path& path)
+	{
+		/* The recording starts at the next opportunity of the emulation thread; see 'Begin'. It is written
+		   to 'path' once stopped. */
+		static_assert(Input::max_players <= max_players);
+		Stop();
+		std::lock_guard lock{ mutex };
+		Movie::path = path;
+		num_players = Input::max_players;
+		num_core_inputs = u32(Input::GetCoreActionNames().size());
+		pending_mode = Mode::Recording;
+		start_is_pending.store(true, std::memory_order_release);
+	}
+
+
+	void Stop()
+	{
+		/* Stops playback, or stops recording and writes the movie to file. */
+		std::string unsaved_movie_path;
+		{
+			std::lock_guard lock{ mutex };
+			start_is_pending = false;
+			if (mode == Mode::Recording && !WriteRecording()) {
+				unsaved_movie_path = path.string();
+			}
+			mode = Mode::Off;
+		}
+		if (!unsaved_movie_path.empty()) {
+			UserMessage::Post(std::format("Could not save the movie to {}.", unsaved_movie_path), UserMessage::Type::Warning);
+		}
+	}
+
+
+	void TogglePressed(PlayerInput& player, uint core_action_index)
+	{
+		player.pressed_buttons[core_action_index / 64] ^= u64(1) << (core_action_index % 64);
+	}
+
+
+	bool WriteRecording()
+	{
+		num_frames = frame;
+		std::error_code error_code;
+		std::filesystem::create_directories(path.parent_path(), error_code);
+		SerializationStream stream{ SerializationMode::Write, path };
+		stream.StreamHeader(movie_kind, movie_version);
+		stream.Stream(num_players);
+		stream.Stream(num_core_inputs);
+		stream.Stream(num_frames);
+		stream.Stream(initial_state);
+		stream.Stream(frame_data);
+		return stream.Flush();
+	}
+
+
+	void WriteVarint(u64 value)
+	{
+		while (value >= 0x80) {
+			frame_data.push_back(u8(value | 0x80));
+			value >>= 7;
+		}
+		frame_data.push_back(u8(value));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+export module Movie;
+
+import Core;
+import Types;
+
+import <algorithm>;
+import <atomic>;
+import <filesystem>;
+import <mutex>;
+import <span>;
+import <string_view>;
+import <vector>;
+
+namespace Movie
+{
+	export
+	{
+		enum class Mode {
+			Off, Playing, Recording
+		};
+
+		enum class InputType : u8 {
+			AxisMotion, ButtonPress, ButtonRelease
+		};
+
+		/* An input as it reached the core during the recording. */
+		struct FrameInput
+		{
+			InputType type;
+			s16 axis_value;
+			u16 core_action_index;
+			u8 player_index;
+		};
+
+		struct Status
+		{
+			Mode mode;
+			u64 frame;
+			u64 num_frames; /* of the movie being played; equal to 'frame' while recording */
+		};
+
+		void Begin(Core& core, Core* secondary_core);
+		void EndRecordedFrame();
+		Mode GetMode();
+		Status GetStatus();
+		std::span<const FrameInput> PlayFrame();
+		bool RecordAxis(uint player_index, uint core_action_index, s16 axis_value);
+		bool RecordButton(uint player_index, uint core_action_index, bool pressed);
+		bool StartPlayback(const std::filesystem::path& path);
+		void StartRecording(const std::filesystem::path& path);
+		void Stop();
+	}
+
+	/* The state of one player's input, as the core last saw it. */
+	struct PlayerInput
+	{
+		std::vector<u64> pressed_buttons; /* bitmask, one bit per core action */
+		std::vector<s16> axis_values; /* one per core action */
+		/* Only used while recording; what has changed since the last recorded frame, in order. */
+		std::vector<u16> toggled_buttons;
+		std::vector<u16> moved_axes;
+		std::vector<s16> recorded_axis_values;
+	};
+
+	bool DecodeFrame();
+	bool IsPressed(const PlayerInput& player, uint core_action_index);
+	u64 ReadVarint();
+	void ResetPlayers();
+	void TogglePressed(PlayerInput& player, uint core_action_index);
+	bool WriteRecording();
+	void WriteVarint(u64 value);
+
+	/* Movie files hold the core state that the movie starts from (empty if the core has no in-memory
+	   states, in which case the movie starts from a reset), followed by the input of every frame:
+	   - frames without any input are not stored, but counted; every stored frame starts with a varint
+	     count of the frames without input before it.
+	   - a byte with one bit per player whose input changed during the frame.
+	   - for each such player, the delta of its button bitmask: a varint count of toggled buttons, and the
+	     varint index of each, in the order they were toggled.
+	   - then a varint count of moved axes, and for each, its varint index and the zigzag-encoded varint
+	     difference from the value last stored for it.
+	   Input is recorded as it reaches the core at the end of each frame, after it has been matched to
+	   core actions, so that playback needs no bindings and does not depend on the host devices. */
+	constexpr std::string_view movie_kind = "MOVI";
+	constexpr u32 movie_version = 1;
+	constexpr uint max_players = 8; /* one bit each in the change byte */
+
+	/* 'mode' is read on the emulation thread at the end of every frame, without locking, so that there is
+	   no cost at all to input when no movie is active. Everything else is protected by 'mutex'. */
+	std::atomic<Mode> mode = Mode::Off;
+	std::atomic<bool> start_is_pending;
+
+	std::mutex mutex;
+	Mode pending_mode;
+	std::filesystem::path path;
+
+	u32 num_players;
+	u32 num_core_inputs;
+	u64 frame;
+	u64 num_frames;
+	u64 num_frames_without_input;
+	std::vector<u8> initial_state;
+	std::vector<u8> frame_data;
+	size_t frame_data_position;
+	bool frame_data_error;
+
+	std::vector<PlayerInput> players;
+	std::vector<FrameInput> frame_inputs;
+}
\ No newline at end of file
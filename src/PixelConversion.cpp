@@ -0,0 +1,243 @@
+module;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HUMLA_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define HUMLA_X86 0
+#endif
+
+/* MSVC allows the intrinsics of any instruction set in any function, whereas GCC and Clang must be told
+   which functions may use them. These functions are only called once the cpu is known to support them. */
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSSE3
+#define TARGET_AVX2
+#endif
+
+module PixelConversion;
+
+namespace PixelConversion
+{
+#if HUMLA_X86
+	TARGET_AVX2 void ExpandRow1LsbAvx2(const u8* source, u32* target, uint width, u32 color_0, u32 color_1);
+	void ExpandRow1LsbSse2(const u8* source, u32* target, uint width, u32 color_0, u32 color_1);
+	template<bool swap_red_blue> TARGET_AVX2 void ExpandRow24Avx2(const u8* source, u32* target, uint width);
+	template<bool swap_red_blue> TARGET_SSSE3 void ExpandRow24Ssse3(const u8* source, u32* target, uint width);
+#endif
+
+
+	bool CanConvert(uint source_format)
+	{
+		return source_format == SDL_PIXELFORMAT_BGR24 || source_format == SDL_PIXELFORMAT_RGB24
+			|| source_format == SDL_PIXELFORMAT_INDEX1LSB;
+	}
+
+
+	void Convert(uint source_format, uint target_format, const u8* source, uint source_pitch,
+		u8* target, uint target_pitch, uint width, uint height)
+	{
+		/* 'target_format' is ARGB8888 or ABGR8888. Every row is converted straight from the source into the
+		   target, e.g. locked texture memory, so that a frame takes a single pass over each. */
+		bool target_is_abgr = target_format == SDL_PIXELFORMAT_ABGR8888;
+		if (source_format == SDL_PIXELFORMAT_INDEX1LSB) {
+			ExpandRow1Kernel kernel = [] {
+				switch (instruction_set) {
+#if HUMLA_X86
+				case InstructionSet::Avx2: return ExpandRow1LsbAvx2;
+				case InstructionSet::Ssse3: return ExpandRow1LsbSse2;
+#endif
+				default: return ExpandRow1LsbScalar;
+				}
+			}();
+			auto to_target_color = [target_is_abgr](u32 rgb) {
+				return opaque_alpha | (target_is_abgr ? (rgb & 0xFF) << 16 | (rgb & 0xFF00) | (rgb >> 16 & 0xFF) : rgb);
+			};
+			u32 color_0 = to_target_color(index1_palette[0]);
+			u32 color_1 = to_target_color(index1_palette[1]);
+			for (uint y = 0; y < height; ++y) {
+				kernel(source + size_t(y) * source_pitch, reinterpret_cast<u32*>(target + size_t(y) * target_pitch),
+					width, color_0, color_1);
+			}
+		}
+		else {
+			/* In memory, RGB24 and ABGR8888 both start with red, and BGR24 and ARGB8888 with blue. */
+			bool swap_red_blue = (source_format == SDL_PIXELFORMAT_RGB24) != target_is_abgr;
+			ExpandRow24Kernel kernel = GetExpandRow24Kernel(swap_red_blue);
+			for (uint y = 0; y < height; ++y) {
+				kernel(source + size_t(y) * source_pitch, reinterpret_cast<u32*>(target + size_t(y) * target_pitch), width);
+			}
+		}
+	}
+
+
+	InstructionSet DetectInstructionSet()
+	{
+#if HUMLA_X86
+#ifdef _MSC_VER
+		std::array<int, 4> info;
+		__cpuid(info.data(), 0);
+		int max_leaf = info[0];
+		__cpuid(info.data(), 1);
+		bool has_ssse3 = info[2] & 1 << 9;
+		/* AVX also needs the os to save the upper halves of the ymm registers on context switches. */
+		bool has_avx = (info[2] & 1 << 27) && (info[2] & 1 << 28) && (_xgetbv(0) & 6) == 6;
+		bool has_avx2 = false;
+		if (has_avx && max_leaf >= 7) {
+			__cpuidex(info.data(), 7, 0);
+			has_avx2 = info[1] & 1 << 5;
+		}
+#else
+		__builtin_cpu_init();
+		bool has_ssse3 = __builtin_cpu_supports("ssse3");
+		bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+		if (has_avx2) {
+			return InstructionSet::Avx2;
+		}
+		if (has_ssse3) {
+			return InstructionSet::Ssse3;
+		}
+#endif
+		return InstructionSet::Scalar;
+	}
+
+
+	void ExpandRow1LsbScalar(const u8* source, u32* target, uint width, u32 color_0, u32 color_1)
+	{
+		for (uint x = 0; x < width; ++x) {
+			target[x] = source[x / 8] >> (x % 8) & 1 ? color_1 : color_0;
+		}
+	}
+
+
+	template<bool swap_red_blue>
+	void ExpandRow24Scalar(const u8* source, u32* target, uint width)
+	{
+		for (uint x = 0; x < width; ++x, source += 3) {
+			u32 first = source[0], second = source[1], third = source[2];
+			target[x] = swap_red_blue
+				? opaque_alpha | first << 16 | second << 8 | third
+				: opaque_alpha | third << 16 | second << 8 | first;
+		}
+	}
+
+
+	ExpandRow24Kernel GetExpandRow24Kernel(bool swap_red_blue)
+	{
+		switch (instruction_set) {
+#if HUMLA_X86
+		case InstructionSet::Avx2:
+			return swap_red_blue ? ExpandRow24Avx2<true> : ExpandRow24Avx2<false>;
+
+		case InstructionSet::Ssse3:
+			return swap_red_blue ? ExpandRow24Ssse3<true> : ExpandRow24Ssse3<false>;
+#endif
+
+		default:
+			return swap_red_blue ? ExpandRow24Scalar<true> : ExpandRow24Scalar<false>;
+		}
+	}
+
+
+	void Initialize()
+	{
+		instruction_set = DetectInstructionSet();
+	}
+
+#if HUMLA_X86
+	TARGET_AVX2 void ExpandRow1LsbAvx2(const u8* source, u32* target, uint width, u32 color_0, u32 color_1)
+	{
+		/* Each source byte becomes eight pixels: the byte is broadcast to every lane, where the bit of
+		   that lane's pixel is isolated and compared, which yields a mask that selects between the colors. */
+		const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		const __m256i colors_0 = _mm256_set1_epi32(int(color_0));
+		const __m256i colors_1 = _mm256_set1_epi32(int(color_1));
+		uint x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m256i byte = _mm256_set1_epi32(source[x / 8]);
+			__m256i is_set = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x), _mm256_blendv_epi8(colors_0, colors_1, is_set));
+		}
+		ExpandRow1LsbScalar(source + x / 8, target + x, width - x, color_0, color_1);
+	}
+
+
+	void ExpandRow1LsbSse2(const u8* source, u32* target, uint width, u32 color_0, u32 color_1)
+	{
+		/* As 'ExpandRow1LsbAvx2', in two halves of four pixels. */
+		const __m128i low_bits = _mm_setr_epi32(1, 2, 4, 8);
+		const __m128i high_bits = _mm_setr_epi32(16, 32, 64, 128);
+		const __m128i colors_0 = _mm_set1_epi32(int(color_0));
+		const __m128i colors_1 = _mm_set1_epi32(int(color_1));
+		uint x = 0;
+		for (; x + 8 <= width; x += 8) {
+			__m128i byte = _mm_set1_epi32(source[x / 8]);
+			__m128i low_is_set = _mm_cmpeq_epi32(_mm_and_si128(byte, low_bits), low_bits);
+			__m128i high_is_set = _mm_cmpeq_epi32(_mm_and_si128(byte, high_bits), high_bits);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + x),
+				_mm_or_si128(_mm_and_si128(low_is_set, colors_1), _mm_andnot_si128(low_is_set, colors_0)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + x + 4),
+				_mm_or_si128(_mm_and_si128(high_is_set, colors_1), _mm_andnot_si128(high_is_set, colors_0)));
+		}
+		ExpandRow1LsbScalar(source + x / 8, target + x, width - x, color_0, color_1);
+	}
+
+
+	template<bool swap_red_blue>
+	TARGET_AVX2 void ExpandRow24Avx2(const u8* source, u32* target, uint width)
+	{
+		/* 16 pixels per iteration. Shuffles do not cross the 128-bit lanes, so each lane is loaded with the
+		   12 bytes of four pixels. The last load reads four bytes past the 48 that are used, which the loop
+		   condition keeps within the row. */
+		const __m256i shuffle = swap_red_blue
+			? _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+				2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+			: _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+				0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m256i alpha = _mm256_set1_epi32(int(opaque_alpha));
+		uint x = 0;
+		for (; x + 18 <= width; x += 16, source += 48) {
+			for (uint half = 0; half < 2; ++half) {
+				const u8* pixels = source + 24 * half;
+				__m256i source_pixels = _mm256_inserti128_si256(
+					_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels))),
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + 12)), 1);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(target + x + 8 * half),
+					_mm256_or_si256(_mm256_shuffle_epi8(source_pixels, shuffle), alpha));
+			}
+		}
+		ExpandRow24Scalar<swap_red_blue>(source, target + x, width - x);
+	}
+
+
+	template<bool swap_red_blue>
+	TARGET_SSSE3 void ExpandRow24Ssse3(const u8* source, u32* target, uint width)
+	{
+		/* 16 pixels per iteration. Three loads hold exactly the 48 bytes of the pixels, which are realigned
+		   into four groups of four pixels, each expanded by a single shuffle. */
+		const __m128i shuffle = swap_red_blue
+			? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+			: _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i alpha = _mm_set1_epi32(int(opaque_alpha));
+		uint x = 0;
+		for (; x + 16 <= width; x += 16, source += 48) {
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16));
+			__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 32));
+			__m128i source_pixels[4] = {
+				a, _mm_alignr_epi8(b, a, 12), _mm_alignr_epi8(c, b, 8), _mm_srli_si128(c, 4)
+			};
+			for (uint quarter = 0; quarter < 4; ++quarter) {
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target + x + 4 * quarter),
+					_mm_or_si128(_mm_shuffle_epi8(source_pixels[quarter], shuffle), alpha));
+			}
+		}
+		ExpandRow24Scalar<swap_red_blue>(source, target + x, width - x);
+	}
+#endif
+}
\ No newline at end of file
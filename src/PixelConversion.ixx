@@ -0,0 +1,45 @@
+export module PixelConversion;
+
+import Types;
+
+import <SDL.h>;
+
+import <array>;
+import <bit>;
+import <cstring>;
+
+namespace PixelConversion
+{
+	export
+	{
+		bool CanConvert(uint source_format);
+		void Convert(uint source_format, uint target_format, const u8* source, uint source_pitch,
+			u8* target, uint target_pitch, uint width, uint height);
+		void Initialize();
+	}
+
+	/* Kernels expand one row of 'width' pixels into 32-bit pixels, with the alpha channel set to opaque.
+	   The target is always ARGB8888 or ABGR8888, whichever the renderer prefers; from the point of view
+	   of a kernel, the only difference between them is whether the red and blue channels are swapped. */
+	using ExpandRow24Kernel = void(*)(const u8* source, u32* target, uint width);
+	using ExpandRow1Kernel = void(*)(const u8* source, u32* target, uint width, u32 color_0, u32 color_1);
+
+	enum class InstructionSet {
+		Scalar, Ssse3, Avx2
+	};
+
+	InstructionSet DetectInstructionSet();
+	ExpandRow24Kernel GetExpandRow24Kernel(bool swap_red_blue);
+
+	void ExpandRow1LsbScalar(const u8* source, u32* target, uint width, u32 color_0, u32 color_1);
+	template<bool swap_red_blue> void ExpandRow24Scalar(const u8* source, u32* target, uint width);
+	/* The SIMD kernels are declared and defined in the implementation unit, along with the instruction set
+	   specific headers and attributes that they need. */
+
+	/* INDEX1LSB framebuffers come without a palette; bits that are clear are black, and bits that are set
+	   are white. Colors are given as 0xRRGGBB. */
+	constexpr std::array<u32, 2> index1_palette = { 0x000000, 0xFFFFFF };
+	constexpr u32 opaque_alpha = 0xFF00'0000;
+
+	InstructionSet instruction_set = InstructionSet::Scalar; /* the best one that the cpu supports; set by 'Initialize' */
+}
\ No newline at end of file
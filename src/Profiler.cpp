@@ -0,0 +1,110 @@
+module Profiler;
+
+namespace Profiler
+{
+	size_t CopySamples(Stage stage, std::span<f32, num_samples_per_stage> samples)
+	{
+		/* Copies the samples oldest first. Returns the number of valid samples, which are at the end. */
+		const SampleRing& ring = sample_rings[size_t(stage)];
+		size_t num_recorded = ring.num_recorded.load(std::memory_order_relaxed);
+		size_t num_valid = std::min(num_recorded, num_samples_per_stage);
+		std::fill(samples.begin(), samples.end() - num_valid, 0.0f);
+		for (size_t i = 0; i < num_valid; ++i) {
+			size_t index = (num_recorded - num_valid + i) % num_samples_per_stage;
+			samples[num_samples_per_stage - num_valid + i] = ring.samples_ms[index].load(std::memory_order_relaxed);
+		}
+		return num_valid;
+	}
+
+
+	std::string_view GetStageName(Stage stage)
+	{
+		switch (stage) {
+		case Stage::CoreRun: return "Core run";
+		case Stage::FrameHandoff: return "Frame handoff";
+		case Stage::InputLatch: return "Input latch";
+		case Stage::RunAhead: return "Run-ahead";
+		case Stage::RewindCapture: return "Rewind capture";
+		case Stage::VideoFilter: return "Video filter";
+		case Stage::PixelUpload: return "Pixel upload";
+		case Stage::ImGuiBuild: return "ImGui build";
+		case Stage::Render: return "Render";
+		case Stage::Present: return "Present";
+		case Stage::GuiFrame: return "Gui frame";
+		default: return "";
+		}
+	}
+
+
+	Clock::time_point GetProcessStartTime()
+	{
+		return process_start_time;
+	}
+
+
+	std::vector<StartupPhase> GetStartupPhases()
+	{
+		/* In order of their start. */
+		std::vector<StartupPhase> phases;
+		{
+			std::lock_guard lock{ startup_phase_mutex };
+			phases = startup_phases;
+		}
+		std::ranges::stable_sort(phases, {}, &StartupPhase::start_ms);
+		return phases;
+	}
+
+
+	Stats GetStats(Stage stage)
+	{
+		std::array<f32, num_samples_per_stage> samples;
+		size_t num_valid = CopySamples(stage, samples);
+		if (num_valid == 0) {
+			return {};
+		}
+		std::span<f32> valid_samples{ samples.end() - num_valid, samples.end() };
+		std::ranges::sort(valid_samples);
+		size_t p99_index = std::min(num_valid - 1, num_valid * 99 / 100);
+		return {
+			.min_ms = valid_samples.front(),
+			.avg_ms = std::accumulate(valid_samples.begin(), valid_samples.end(), 0.0f) / num_valid,
+			.p99_ms = valid_samples[p99_index],
+			.max_ms = valid_samples.back(),
+			.num_samples = num_valid
+		};
+	}
+
+
+	Clock::time_point Now()
+	{
+		return Clock::now();
+	}
+
+
+	Clock::time_point Record(Stage stage, Clock::time_point start)
+	{
+		/* Returns the end time, so that consecutive stages can be recorded with a single clock read each. */
+		Clock::time_point now = Clock::now();
+		SampleRing& ring = sample_rings[size_t(stage)];
+		size_t index = ring.num_recorded.load(std::memory_order_relaxed);
+		ring.samples_ms[index % num_samples_per_stage].store(
+			std::chrono::duration<f32, std::milli>(now - start).count(), std::memory_order_relaxed);
+		ring.num_recorded.store(index + 1, std::memory_order_relaxed);
+		return now;
+	}
+
+
+	Clock::time_point RecordStartupPhase(std::string_view name, Clock::time_point start)
+	{
+		/* Like 'Record', returns the end time. Phases are recorded a handful of times in all, so a lock will do. */
+		Clock::time_point now = Clock::now();
+		StartupPhase phase = {
+			.name = name,
+			.start_ms = std::chrono::duration<f32, std::milli>(start - process_start_time).count(),
+			.duration_ms = std::chrono::duration<f32, std::milli>(now - start).count()
+		};
+		std::lock_guard lock{ startup_phase_mutex };
+		startup_phases.push_back(phase);
+		return now;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,78 @@
+export module Profiler;
+
+import Types;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <chrono>;
+import <mutex>;
+import <numeric>;
+import <span>;
+import <string_view>;
+import <vector>;
+
+namespace Profiler
+{
+	export
+	{
+		using Clock = std::chrono::steady_clock;
+
+		enum class Stage {
+			CoreRun,       /* emulation thread: from the end of the previous frame to the core publishing the next one */
+			FrameHandoff,  /* emulation thread: publishing a frame to the triple buffer */
+			InputLatch,    /* emulation thread: from an input event being queued to it being handed to the core */
+			RunAhead,      /* emulation thread: snapshotting the state, running ahead and restoring the state */
+			RewindCapture, /* emulation thread: snapshotting the state and storing it in the rewind buffer */
+			VideoFilter,   /* gui thread: running a new frame through the video filter chain */
+			PixelUpload,   /* gui thread: uploading a new frame to the game texture */
+			ImGuiBuild,    /* gui thread: building the gui for the current iteration */
+			Render,        /* gui thread: issuing render commands for the game and the gui */
+			Present,       /* gui thread: presenting */
+			GuiFrame,      /* gui thread: a complete iteration of the gui loop */
+			Count
+		};
+
+		constexpr size_t num_samples_per_stage = 256;
+
+		struct Stats
+		{
+			f32 min_ms, avg_ms, p99_ms, max_ms;
+			size_t num_samples;
+		};
+
+		/* A step of bringing the application up, recorded once, possibly on a worker thread. */
+		struct StartupPhase
+		{
+			std::string_view name; /* must outlive the profiler, e.g. a string literal */
+			f32 start_ms; /* since the process start */
+			f32 duration_ms;
+		};
+
+		size_t CopySamples(Stage stage, std::span<f32, num_samples_per_stage> samples);
+		std::string_view GetStageName(Stage stage);
+		Clock::time_point GetProcessStartTime();
+		std::vector<StartupPhase> GetStartupPhases();
+		Stats GetStats(Stage stage);
+		Clock::time_point Now();
+		Clock::time_point Record(Stage stage, Clock::time_point start);
+		Clock::time_point RecordStartupPhase(std::string_view name, Clock::time_point start);
+	}
+
+	/* Each stage is only ever recorded on one thread and can be read from any thread. The samples are
+	   relaxed atomics, so recording amounts to reading the clock and two uncontended stores. A reader may
+	   observe a sample that is newer than the write index suggests, which is harmless for display. */
+	struct SampleRing
+	{
+		std::array<std::atomic<f32>, num_samples_per_stage> samples_ms;
+		std::atomic<size_t> num_recorded;
+	};
+
+	std::array<SampleRing, size_t(Stage::Count)> sample_rings;
+
+	/* Initialized before 'main' runs, which is as close to the process start as can be had portably. */
+	const Clock::time_point process_start_time = Clock::now();
+
+	std::mutex startup_phase_mutex;
+	std::vector<StartupPhase> startup_phases;
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+module;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HUMLA_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define HUMLA_X86 0
+#endif
+
+/* See PixelConversion.cpp. The AVX kernel is only selected once the cpu is known to support it. */
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX __attribute__((target("avx")))
+#else
+#define TARGET_AVX
+#endif
+
+module Resampler;
+
+f64 BesselI0(f64 x);
+void ConvolveScalar(const f32* const* channels, uint num_channels, const f32* coefficients,
+	const f32* deltas, uint num_taps, f32 phase_fraction, f32* output);
+#if HUMLA_X86
+TARGET_AVX void ConvolveAvx(const f32* const* channels, uint num_channels, const f32* coefficients,
+	const f32* deltas, uint num_taps, f32 phase_fraction, f32* output);
+void ConvolveSse(const f32* const* channels, uint num_channels, const f32* coefficients,
+	const f32* deltas, uint num_taps, f32 phase_fraction, f32* output);
+bool CpuSupportsAvx();
+#endif
+
+
+void Resampler::BuildFilter()
+{
+	const Preset& preset = presets[size_t(quality)];
+	/* The passband relative to the input Nyquist frequency; below 1 when downsampling, in which case the
+	   filter needs to be proportionally longer for the same steepness, but also proportionally fewer
+	   phases, since it varies proportionally slower between two input frames. */
+	f64 bandwidth = std::min(1.0, output_sample_rate / input_sample_rate);
+	num_taps = (uint(std::ceil(preset.num_taps / bandwidth)) + 7) & ~7u;
+	num_phases = std::max(uint(preset.num_phases * bandwidth), 16u);
+	f64 cutoff = preset.cutoff * bandwidth;
+	f64 half_width = num_taps / 2.0;
+	f64 window_scale = 1.0 / BesselI0(preset.kaiser_beta);
+
+	/* One more row than there are phases, as the last phase is interpolated towards it. */
+	std::vector<f64> rows(size_t(num_phases + 1) * num_taps);
+	for (uint phase_index = 0; phase_index <= num_phases; ++phase_index) {
+		f64* row = rows.data() + size_t(phase_index) * num_taps;
+		f64 phase = f64(phase_index) / num_phases;
+		f64 row_sum = 0.0;
+		for (uint tap = 0; tap < num_taps; ++tap) {
+			/* Distance from the output frame, in input frames. The output frame lies between the two
+			   taps in the middle. */
+			f64 distance = f64(tap) - (half_width - 1.0) - phase;
+			f64 x = distance / half_width;
+			f64 window = std::abs(x) < 1.0 ? BesselI0(preset.kaiser_beta * std::sqrt(1.0 - x * x)) * window_scale : 0.0;
+			f64 arg = std::numbers::pi * cutoff * distance;
+			f64 sinc = arg == 0.0 ? 1.0 : std::sin(arg) / arg;
+			row[tap] = sinc * window;
+			row_sum += row[tap];
+		}
+		/* Unity gain at DC for every phase, or a constant signal would come out with a ripple. */
+		for (uint tap = 0; tap < num_taps; ++tap) {
+			row[tap] /= row_sum;
+		}
+	}
+
+	coefficients.resize(size_t(num_phases) * num_taps);
+	deltas.resize(size_t(num_phases) * num_taps);
+	for (size_t i = 0; i < coefficients.size(); ++i) {
+		coefficients[i] = f32(rows[i]);
+		deltas[i] = f32(rows[i + num_taps] - rows[i]);
+	}
+}
+
+
+void Resampler::Configure(uint num_channels, f64 input_sample_rate, f64 output_sample_rate, Quality quality)
+{
+	/* Does nothing if nothing has changed, so that it can be called before every 'Process'. */
+	num_channels = std::min(num_channels, max_channels);
+	if (num_channels == this->num_channels && input_sample_rate == this->input_sample_rate
+		&& output_sample_rate == this->output_sample_rate && quality == this->quality) {
+		return;
+	}
+	this->num_channels = num_channels;
+	this->input_sample_rate = input_sample_rate;
+	this->output_sample_rate = output_sample_rate;
+	this->quality = quality;
+	nominal_step = input_sample_rate / output_sample_rate;
+	step = nominal_step;
+	kernel = SelectKernel();
+	BuildFilter();
+	history_capacity = num_taps + history_block_size;
+	for (uint channel = 0; channel < max_channels; ++channel) {
+		history[channel].assign(channel < num_channels ? history_capacity : 0, 0.0f);
+	}
+	Reset();
+}
+
+
+void Resampler::DiscardConsumedFrames()
+{
+	/* When downsampling, the next output frame may lie beyond what has been received so far, in which
+	   case everything is discarded. */
+	size_t num_discarded = std::min(position, num_history_frames);
+	size_t num_kept = num_history_frames - num_discarded + (num_pending_samples > 0);
+	for (uint channel = 0; channel < num_channels; ++channel) {
+		auto first = history[channel].begin() + num_discarded;
+		std::copy(first, first + num_kept, history[channel].begin());
+	}
+	position -= num_discarded;
+	num_history_frames -= num_discarded;
+}
+
+
+std::string_view Resampler::GetQualityName(Quality quality)
+{
+	switch (quality) {
+	case Quality::Low: return "Low";
+	case Quality::Medium: return "Medium";
+	case Quality::High: return "High";
+	default: return "";
+	}
+}
+
+
+Resampler::Result Resampler::Process(std::span<const f32> input, std::span<f32> output)
+{
+	/* Takes in input and produces output until either all input has been taken in or the output is full.
+	   Input may end in the middle of a frame. An output frame is only produced once all input frames
+	   under the filter have been received, so half the filter's worth of input is always held back. */
+	Result result{};
+	if (num_channels == 0) {
+		return result;
+	}
+	std::array<const f32*, max_channels> channels;
+	while (true) {
+		while (position + num_taps <= num_history_frames && result.num_output_samples + num_channels <= output.size()) {
+			f64 phase = fraction * num_phases;
+			uint phase_index = std::min(uint(phase), num_phases - 1);
+			for (uint channel = 0; channel < num_channels; ++channel) {
+				channels[channel] = history[channel].data() + position;
+			}
+			kernel(channels.data(), num_channels, coefficients.data() + size_t(phase_index) * num_taps,
+				deltas.data() + size_t(phase_index) * num_taps, num_taps, f32(phase - phase_index),
+				output.data() + result.num_output_samples);
+			result.num_output_samples += num_channels;
+			fraction += step;
+			f64 num_whole_frames = std::floor(fraction);
+			position += size_t(num_whole_frames);
+			fraction -= num_whole_frames;
+		}
+		if (result.num_output_samples + num_channels > output.size() || result.num_input_samples == input.size()) {
+			return result;
+		}
+		if (num_history_frames == history_capacity) {
+			DiscardConsumedFrames();
+		}
+		while (result.num_input_samples < input.size() && num_history_frames < history_capacity) {
+			history[num_pending_samples][num_history_frames] = input[result.num_input_samples++];
+			if (++num_pending_samples == num_channels) {
+				num_pending_samples = 0;
+				++num_history_frames;
+			}
+		}
+	}
+}
+
+
+void Resampler::Reset()
+{
+	if (num_channels == 0) {
+		return; /* not configured yet */
+	}
+	/* The filter starts out over silence, with the first input frame just after its center. */
+	for (uint channel = 0; channel < num_channels; ++channel) {
+		std::ranges::fill(history[channel], 0.0f);
+	}
+	num_history_frames = num_taps / 2 - 1;
+	num_pending_samples = 0;
+	position = 0;
+	fraction = 0.0;
+}
+
+
+Resampler::Kernel Resampler::SelectKernel()
+{
+#if HUMLA_X86
+	/* SSE2 is part of x86-64, and assumed on 32-bit x86 as well. */
+	return CpuSupportsAvx() ? ConvolveAvx : ConvolveSse;
+#else
+	return ConvolveScalar;
+#endif
+}
+
+
+void Resampler::SetRateAdjustment(f64 rate_adjustment)
+{
+	/* Produce 1 + rate_adjustment as many output frames per input frame as the sample rates say. */
+	step = nominal_step / (1.0 + rate_adjustment);
+}
+
+
+f64 BesselI0(f64 x)
+{
+	/* The zeroth order modified Bessel function of the first kind, by its power series, which converges
+	   quickly for the arguments that a Kaiser window takes. */
+	f64 sum = 1.0;
+	f64 term = 1.0;
+	for (int k = 1; term > sum * 1e-12; ++k) {
+		f64 factor = x / (2.0 * k);
+		term *= factor * factor;
+		sum += term;
+	}
+	return sum;
+}
+
+
+void ConvolveScalar(const f32* const* channels, uint num_channels, const f32* coefficients,
+	const f32* deltas, uint num_taps, f32 phase_fraction, f32* output)
+{
+	/* The interpolated filter is never formed; since it is linear in the phase fraction, both rows are
+	   applied separately and the results combined, which reads each frame once for both. */
+	for (uint channel = 0; channel < num_channels; ++channel) {
+		const f32* frames = channels[channel];
+		f32 sum = 0.0f;
+		f32 delta_sum = 0.0f;
+		for (uint tap = 0; tap < num_taps; ++tap) {
+			sum += frames[tap] * coefficients[tap];
+			delta_sum += frames[tap] * deltas[tap];
+		}
+		output[channel] = sum + phase_fraction * delta_sum;
+	}
+}
+
+#if HUMLA_X86
+TARGET_AVX void ConvolveAvx(const f32* const* channels, uint num_channels, const f32* coefficients,
+	const f32* deltas, uint num_taps, f32 phase_fraction, f32* output)
+{
+	/* As 'ConvolveScalar', eight taps at a time; 'num_taps' is a multiple of eight. */
+	const __m256 fractions = _mm256_set1_ps(phase_fraction);
+	for (uint channel = 0; channel < num_channels; ++channel) {
+		const f32* frames = channels[channel];
+		__m256 sum = _mm256_setzero_ps();
+		__m256 delta_sum = _mm256_setzero_ps();
+		for (uint tap = 0; tap < num_taps; tap += 8) {
+			__m256 x = _mm256_loadu_ps(frames + tap);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(x, _mm256_loadu_ps(coefficients + tap)));
+			delta_sum = _mm256_add_ps(delta_sum, _mm256_mul_ps(x, _mm256_loadu_ps(deltas + tap)));
+		}
+		__m256 total = _mm256_add_ps(sum, _mm256_mul_ps(delta_sum, fractions));
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(total), _mm256_extractf128_ps(total, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+		output[channel] = _mm_cvtss_f32(half);
+	}
+}
+
+
+void ConvolveSse(const f32* const* channels, uint num_channels, const f32* coefficients,
+	const f32* deltas, uint num_taps, f32 phase_fraction, f32* output)
+{
+	/* As 'ConvolveScalar', four taps at a time. */
+	const __m128 fractions = _mm_set1_ps(phase_fraction);
+	for (uint channel = 0; channel < num_channels; ++channel) {
+		const f32* frames = channels[channel];
+		__m128 sum = _mm_setzero_ps();
+		__m128 delta_sum = _mm_setzero_ps();
+		for (uint tap = 0; tap < num_taps; tap += 4) {
+			__m128 x = _mm_loadu_ps(frames + tap);
+			sum = _mm_add_ps(sum, _mm_mul_ps(x, _mm_loadu_ps(coefficients + tap)));
+			delta_sum = _mm_add_ps(delta_sum, _mm_mul_ps(x, _mm_loadu_ps(deltas + tap)));
+		}
+		__m128 total = _mm_add_ps(sum, _mm_mul_ps(delta_sum, fractions));
+		total = _mm_add_ps(total, _mm_movehl_ps(total, total));
+		total = _mm_add_ss(total, _mm_shuffle_ps(total, total, 1));
+		output[channel] = _mm_cvtss_f32(total);
+	}
+}
+
+
+bool CpuSupportsAvx()
+{
+#ifdef _MSC_VER
+	std::array<int, 4> info;
+	__cpuid(info.data(), 1);
+	/* AVX also needs the os to save the upper halves of the ymm registers on context switches. */
+	return (info[2] & 1 << 27) && (info[2] & 1 << 28) && (_xgetbv(0) & 6) == 6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx");
+#endif
+}
+#endif
\ No newline at end of file
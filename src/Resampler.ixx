@@ -0,0 +1,92 @@
+export module Resampler;
+
+import Types;
+
+import <algorithm>;
+import <array>;
+import <cmath>;
+import <numbers>;
+import <span>;
+import <string_view>;
+import <vector>;
+
+/* Converts interleaved audio from one sample rate to another with a polyphase windowed-sinc filter, so
+   that a core can produce audio at its native rate, e.g. 32040 Hz, rather than at that of the device.
+   The filter is tabulated at a number of fractional positions ("phases") between two input frames, and
+   the coefficients for the exact position of an output frame are interpolated linearly between the two
+   nearest phases. When the output rate is below the input rate, the cutoff is lowered to the output
+   Nyquist frequency and the filter is widened in proportion, so that nothing aliases. */
+export class Resampler
+{
+public:
+	enum class Quality {
+		Low,    /* 16 taps; about 60 dB of stopband attenuation */
+		Medium, /* 32 taps; about 80 dB */
+		High,   /* 64 taps; about 100 dB */
+		Count
+	};
+
+	struct Result
+	{
+		size_t num_input_samples; /* consumed */
+		size_t num_output_samples; /* written */
+	};
+
+	static constexpr uint max_channels = 8;
+
+	void Configure(uint num_channels, f64 input_sample_rate, f64 output_sample_rate, Quality quality);
+	static std::string_view GetQualityName(Quality quality);
+	Result Process(std::span<const f32> input, std::span<f32> output);
+	void Reset();
+	void SetRateAdjustment(f64 rate_adjustment);
+
+private:
+	/* Computes one output frame from 'num_taps' consecutive frames of each channel; see 'Process'. */
+	using Kernel = void(*)(const f32* const* channels, uint num_channels, const f32* coefficients,
+		const f32* deltas, uint num_taps, f32 phase_fraction, f32* output);
+
+	struct Preset
+	{
+		uint num_taps; /* when not downsampling; always a multiple of 8, the width of the widest kernel */
+		uint num_phases;
+		f64 cutoff; /* relative to the lower of the two Nyquist frequencies */
+		f64 kaiser_beta;
+	};
+
+	static constexpr std::array<Preset, size_t(Quality::Count)> presets = { {
+		{ .num_taps = 16, .num_phases = 64, .cutoff = 0.85, .kaiser_beta = 6.0 },
+		{ .num_taps = 32, .num_phases = 128, .cutoff = 0.90, .kaiser_beta = 8.0 },
+		{ .num_taps = 64, .num_phases = 256, .cutoff = 0.94, .kaiser_beta = 10.0 }
+	} };
+
+	/* Frames of input that are taken in at a time beyond what the filter spans. */
+	static constexpr uint history_block_size = 512;
+
+	void BuildFilter();
+	void DiscardConsumedFrames();
+	static Kernel SelectKernel();
+
+	Kernel kernel = nullptr;
+	Quality quality = Quality::Count;
+	uint num_channels = 0;
+	uint num_phases;
+	uint num_taps;
+	f64 input_sample_rate = 0.0;
+	f64 output_sample_rate = 0.0;
+	f64 nominal_step; /* input frames per output frame, before any rate adjustment */
+	f64 step;
+
+	/* Row 'p' of 'coefficients' holds the filter for an output frame that lies p / num_phases of the way
+	   from one input frame to the next; row 'p' of 'deltas' holds the difference to row p + 1. */
+	std::vector<f32> coefficients;
+	std::vector<f32> deltas;
+
+	/* Input frames, one buffer per channel, so that the kernels can read the taps of a channel as
+	   consecutive values. A frame that has only partly been received is kept at 'num_history_frames'. */
+	std::array<std::vector<f32>, max_channels> history;
+	size_t history_capacity;
+	size_t num_history_frames;
+	uint num_pending_samples; /* of the partly received frame */
+	size_t position; /* the history frame under the first tap for the next output frame */
+	f64 fraction; /* how far the next output frame lies beyond the center of the filter at 'position', in [0, 1) */
+};
\ No newline at end of file
@@ -0,0 +1,242 @@
+module Rewind;
+
+namespace Rewind
+{
+	void ApplyDelta(std::span<const u8> delta, std::span<u8> state)
+	{
+		size_t state_index = 0;
+		size_t delta_index = 0;
+		while (delta_index < delta.size()) {
+			state_index += ReadVarint(delta, delta_index);
+			size_t num_changed = ReadVarint(delta, delta_index);
+			for (size_t i = 0; i < num_changed; ++i) {
+				state[state_index + i] ^= delta[delta_index + i];
+			}
+			state_index += num_changed;
+			delta_index += num_changed;
+		}
+	}
+
+
+	void Capture(Core& core)
+	{
+		/* Called on the emulation thread after every frame. */
+		if (++frames_since_capture < capture_interval.load(std::memory_order_relaxed)) {
+			return;
+		}
+		frames_since_capture = 0;
+
+		Profiler::Clock::time_point capture_start = Profiler::Now();
+		size_t state_size = core.GetStateSize();
+		if (state_size == 0) {
+			return;
+		}
+		if (state_size != latest_state.size()) {
+			/* The first capture, or a different game. Deltas are only made between states of the same size. */
+			Clear();
+			latest_state.resize(state_size);
+			new_state.resize(state_size);
+			/* Every segment of a delta but the first is preceded by at least 'min_unchanged_run' unchanged
+			   bytes, and costs two varints of at most ten bytes each on top of its changed bytes. */
+			encoded_delta.resize(state_size + (state_size / min_unchanged_run + 1) * 20);
+			delta_buffer.resize(default_buffer_size);
+			deltas.resize(max_deltas);
+		}
+
+		if (!core.SaveStateToMemory(has_latest_state ? new_state : latest_state)) {
+			return;
+		}
+		if (has_latest_state) {
+			size_t delta_size = EncodeDelta(latest_state, new_state, encoded_delta);
+			if (!PushDelta({ encoded_delta.data(), delta_size })) {
+				/* The delta does not fit even in an empty buffer; the history starts over from here. */
+				num_deltas = 0;
+				delta_buffer_used = 0;
+			}
+			latest_state.swap(new_state);
+		}
+		has_latest_state = true;
+		latest_state_is_loaded = false;
+
+		f32 capture_time_ms = std::chrono::duration<f32, std::milli>(
+			Profiler::Record(Profiler::Stage::RewindCapture, capture_start) - capture_start).count();
+		f32 smoothed_capture_time_ms = stats_capture_time_ms.load(std::memory_order_relaxed);
+		stats_capture_time_ms.store(smoothed_capture_time_ms + capture_time_smoothing * (capture_time_ms - smoothed_capture_time_ms),
+			std::memory_order_relaxed);
+		stats_num_snapshots.store(num_deltas + 1, std::memory_order_relaxed);
+		stats_memory_used.store(latest_state.size() + delta_buffer_used, std::memory_order_relaxed);
+	}
+
+
+	void Clear()
+	{
+		/* Releases all memory, so that having rewind disabled costs nothing. Emulation thread only. */
+		has_latest_state = false;
+		latest_state_is_loaded = false;
+		frames_since_capture = 0;
+		latest_state = {};
+		new_state = {};
+		encoded_delta = {};
+		delta_buffer = {};
+		deltas = {};
+		oldest_delta_index = num_deltas = delta_buffer_used = 0;
+		stats_num_snapshots.store(0, std::memory_order_relaxed);
+		stats_memory_used.store(0, std::memory_order_relaxed);
+		stats_capture_time_ms.store(0.0f, std::memory_order_relaxed);
+	}
+
+
+	size_t EncodeDelta(std::span<const u8> a, std::span<const u8> b, std::span<u8> delta)
+	{
+		/* Encodes the XOR of 'a' and 'b' as a sequence of segments: a varint count of unchanged bytes to
+		   skip, a varint count of changed bytes, and then those bytes XORed. Unchanged stretches are found
+		   eight bytes at a time, which is where nearly all of the time goes for typical states. */
+		size_t size = a.size();
+		size_t index = 0;
+		size_t delta_size = 0;
+		while (index < size) {
+			size_t skip_start = index;
+			for (; index + 8 <= size; index += 8) {
+				u64 word_a, word_b;
+				std::memcpy(&word_a, a.data() + index, 8);
+				std::memcpy(&word_b, b.data() + index, 8);
+				if (word_a != word_b) {
+					break;
+				}
+			}
+			while (index < size && a[index] == b[index]) {
+				++index;
+			}
+			if (index == size) {
+				break;
+			}
+
+			size_t changed_start = index;
+			size_t changed_end = size;
+			size_t num_unchanged = 0;
+			for (; index < size; ++index) {
+				if (a[index] != b[index]) {
+					num_unchanged = 0;
+				}
+				else if (++num_unchanged == min_unchanged_run) {
+					changed_end = index + 1 - min_unchanged_run;
+					break;
+				}
+			}
+			if (index == size) {
+				changed_end = size - num_unchanged;
+			}
+			index = changed_end;
+
+			delta_size = WriteVarint(changed_start - skip_start, delta, delta_size);
+			delta_size = WriteVarint(changed_end - changed_start, delta, delta_size);
+			for (size_t i = changed_start; i < changed_end; ++i) {
+				delta[delta_size++] = a[i] ^ b[i];
+			}
+		}
+		return delta_size;
+	}
+
+
+	Stats GetStats()
+	{
+		size_t num_snapshots = stats_num_snapshots.load(std::memory_order_relaxed);
+		return {
+			.num_snapshots = num_snapshots,
+			.num_frames = num_snapshots * capture_interval.load(std::memory_order_relaxed),
+			.memory_used = stats_memory_used.load(std::memory_order_relaxed),
+			.capture_time_ms = stats_capture_time_ms.load(std::memory_order_relaxed)
+		};
+	}
+
+
+	bool PushDelta(std::span<const u8> delta)
+	{
+		if (delta.size() > delta_buffer.size()) {
+			return false;
+		}
+		if (num_deltas == max_deltas) {
+			delta_buffer_used -= deltas[oldest_delta_index].size;
+			oldest_delta_index = (oldest_delta_index + 1) % max_deltas;
+			--num_deltas;
+		}
+		size_t offset = 0;
+		if (num_deltas > 0) {
+			const Delta& newest = deltas[(oldest_delta_index + num_deltas - 1) % max_deltas];
+			offset = newest.offset + newest.size;
+			if (offset + delta.size() > delta_buffer.size()) {
+				offset = 0;
+			}
+		}
+		/* Deltas lie in the buffer in the order they were pushed, wrapping around, so the only ones that
+		   can be in the way are the oldest ones. */
+		while (num_deltas > 0) {
+			const Delta& oldest = deltas[oldest_delta_index];
+			if (oldest.offset >= offset + delta.size() || oldest.offset + oldest.size <= offset) {
+				break;
+			}
+			delta_buffer_used -= oldest.size;
+			oldest_delta_index = (oldest_delta_index + 1) % max_deltas;
+			--num_deltas;
+		}
+		std::ranges::copy(delta, delta_buffer.begin() + offset);
+		deltas[(oldest_delta_index + num_deltas) % max_deltas] = { .offset = offset, .size = delta.size() };
+		++num_deltas;
+		delta_buffer_used += delta.size();
+		return true;
+	}
+
+
+	size_t ReadVarint(std::span<const u8> data, size_t& index)
+	{
+		size_t value = 0;
+		for (uint shift = 0; ; shift += 7) {
+			u8 byte = data[index++];
+			value |= size_t(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0) {
+				return value;
+			}
+		}
+	}
+
+
+	void SetCaptureInterval(uint num_frames)
+	{
+		capture_interval.store(std::max(num_frames, 1u), std::memory_order_relaxed);
+	}
+
+
+	bool StepBack(Core& core)
+	{
+		/* The first step back since the last capture loads the snapshot captured last; every further step
+		   loads the one before the one loaded last, or the oldest one if there is nothing further back.
+		   Returns false if there is no snapshot at all. Emulation thread only. */
+		if (!has_latest_state) {
+			return false;
+		}
+		if (!latest_state_is_loaded) {
+			latest_state_is_loaded = true;
+		}
+		else if (num_deltas > 0) {
+			const Delta& newest = deltas[(oldest_delta_index + num_deltas - 1) % max_deltas];
+			ApplyDelta({ delta_buffer.data() + newest.offset, newest.size }, latest_state);
+			delta_buffer_used -= newest.size;
+			--num_deltas;
+		}
+		frames_since_capture = 0;
+		stats_num_snapshots.store(num_deltas + 1, std::memory_order_relaxed);
+		stats_memory_used.store(latest_state.size() + delta_buffer_used, std::memory_order_relaxed);
+		return core.LoadStateFromMemory(latest_state);
+	}
+
+
+	size_t WriteVarint(size_t value, std::span<u8> data, size_t index)
+	{
+		while (value >= 0x80) {
+			data[index++] = u8(value | 0x80);
+			value >>= 7;
+		}
+		data[index++] = u8(value);
+		return index;
+	}
+}
\ No newline at end of file
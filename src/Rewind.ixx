@@ -0,0 +1,78 @@
+export module Rewind;
+
+import Core;
+import Profiler;
+import Types;
+
+import <algorithm>;
+import <atomic>;
+import <chrono>;
+import <cstring>;
+import <span>;
+import <vector>;
+
+namespace Rewind
+{
+	export
+	{
+		struct Stats
+		{
+			size_t num_snapshots;
+			size_t num_frames; /* how far back it is possible to rewind */
+			size_t memory_used; /* in bytes, including the latest snapshot, which is kept in full */
+			f32 capture_time_ms; /* moving average */
+		};
+
+		constexpr uint default_capture_interval = 2; /* frames */
+		constexpr size_t default_buffer_size = 32 * 1024 * 1024;
+
+		void Capture(Core& core);
+		void Clear();
+		Stats GetStats();
+		void SetCaptureInterval(uint num_frames);
+		bool StepBack(Core& core);
+	}
+
+	/* A delta between two snapshots, stored somewhere in 'delta_buffer'. */
+	struct Delta
+	{
+		size_t offset, size;
+	};
+
+	void ApplyDelta(std::span<const u8> delta, std::span<u8> state);
+	size_t EncodeDelta(std::span<const u8> from, std::span<const u8> to, std::span<u8> delta);
+	bool PushDelta(std::span<const u8> delta);
+	size_t ReadVarint(std::span<const u8> data, size_t& index);
+	size_t WriteVarint(size_t value, std::span<u8> data, size_t index);
+
+	/* Stretches of unchanged bytes shorter than this are kept in a delta as part of the surrounding
+	   changed bytes, since starting a new segment would cost about as much as the bytes themselves. */
+	constexpr size_t min_unchanged_run = 8;
+	/* The number of deltas is bounded as well, so that their bookkeeping never allocates. */
+	constexpr size_t max_deltas = 1 << 16;
+	/* Weight of each new measurement in the moving average of the capture time. */
+	constexpr f32 capture_time_smoothing = 0.05f;
+
+	std::atomic<uint> capture_interval = default_capture_interval;
+
+	/* Only touched on the emulation thread. The most recent snapshot is kept in full in 'latest_state'.
+	   Every older snapshot is kept as the XOR of it and its successor, with runs of zero bytes (unchanged
+	   bytes) left out, and can be recovered by applying its delta to the successor. Stepping back thus
+	   walks the deltas from newest to oldest. When 'delta_buffer' runs out of space, the oldest deltas
+	   are dropped. Deltas are never split across the end of the buffer; any space left there is skipped. */
+	bool has_latest_state;
+	bool latest_state_is_loaded; /* by 'StepBack', since it was captured */
+	uint frames_since_capture;
+	std::vector<u8> latest_state;
+	std::vector<u8> new_state;
+	std::vector<u8> encoded_delta; /* scratch space, large enough for the worst case */
+	std::vector<u8> delta_buffer;
+	std::vector<Delta> deltas; /* circular, 'max_deltas' long; oldest at 'oldest_delta_index' */
+	size_t oldest_delta_index;
+	size_t num_deltas;
+	size_t delta_buffer_used;
+
+	std::atomic<size_t> stats_num_snapshots;
+	std::atomic<size_t> stats_memory_used;
+	std::atomic<f32> stats_capture_time_ms;
+}
\ No newline at end of file
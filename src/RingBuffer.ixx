@@ -0,0 +1,133 @@
+export module RingBuffer;
+
+import Types;
+
+import <algorithm>;
+import <atomic>;
+import <bit>;
+import <cassert>;
+import <span>;
+import <vector>;
+
+/* Single-producer/single-consumer lock-free ring buffer. One thread may push while another thread pops,
+   without any locking. The read and write indices grow without bound and are masked on access, so that a
+   full buffer can be told apart from an empty one without wasting a slot.
+   'Clear' and 'Resize' may only be called while neither side is using the buffer. */
+export template<typename T>
+class RingBuffer
+{
+public:
+	explicit RingBuffer(size_t capacity = 0);
+
+	size_t Capacity() const;
+	void Clear();
+	size_t FreeSpace() const;
+	bool Pop(T& value);
+	size_t Pop(std::span<T> values);
+	bool Push(const T& value);
+	size_t Push(std::span<const T> values);
+	void Resize(size_t capacity);
+	size_t Size() const;
+
+private:
+	std::vector<T> buffer;
+	size_t index_mask;
+
+	/* Kept on separate cache lines so that the producer and consumer do not invalidate each other's line
+	   on every push and pop. */
+	alignas(64) std::atomic<size_t> read_index;
+	alignas(64) std::atomic<size_t> write_index;
+};
+
+
+/// Template definitions ////////////////////////////
+template<typename T>
+RingBuffer<T>::RingBuffer(size_t capacity)
+{
+	Resize(capacity);
+}
+
+
+template<typename T>
+size_t RingBuffer<T>::Capacity() const
+{
+	return buffer.size();
+}
+
+
+template<typename T>
+void RingBuffer<T>::Clear()
+{
+	read_index.store(0, std::memory_order_relaxed);
+	write_index.store(0, std::memory_order_relaxed);
+}
+
+
+template<typename T>
+size_t RingBuffer<T>::FreeSpace() const
+{
+	return Capacity() - Size();
+}
+
+
+template<typename T>
+bool RingBuffer<T>::Pop(T& value)
+{
+	return Pop(std::span<T>{ &value, 1 }) == 1;
+}
+
+
+template<typename T>
+size_t RingBuffer<T>::Pop(std::span<T> values)
+{
+	size_t read = read_index.load(std::memory_order_relaxed);
+	size_t write = write_index.load(std::memory_order_acquire);
+	size_t num_values = std::min(values.size(), write - read);
+	size_t first_part = std::min(num_values, buffer.size() - (read & index_mask));
+	std::copy_n(buffer.begin() + (read & index_mask), first_part, values.begin());
+	std::copy_n(buffer.begin(), num_values - first_part, values.begin() + first_part);
+	read_index.store(read + num_values, std::memory_order_release);
+	return num_values;
+}
+
+
+template<typename T>
+bool RingBuffer<T>::Push(const T& value)
+{
+	return Push(std::span<const T>{ &value, 1 }) == 1;
+}
+
+
+template<typename T>
+size_t RingBuffer<T>::Push(std::span<const T> values)
+{
+	size_t write = write_index.load(std::memory_order_relaxed);
+	size_t read = read_index.load(std::memory_order_acquire);
+	size_t num_values = std::min(values.size(), buffer.size() - (write - read));
+	size_t first_part = std::min(num_values, buffer.size() - (write & index_mask));
+	std::copy_n(values.begin(), first_part, buffer.begin() + (write & index_mask));
+	std::copy_n(values.begin() + first_part, num_values - first_part, buffer.begin());
+	write_index.store(write + num_values, std::memory_order_release);
+	return num_values;
+}
+
+
+template<typename T>
+void RingBuffer<T>::Resize(size_t capacity)
+{
+	capacity = capacity > 0 ? std::bit_ceil(capacity) : 0;
+	buffer.assign(capacity, T{});
+	index_mask = capacity > 0 ? capacity - 1 : 0;
+	Clear();
+}
+
+
+template<typename T>
+size_t RingBuffer<T>::Size() const
+{
+	/* The read index is loaded first, so that the difference can never underflow. The producer may have
+	   pushed in between, so clamp it as well. */
+	size_t read = read_index.load(std::memory_order_acquire);
+	size_t write = write_index.load(std::memory_order_acquire);
+	return std::min(write - read, buffer.size());
+}
\ No newline at end of file
@@ -0,0 +1,404 @@
+module RomLibrary;
+
+import Hashing;
+import MappedFile;
+import RomLoader;
+import ThreadPool;
+import UserMessage;
+
+import <cctype>;
+import <cstring>;
+
+namespace RomLibrary
+{
+	void AddDirectory(std::string path)
+	{
+		{
+			std::lock_guard lock{ mutex };
+			if (!index_is_loaded) {
+				LoadIndex();
+			}
+			if (std::ranges::find(directories, path) != directories.end()) {
+				return;
+			}
+			directories.push_back(std::move(path));
+		}
+		CancelScan();
+		Rescan();
+	}
+
+
+	void AddRecent(const std::string& path)
+	{
+		std::lock_guard lock{ mutex };
+		if (!index_is_loaded) {
+			LoadIndex();
+		}
+		std::erase(recent_paths, path);
+		recent_paths.insert(recent_paths.begin(), path);
+		if (recent_paths.size() > max_recent_paths) {
+			recent_paths.resize(max_recent_paths);
+		}
+		index_is_dirty = true;
+	}
+
+
+	void CancelScan()
+	{
+		if (scan_thread.joinable()) {
+			scan_thread.request_stop();
+			scan_thread.join();
+		}
+		is_scanning = false;
+	}
+
+
+	System DetectSystem(std::string_view file_name, std::span<const u8> data)
+	{
+		/* 'data' is empty for a rom inside a zip, which is not unpacked for this. */
+		auto HasMagic = [&](size_t offset, std::string_view magic) {
+			return data.size() >= offset + magic.size() && std::memcmp(data.data() + offset, magic.data(), magic.size()) == 0;
+		};
+		if (HasMagic(0, "NES\x1A")) {
+			return System::Nes;
+		}
+		if (HasMagic(0, "\x80\x37\x12\x40")) {
+			return System::Nintendo64;
+		}
+		if (HasMagic(0x100, "SEGA")) {
+			return System::MegaDrive;
+		}
+		std::string extension = std::filesystem::path(file_name).extension().string();
+		std::ranges::transform(extension, extension.begin(), [](char c) { return char(std::tolower(u8(c))); });
+		auto rom_extension = std::ranges::find(rom_extensions, std::string_view{ extension },
+			&std::pair<std::string_view, System>::first);
+		if (rom_extension == rom_extensions.end()) {
+			return System::Unknown;
+		}
+		/* Game Boy Color games that also run on the Game Boy often have the extension of the latter; the
+		   cartridge header tells. */
+		if (rom_extension->second == System::GameBoy && data.size() > 0x143 && (data[0x143] & 0x80)) {
+			return System::GameBoyColor;
+		}
+		return rom_extension->second;
+	}
+
+
+	std::vector<std::string> GetDirectories()
+	{
+		std::lock_guard lock{ mutex };
+		if (!index_is_loaded) {
+			LoadIndex();
+		}
+		return directories;
+	}
+
+
+	std::shared_ptr<const std::vector<Entry>> GetEntries()
+	{
+		std::lock_guard lock{ mutex };
+		if (!index_is_loaded) {
+			LoadIndex();
+		}
+		return entries;
+	}
+
+
+	std::vector<std::string> GetRecent()
+	{
+		std::lock_guard lock{ mutex };
+		if (!index_is_loaded) {
+			LoadIndex();
+		}
+		return recent_paths;
+	}
+
+
+	ScanStatus GetScanStatus()
+	{
+		return {
+			.is_scanning = is_scanning,
+			.num_files = scan_num_files,
+			.num_checked_files = scan_num_checked_files,
+			.num_hashed_files = scan_num_hashed_files
+		};
+	}
+
+
+	std::string_view GetSystemName(System system)
+	{
+		switch (system) {
+		case System::Atari2600: return "Atari 2600";
+		case System::GameBoy: return "Game Boy";
+		case System::GameBoyAdvance: return "Game Boy Advance";
+		case System::GameBoyColor: return "Game Boy Color";
+		case System::GameGear: return "Game Gear";
+		case System::MasterSystem: return "Master System";
+		case System::MegaDrive: return "Mega Drive";
+		case System::Nes: return "NES";
+		case System::Nintendo64: return "Nintendo 64";
+		case System::PcEngine: return "PC Engine";
+		case System::Snes: return "SNES";
+		default: return "";
+		}
+	}
+
+
+	bool IsRomFile(const std::filesystem::path& path)
+	{
+		std::string extension = path.extension().string();
+		std::ranges::transform(extension, extension.begin(), [](char c) { return char(std::tolower(u8(c))); });
+		return std::ranges::find(rom_extensions, std::string_view{ extension },
+			&std::pair<std::string_view, System>::first) != rom_extensions.end();
+	}
+
+
+	void LoadIndex()
+	{
+		/* Called with 'mutex' held, the first time that the library is used. */
+		index_is_loaded = true;
+		if (!std::filesystem::exists(index_file_path)) {
+			return;
+		}
+		SerializationStream stream{ SerializationMode::Read, index_file_path };
+		std::vector<std::string> loaded_directories;
+		std::vector<std::string> loaded_recent_paths;
+		std::vector<Entry> loaded_entries;
+		StreamIndex(stream, loaded_directories, loaded_recent_paths, loaded_entries);
+		if (stream.HasError()) {
+			UserMessage::Show("Could not load the rom library.", UserMessage::Type::Warning);
+			return;
+		}
+		directories = std::move(loaded_directories);
+		recent_paths = std::move(loaded_recent_paths);
+		entries = std::make_shared<const std::vector<Entry>>(std::move(loaded_entries));
+	}
+
+
+	void RemoveDirectory(const std::string& path)
+	{
+		/* The entries in the directory are dropped at once, rather than by the next scan. */
+		CancelScan();
+		{
+			std::lock_guard lock{ mutex };
+			if (!index_is_loaded) {
+				LoadIndex();
+			}
+			std::erase(directories, path);
+			std::filesystem::path directory = path;
+			std::vector<Entry> remaining_entries;
+			for (const Entry& entry : *entries) {
+				std::filesystem::path relative_path = std::filesystem::path(entry.path).lexically_relative(directory);
+				if (relative_path.empty() || *relative_path.begin() == "..") {
+					remaining_entries.push_back(entry);
+				}
+			}
+			entries = std::make_shared<const std::vector<Entry>>(std::move(remaining_entries));
+		}
+		SaveIndex();
+		Rescan(); /* in case the directory was inside another one */
+	}
+
+
+	void Rescan()
+	{
+		/* Starts a scan of all directories in the background, unless one is running already. The entries
+		   are replaced once it completes. */
+		if (is_scanning) {
+			return;
+		}
+		if (scan_thread.joinable()) {
+			scan_thread.join(); /* a scan that has completed */
+		}
+		std::lock_guard lock{ mutex };
+		if (!index_is_loaded) {
+			LoadIndex();
+		}
+		scan_num_files = scan_num_checked_files = scan_num_hashed_files = 0;
+		is_scanning = true;
+		scan_thread = std::jthread{ Scan, directories, entries };
+	}
+
+
+	void SaveIndex()
+	{
+		/* Only the copying happens under 'mutex', which the gui takes every frame; serializing and writing
+		   the index happen outside of it. 'index_file_mutex' keeps the scan thread and the gui from writing
+		   the file at the same time, and an older copy from being written over a newer one. */
+		std::lock_guard index_file_lock{ index_file_mutex };
+		std::vector<std::string> directories_to_save;
+		std::vector<std::string> recent_paths_to_save;
+		std::shared_ptr<const std::vector<Entry>> entries_to_save;
+		{
+			std::lock_guard lock{ mutex };
+			directories_to_save = directories;
+			recent_paths_to_save = recent_paths;
+			entries_to_save = entries; /* never changed in place */
+			index_is_dirty = false; /* until a change after this copy, or if the write fails */
+		}
+		/* 'StreamIndex' streams both ways, and so takes the entries by non-const reference. */
+		std::vector<Entry> entries_copy = *entries_to_save;
+		SerializationStream stream{ SerializationMode::Write, index_file_path };
+		StreamIndex(stream, directories_to_save, recent_paths_to_save, entries_copy);
+		if (!stream.Flush()) {
+			std::lock_guard lock{ mutex };
+			index_is_dirty = true;
+		}
+	}
+
+
+	void Scan(std::stop_token stop_token, std::vector<std::string> directories_to_scan,
+		std::shared_ptr<const std::vector<Entry>> previous_entries)
+	{
+		/* Runs on the scan thread. Rescans are incremental: a file whose size and modification time match
+		   its entry from the previous scan is not read again, so that a rescan costs a directory listing and
+		   a stat per file. The file system is not watched for changes (e.g. with inotify), since changes
+		   made to a network disk by other machines are not reported that way. */
+		std::vector<std::string> paths;
+		for (const std::string& directory : directories_to_scan) {
+			std::error_code error_code;
+			auto iterator = std::filesystem::recursive_directory_iterator(directory,
+				std::filesystem::directory_options::skip_permission_denied, error_code);
+			for (; !error_code && iterator != std::filesystem::recursive_directory_iterator(); iterator.increment(error_code)) {
+				if (stop_token.stop_requested()) {
+					return;
+				}
+				if (iterator->is_regular_file(error_code) && IsRomFile(iterator->path())) {
+					paths.push_back(iterator->path().string());
+					++scan_num_files;
+				}
+			}
+		}
+		/* Directories may be nested in one another. */
+		std::ranges::sort(paths);
+		paths.erase(std::ranges::unique(paths).begin(), paths.end());
+		scan_num_files = paths.size();
+
+		std::vector<Entry> scanned_entries(paths.size());
+		std::vector<u8> entry_is_valid(paths.size());
+		ThreadPool thread_pool{ std::max(2 * std::thread::hardware_concurrency(), min_scan_threads) };
+		uint num_tasks = uint((paths.size() + files_per_scan_task - 1) / files_per_scan_task);
+		thread_pool.ParallelFor(num_tasks, [&](uint task_index) {
+			size_t end = std::min(size_t(task_index + 1) * files_per_scan_task, paths.size());
+			for (size_t i = size_t(task_index) * files_per_scan_task; i < end && !stop_token.stop_requested(); ++i) {
+				entry_is_valid[i] = ScanFile(paths[i], *previous_entries, scanned_entries[i]);
+				++scan_num_checked_files;
+			}
+		});
+		if (stop_token.stop_requested()) {
+			return;
+		}
+
+		std::vector<Entry> new_entries;
+		new_entries.reserve(paths.size());
+		for (size_t i = 0; i < paths.size(); ++i) {
+			if (entry_is_valid[i]) {
+				new_entries.push_back(std::move(scanned_entries[i]));
+			}
+		}
+		{
+			std::lock_guard lock{ mutex };
+			entries = std::make_shared<const std::vector<Entry>>(std::move(new_entries));
+		}
+		SaveIndex();
+		is_scanning = false;
+	}
+
+
+	bool ScanFile(const std::string& path, const std::vector<Entry>& previous_entries, Entry& entry)
+	{
+		/* Runs on a pool thread. Fails if the file cannot be read, or is a zip without a file in it. */
+		std::error_code error_code;
+		entry.path = path;
+		entry.file_size = std::filesystem::file_size(path, error_code);
+		if (error_code) {
+			return false;
+		}
+		entry.modification_time = std::filesystem::last_write_time(path, error_code).time_since_epoch().count();
+		if (error_code) {
+			return false;
+		}
+		auto previous_entry = std::ranges::lower_bound(previous_entries, path, {}, &Entry::path);
+		if (previous_entry != previous_entries.end() && previous_entry->path == path
+			&& previous_entry->file_size == entry.file_size && previous_entry->modification_time == entry.modification_time) {
+			entry = *previous_entry;
+			return true;
+		}
+
+		MappedFile file;
+		if (!file.Open(path)) {
+			return false;
+		}
+		std::span<const u8> data = file.Data();
+		if (RomLoader::IsZip(data)) {
+			std::string error;
+			std::optional<RomLoader::ArchiveEntry> archive_entry = RomLoader::FindLargestZipEntry(data, error);
+			if (!archive_entry) {
+				return false;
+			}
+			entry.crc32 = archive_entry->crc32;
+			entry.system = DetectSystem(archive_entry->name, {});
+		}
+		else {
+			entry.crc32 = Hashing::Crc32(data);
+			entry.system = DetectSystem(path, data);
+		}
+		++scan_num_hashed_files;
+		return true;
+	}
+
+
+	void Shutdown()
+	{
+		CancelScan();
+		bool index_needs_saving;
+		{
+			std::lock_guard lock{ mutex };
+			index_needs_saving = index_is_dirty;
+		}
+		if (index_needs_saving) {
+			SaveIndex();
+		}
+	}
+
+
+	void StreamIndex(SerializationStream& stream, std::vector<std::string>& directories_to_stream,
+		std::vector<std::string>& recent_paths_to_stream, std::vector<Entry>& entries_to_stream)
+	{
+		stream.StreamHeader(index_kind, index_version);
+		stream.Stream(directories_to_stream);
+		stream.Stream(recent_paths_to_stream);
+		u64 num_entries = entries_to_stream.size();
+		stream.Stream(num_entries);
+		std::string previous_path;
+		for (u64 i = 0; i < num_entries && !stream.HasError(); ++i) {
+			Entry read_entry;
+			bool is_reading = stream.GetMode() == SerializationMode::Read;
+			Entry& entry = is_reading ? read_entry : entries_to_stream[i];
+			u16 prefix_length = 0;
+			std::string suffix;
+			if (!is_reading) {
+				auto [mismatch, ignored] = std::ranges::mismatch(previous_path, entry.path);
+				prefix_length = u16(std::min<size_t>(mismatch - previous_path.begin(), 0xFFFF));
+				suffix = entry.path.substr(prefix_length);
+			}
+			stream.Stream(prefix_length);
+			stream.Stream(suffix);
+			if (is_reading) {
+				if (prefix_length > previous_path.size()) {
+					stream.SetError();
+					return;
+				}
+				entry.path = previous_path.substr(0, prefix_length) + suffix;
+			}
+			stream.Stream(entry.file_size);
+			stream.Stream(entry.modification_time);
+			stream.Stream(entry.crc32);
+			stream.Stream(entry.system);
+			previous_path = entry.path;
+			if (is_reading) {
+				entries_to_stream.push_back(std::move(read_entry));
+			}
+		}
+	}
+}
\ No newline at end of file
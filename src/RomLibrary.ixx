@@ -0,0 +1,133 @@
+export module RomLibrary;
+
+import Serialization;
+import Types;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <filesystem>;
+import <memory>;
+import <mutex>;
+import <span>;
+import <stop_token>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <utility>;
+import <vector>;
+
+namespace RomLibrary
+{
+	export
+	{
+		enum class System : u8 {
+			Unknown,
+			Atari2600,
+			GameBoy,
+			GameBoyAdvance,
+			GameBoyColor,
+			GameGear,
+			MasterSystem,
+			MegaDrive,
+			Nes,
+			Nintendo64,
+			PcEngine,
+			Snes
+		};
+
+		struct Entry
+		{
+			std::string path;
+			u64 file_size;
+			s64 modification_time;
+			u32 crc32; /* of the rom; for a zip, of the rom inside it, as given by the zip */
+			System system;
+		};
+
+		struct ScanStatus
+		{
+			bool is_scanning;
+			u64 num_files; /* found so far */
+			u64 num_checked_files;
+			u64 num_hashed_files; /* new or changed since the last scan, and therefore read */
+		};
+
+		void AddDirectory(std::string path);
+		void AddRecent(const std::string& path);
+		std::vector<std::string> GetDirectories();
+		std::shared_ptr<const std::vector<Entry>> GetEntries();
+		std::vector<std::string> GetRecent();
+		ScanStatus GetScanStatus();
+		std::string_view GetSystemName(System system);
+		void RemoveDirectory(const std::string& path);
+		void Rescan();
+		void Shutdown();
+	}
+
+	void CancelScan();
+	System DetectSystem(std::string_view file_name, std::span<const u8> data);
+	bool IsRomFile(const std::filesystem::path& path);
+	void LoadIndex();
+	void SaveIndex();
+	void Scan(std::stop_token stop_token, std::vector<std::string> directories_to_scan,
+		std::shared_ptr<const std::vector<Entry>> previous_entries);
+	bool ScanFile(const std::string& path, const std::vector<Entry>& previous_entries, Entry& entry);
+	void StreamIndex(SerializationStream& stream, std::vector<std::string>& directories_to_stream,
+		std::vector<std::string>& recent_paths_to_stream, std::vector<Entry>& entries_to_stream);
+
+	/* Roms are told apart from other files by their extension; a system is given where the extension
+	   settles it. Zips are looked into; the system of a zipped rom comes from the extension of the rom. */
+	constexpr std::array<std::pair<std::string_view, System>, 21> rom_extensions = { {
+		{ ".a26", System::Atari2600 },
+		{ ".bin", System::Unknown },
+		{ ".chd", System::Unknown },
+		{ ".cue", System::Unknown },
+		{ ".gb", System::GameBoy },
+		{ ".gba", System::GameBoyAdvance },
+		{ ".gbc", System::GameBoyColor },
+		{ ".gen", System::MegaDrive },
+		{ ".gg", System::GameGear },
+		{ ".iso", System::Unknown },
+		{ ".md", System::MegaDrive },
+		{ ".n64", System::Nintendo64 },
+		{ ".nes", System::Nes },
+		{ ".pce", System::PcEngine },
+		{ ".sfc", System::Snes },
+		{ ".smc", System::Snes },
+		{ ".smd", System::MegaDrive },
+		{ ".sms", System::MasterSystem },
+		{ ".v64", System::Nintendo64 },
+		{ ".z64", System::Nintendo64 },
+		{ ".zip", System::Unknown }
+	} };
+
+	/* Files are checked in batches of this many per task. Checking a file is mostly waiting for the disk,
+	   often a network one, so the pool gets more threads than there are cores. */
+	constexpr uint files_per_scan_task = 32;
+	constexpr uint min_scan_threads = 8;
+	constexpr size_t max_recent_paths = 10;
+
+	/* The index holds the directories, the recently opened roms and every entry, ordered by path. Each
+	   path is stored as the length of the prefix it shares with the previous one followed by the rest,
+	   which shrinks a library of long paths in a few directories to a fraction of its size. */
+	const std::filesystem::path index_file_path = "rom_library.bin";
+	constexpr std::string_view index_kind = "LIBR";
+	constexpr u32 index_version = 1;
+
+	std::mutex index_file_mutex; /* held while the index file is written */
+	std::mutex mutex; /* guards everything below that is not atomic */
+	bool index_is_loaded;
+	bool index_is_dirty; /* has changes that only 'Shutdown' would save, e.g. to the recent roms */
+	std::vector<std::string> directories;
+	std::vector<std::string> recent_paths; /* most recent first */
+	/* Ordered by path. Never changed in place; a scan replaces it as a whole, so that the gui can hold on
+	   to the one it shows without locking. */
+	std::shared_ptr<const std::vector<Entry>> entries = std::make_shared<const std::vector<Entry>>();
+
+	std::jthread scan_thread;
+	std::atomic<bool> is_scanning;
+	std::atomic<u64> scan_num_files;
+	std::atomic<u64> scan_num_checked_files;
+	std::atomic<u64> scan_num_hashed_files;
+}
\ No newline at end of file
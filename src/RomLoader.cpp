@@ -0,0 +1,438 @@
+module RomLoader;
+
+import Compression;
+
+import <cstdio>;
+import <format>;
+
+namespace RomLoader
+{
+	void CancelLoad()
+	{
+		/* Waits for the loader thread to notice; it checks between pieces of at most a megabyte. */
+		if (loader_thread.joinable()) {
+			loader_thread.request_stop();
+			loader_thread.join();
+		}
+		std::lock_guard lock{ completion_mutex };
+		completion.reset();
+		progress_phase = Phase::Idle;
+	}
+
+
+	void DeleteTemporaryCopies(const std::filesystem::path& path_to_keep)
+	{
+		/* Called once the roms that the copies were made of are no longer loaded, i.e. when another rom has
+		   been loaded, which may have been copied to the same path, and on shutdown. */
+		std::lock_guard lock{ temporary_copies_mutex };
+		std::erase_if(temporary_copies, [&](const std::filesystem::path& path) {
+			if (path == path_to_keep) {
+				return false;
+			}
+			std::error_code error_code;
+			std::filesystem::remove(path, error_code);
+			return true;
+		});
+	}
+
+
+	std::optional<ArchiveEntry> FindLargestZipEntry(std::span<const u8> file, std::string& error)
+	{
+		/* The end of central directory record ends the file, unless it is followed by a comment, so it is
+		   searched for backwards from the end. A rom that comes zipped is normally the only file in its
+		   zip; if there are several, the largest one is taken to be the rom. */
+		error = "the zip file is damaged";
+		if (file.size() < zip_end_of_central_directory_size) {
+			return std::nullopt;
+		}
+		size_t search_start = file.size() - zip_end_of_central_directory_size;
+		size_t search_end = search_start > zip_max_comment_size ? search_start - zip_max_comment_size : 0;
+		std::optional<size_t> end_offset;
+		for (size_t offset = search_start; !end_offset; --offset) {
+			if (ReadLittleEndian32(file, offset) == zip_end_of_central_directory_signature
+				&& offset + zip_end_of_central_directory_size + ReadLittleEndian16(file, offset + 20) == file.size()) {
+				end_offset = offset;
+			}
+			if (offset == search_end) {
+				break;
+			}
+		}
+		if (!end_offset) {
+			return std::nullopt;
+		}
+		size_t num_entries = ReadLittleEndian16(file, *end_offset + 10);
+		size_t directory_offset = ReadLittleEndian32(file, *end_offset + 16);
+		if (num_entries == 0xFFFF || directory_offset == 0xFFFF'FFFF) {
+			error = "zip64 files are not supported";
+			return std::nullopt;
+		}
+
+		std::optional<ArchiveEntry> largest_entry;
+		size_t offset = directory_offset;
+		for (size_t i = 0; i < num_entries; ++i) {
+			if (offset + zip_central_directory_entry_size > *end_offset
+				|| ReadLittleEndian32(file, offset) != zip_central_directory_signature) {
+				return std::nullopt;
+			}
+			ArchiveEntry entry = {
+				.flags = u16(ReadLittleEndian16(file, offset + 8)),
+				.compression_method = u16(ReadLittleEndian16(file, offset + 10)),
+				.crc32 = ReadLittleEndian32(file, offset + 16),
+				.compressed_size = ReadLittleEndian32(file, offset + 20),
+				.uncompressed_size = ReadLittleEndian32(file, offset + 24),
+				.local_header_offset = ReadLittleEndian32(file, offset + 42)
+			};
+			size_t name_offset = offset + zip_central_directory_entry_size;
+			size_t name_length = ReadLittleEndian16(file, offset + 28);
+			if (name_length > *end_offset - name_offset) {
+				return std::nullopt;
+			}
+			entry.name.assign(reinterpret_cast<const char*>(file.data() + name_offset), name_length);
+			offset = name_offset + name_length + ReadLittleEndian16(file, offset + 30) + ReadLittleEndian16(file, offset + 32);
+			if (entry.name.ends_with('/')) {
+				continue; /* a directory */
+			}
+			if (entry.compressed_size == 0xFFFF'FFFF || entry.uncompressed_size == 0xFFFF'FFFF
+				|| entry.local_header_offset == 0xFFFF'FFFF) {
+				error = "zip64 files are not supported";
+				return std::nullopt;
+			}
+			if (!largest_entry || entry.uncompressed_size > largest_entry->uncompressed_size) {
+				largest_entry = std::move(entry);
+			}
+		}
+		if (!largest_entry) {
+			error = "the zip file holds no files";
+		}
+		return largest_entry;
+	}
+
+
+	Progress GetProgress()
+	{
+		Progress progress;
+		progress.phase = progress_phase;
+		u64 num_total_bytes = progress_num_total_bytes;
+		progress.fraction = num_total_bytes > 0 ? f32(f64(progress_num_done_bytes) / f64(num_total_bytes)) : 0.0f;
+		std::lock_guard lock{ progress_mutex };
+		progress.path = progress_path;
+		return progress;
+	}
+
+
+	Hashes HashData(std::span<const u8> data, std::stop_token stop_token)
+	{
+		/* Both hashes are taken over the same piece while it is in the cache, rather than in two passes
+		   over all of the data. */
+		Hashes hashes{};
+		Hashing::Sha1 sha1;
+		for (size_t offset = 0; offset < data.size() && !stop_token.stop_requested(); offset += hash_chunk_size) {
+			std::span<const u8> chunk = data.subspan(offset, std::min(hash_chunk_size, data.size() - offset));
+			hashes.crc32 = Hashing::Crc32(chunk, hashes.crc32);
+			sha1.Update(chunk);
+			SetProgress(Phase::Hashing, offset + chunk.size(), data.size());
+		}
+		hashes.sha1 = sha1.Finish();
+		return hashes;
+	}
+
+
+	bool IsZip(std::span<const u8> file)
+	{
+		return ReadLittleEndian32(file, 0) == zip_local_header_signature
+			|| file.size() == zip_end_of_central_directory_size
+			&& ReadLittleEndian32(file, 0) == zip_end_of_central_directory_signature;
+	}
+
+
+	std::shared_ptr<const Rom> Load(const std::string& path, std::string& error)
+	{
+		/* Loads on the calling thread, e.g. before the gui is up. */
+		return LoadRom(path, {}, error);
+	}
+
+
+	void LoadAsync(std::string path)
+	{
+		/* Returns immediately; the result is reported through 'PollCompletion'. */
+		CancelLoad();
+		{
+			std::lock_guard lock{ progress_mutex };
+			progress_path = path;
+		}
+		progress_num_done_bytes = progress_num_total_bytes = 0;
+		progress_phase = Phase::Opening;
+		loader_thread = std::jthread{ [path = std::move(path)](std::stop_token stop_token) {
+			reports_progress = true;
+			std::string error;
+			std::shared_ptr<const Rom> rom = LoadRom(path, stop_token, error);
+			progress_phase = Phase::Idle;
+			if (stop_token.stop_requested()) {
+				return;
+			}
+			std::lock_guard lock{ completion_mutex };
+			completion = Completion{ .path = path, .rom = std::move(rom), .error = std::move(error) };
+		} };
+	}
+
+
+	void LoadHashCache()
+	{
+		/* Called with 'hash_cache_mutex' held. A cache that cannot be read only means that roms are hashed
+		   again, so errors are not reported. */
+		hash_cache_is_loaded = true;
+		if (!std::filesystem::exists(hash_cache_file_path)) {
+			return;
+		}
+		SerializationStream stream{ SerializationMode::Read, hash_cache_file_path };
+		stream.StreamHeader(hash_cache_kind, hash_cache_version);
+		u64 num_entries = 0;
+		stream.Stream(num_entries);
+		std::unordered_map<std::string, HashCacheEntry> loaded_cache;
+		for (u64 i = 0; i < num_entries && !stream.HasError(); ++i) {
+			std::string path;
+			HashCacheEntry entry;
+			StreamHashCacheEntry(stream, path, entry);
+			loaded_cache.emplace(std::move(path), entry);
+		}
+		if (!stream.HasError()) {
+			hash_cache = std::move(loaded_cache);
+		}
+	}
+
+
+	std::shared_ptr<Rom> LoadRom(const std::string& path, std::stop_token stop_token, std::string& error)
+	{
+		/* Mapping a file costs next to nothing up front; its pages are read in as they are first touched,
+		   by the core or by the hashing. */
+		auto rom = std::make_shared<Rom>();
+		rom->path = path;
+		rom->name = std::filesystem::path(path).filename().string();
+		std::error_code error_code;
+		std::string cache_key = std::filesystem::absolute(path, error_code).string(); /* the same file, however it was named */
+		u64 file_size = error_code ? 0 : std::filesystem::file_size(path, error_code);
+		s64 modification_time = error_code ? 0 : std::filesystem::last_write_time(path, error_code).time_since_epoch().count();
+		if (error_code || !rom->mapped_file.Open(path)) {
+			error = "the file could not be opened";
+			return nullptr;
+		}
+		std::span<const u8> file = rom->mapped_file.Data();
+
+		std::optional<ArchiveEntry> archive_entry;
+		if (IsZip(file)) {
+			archive_entry = FindLargestZipEntry(file, error);
+			if (!archive_entry || !UnpackZipEntry(*rom, *archive_entry, stop_token, error)) {
+				return nullptr;
+			}
+		}
+		else if (file.size() >= seven_zip_signature.size() && std::ranges::equal(file.first(seven_zip_signature.size()), seven_zip_signature)) {
+			error = "7z archives are not supported";
+			return nullptr;
+		}
+		else {
+			rom->data = file;
+		}
+
+		if (std::optional<Hashes> cached_hashes = LookUpHashes(cache_key, file_size, modification_time)) {
+			rom->hashes = *cached_hashes;
+			return rom;
+		}
+		rom->hashes = HashData(rom->data, stop_token);
+		if (stop_token.stop_requested()) {
+			error = "loading was cancelled";
+			return nullptr;
+		}
+		/* Unpacked data is checked against the crc in the archive only here, when it is first hashed; a
+		   cache hit means that the same file has been checked before. */
+		if (archive_entry && rom->hashes.crc32 != archive_entry->crc32) {
+			error = "the zip file is damaged";
+			return nullptr;
+		}
+		StoreHashes(cache_key, file_size, modification_time, rom->hashes);
+		return rom;
+	}
+
+
+	std::optional<Hashes> LookUpHashes(const std::string& path, u64 file_size, s64 modification_time)
+	{
+		std::lock_guard lock{ hash_cache_mutex };
+		if (!hash_cache_is_loaded) {
+			LoadHashCache();
+		}
+		auto entry = hash_cache.find(path);
+		if (entry == hash_cache.end() || entry->second.file_size != file_size
+			|| entry->second.modification_time != modification_time) {
+			return std::nullopt;
+		}
+		return entry->second.hashes;
+	}
+
+
+	std::optional<Completion> PollCompletion()
+	{
+		/* Called by the gui to learn about a finished load, without ever waiting for one. */
+		std::lock_guard lock{ completion_mutex };
+		std::optional<Completion> result = std::move(completion);
+		completion.reset();
+		return result;
+	}
+
+
+	u32 ReadLittleEndian16(std::span<const u8> data, size_t offset)
+	{
+		/* Reads outside of 'data' produce 0, which no signature or sensible size in a zip file is. */
+		if (offset > data.size() || data.size() - offset < 2) {
+			return 0;
+		}
+		return data[offset] | data[offset + 1] << 8;
+	}
+
+
+	u32 ReadLittleEndian32(std::span<const u8> data, size_t offset)
+	{
+		if (offset > data.size() || data.size() - offset < 4) {
+			return 0;
+		}
+		return ReadLittleEndian16(data, offset) | ReadLittleEndian16(data, offset + 2) << 16;
+	}
+
+
+	void SaveHashCache()
+	{
+		std::lock_guard lock{ hash_cache_mutex };
+		if (!hash_cache_is_dirty) {
+			return;
+		}
+		SerializationStream stream{ SerializationMode::Write, hash_cache_file_path };
+		stream.StreamHeader(hash_cache_kind, hash_cache_version);
+		u64 num_entries = hash_cache.size();
+		stream.Stream(num_entries);
+		for (const auto& [path, entry] : hash_cache) {
+			std::string path_copy = path;
+			HashCacheEntry entry_copy = entry;
+			StreamHashCacheEntry(stream, path_copy, entry_copy);
+		}
+		hash_cache_is_dirty = !stream.Flush();
+	}
+
+
+	void SetProgress(Phase phase, u64 num_done_bytes, u64 num_total_bytes)
+	{
+		if (reports_progress) {
+			progress_num_done_bytes = num_done_bytes;
+			progress_num_total_bytes = num_total_bytes;
+			progress_phase = phase;
+		}
+	}
+
+
+	void Shutdown()
+	{
+		CancelLoad();
+		SaveHashCache();
+		DeleteTemporaryCopies();
+	}
+
+
+	void StoreHashes(const std::string& path, u64 file_size, s64 modification_time, const Hashes& hashes)
+	{
+		std::lock_guard lock{ hash_cache_mutex };
+		if (!hash_cache_is_loaded) {
+			LoadHashCache();
+		}
+		hash_cache[path] = { .file_size = file_size, .modification_time = modification_time, .hashes = hashes };
+		hash_cache_is_dirty = true;
+	}
+
+
+	void StreamHashCacheEntry(SerializationStream& stream, std::string& path, HashCacheEntry& entry)
+	{
+		stream.Stream(path);
+		stream.Stream(entry.file_size);
+		stream.Stream(entry.modification_time);
+		stream.Stream(entry.hashes.crc32);
+		stream.StreamBytes(entry.hashes.sha1);
+	}
+
+
+	bool UnpackZipEntry(Rom& rom, const ArchiveEntry& entry, std::stop_token stop_token, std::string& error)
+	{
+		/* A stored entry is used in place. A deflated one is inflated straight out of the mapping, after
+		   which the archive is unmapped; only the unpacked rom is kept. */
+		std::span<const u8> file = rom.mapped_file.Data();
+		size_t header_offset = entry.local_header_offset;
+		size_t data_offset = header_offset + zip_local_header_size
+			+ ReadLittleEndian16(file, header_offset + 26) + ReadLittleEndian16(file, header_offset + 28);
+		if (ReadLittleEndian32(file, header_offset) != zip_local_header_signature
+			|| data_offset > file.size() || entry.compressed_size > file.size() - data_offset) {
+			error = "the zip file is damaged";
+			return false;
+		}
+		if (entry.flags & zip_flag_encrypted) {
+			error = "encrypted zip files are not supported";
+			return false;
+		}
+		std::span<const u8> compressed_data = file.subspan(data_offset, size_t(entry.compressed_size));
+		rom.is_from_archive = true;
+		rom.name = std::filesystem::path(entry.name).filename().string();
+
+		switch (entry.compression_method) {
+		case zip_method_stored:
+			if (entry.compressed_size != entry.uncompressed_size) {
+				error = "the zip file is damaged";
+				return false;
+			}
+			rom.data = compressed_data;
+			return true;
+
+		case zip_method_deflated: {
+			rom.decompressed_data.resize(size_t(entry.uncompressed_size));
+			SetProgress(Phase::Decompressing, 0, entry.uncompressed_size);
+			bool success = Compression::Inflate(compressed_data, rom.decompressed_data, [&](size_t num_output_bytes) {
+				SetProgress(Phase::Decompressing, num_output_bytes, entry.uncompressed_size);
+				return !stop_token.stop_requested();
+			});
+			if (!success) {
+				error = stop_token.stop_requested() ? "loading was cancelled" : "the zip file is damaged";
+				return false;
+			}
+			rom.data = rom.decompressed_data;
+			rom.mapped_file.Close();
+			return true;
+		}
+
+		default:
+			error = std::format("zip compression method {} is not supported", entry.compression_method);
+			return false;
+		}
+	}
+
+
+	std::optional<std::filesystem::path> WriteTemporaryCopy(const Rom& rom)
+	{
+		/* For cores that only take a path. The copy has the name of the rom, so that a core that tells the
+		   type of a rom by its extension still can. */
+		std::error_code error_code;
+		std::filesystem::path directory = std::filesystem::temp_directory_path(error_code) / "humla";
+		std::filesystem::create_directories(directory, error_code);
+		if (error_code) {
+			return std::nullopt;
+		}
+		std::filesystem::path path = directory / rom.name;
+		std::FILE* file = std::fopen(path.string().c_str(), "wb");
+		if (!file) {
+			return std::nullopt;
+		}
+		bool written = std::fwrite(rom.data.data(), 1, rom.data.size(), file) == rom.data.size();
+		written = std::fclose(file) == 0 && written;
+		if (!written) {
+			std::filesystem::remove(path, error_code);
+			return std::nullopt;
+		}
+		std::lock_guard lock{ temporary_copies_mutex };
+		if (std::ranges::find(temporary_copies, path) == temporary_copies.end()) {
+			temporary_copies.push_back(path);
+		}
+		return path;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+export module RomLoader;
+
+import Hashing;
+import MappedFile;
+import Serialization;
+import Types;
+
+import <algorithm>;
+import <array>;
+import <atomic>;
+import <filesystem>;
+import <memory>;
+import <mutex>;
+import <optional>;
+import <span>;
+import <stop_token>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <unordered_map>;
+import <vector>;
+
+namespace RomLoader
+{
+	export
+	{
+		/* A file in an archive, as listed in its directory. */
+		struct ArchiveEntry
+		{
+			std::string name;
+			u16 flags;
+			u16 compression_method;
+			u32 crc32;
+			u64 compressed_size;
+			u64 uncompressed_size;
+			u64 local_header_offset;
+		};
+
+		struct Hashes
+		{
+			u32 crc32;
+			Hashing::Sha1Digest sha1;
+		};
+
+		/* A rom image, ready to be handed to a core. A plain file is mapped, and 'data' views the mapping
+		   itself; a rom inside an archive is viewed in the mapping too if it is stored uncompressed, and is
+		   decompressed into 'decompressed_data' otherwise. Either way, 'data' is valid for as long as the
+		   object lives. */
+		struct Rom
+		{
+			std::string path; /* of the file that was opened, archive or not */
+			std::string name; /* file name of the rom, inside the archive if there is one */
+			bool is_from_archive;
+			std::span<const u8> data;
+			Hashes hashes;
+			MappedFile mapped_file;
+			std::vector<u8> decompressed_data;
+		};
+
+		enum class Phase {
+			Idle, Opening, Decompressing, Hashing
+		};
+
+		struct Progress
+		{
+			Phase phase;
+			f32 fraction; /* of the current phase */
+			std::string path;
+		};
+
+		struct Completion
+		{
+			std::string path;
+			std::shared_ptr<const Rom> rom; /* null if loading failed... */
+			std::string error; /* ...for this reason */
+		};
+
+		void CancelLoad();
+		void DeleteTemporaryCopies(const std::filesystem::path& path_to_keep = {});
+		std::optional<ArchiveEntry> FindLargestZipEntry(std::span<const u8> file, std::string& error);
+		Progress GetProgress();
+		bool IsZip(std::span<const u8> file);
+		std::shared_ptr<const Rom> Load(const std::string& path, std::string& error);
+		void LoadAsync(std::string path);
+		std::optional<Completion> PollCompletion();
+		void Shutdown();
+		std::optional<std::filesystem::path> WriteTemporaryCopy(const Rom& rom);
+	}
+
+	/* The hashes of a file are cached for as long as its size and modification time stay the same. */
+	struct HashCacheEntry
+	{
+		u64 file_size;
+		s64 modification_time;
+		Hashes hashes;
+	};
+
+	Hashes HashData(std::span<const u8> data, std::stop_token stop_token);
+	void LoadHashCache();
+	std::shared_ptr<Rom> LoadRom(const std::string& path, std::stop_token stop_token, std::string& error);
+	std::optional<Hashes> LookUpHashes(const std::string& path, u64 file_size, s64 modification_time);
+	u32 ReadLittleEndian16(std::span<const u8> data, size_t offset);
+	u32 ReadLittleEndian32(std::span<const u8> data, size_t offset);
+	void SaveHashCache();
+	void SetProgress(Phase phase, u64 num_done_bytes, u64 num_total_bytes);
+	void StoreHashes(const std::string& path, u64 file_size, s64 modification_time, const Hashes& hashes);
+	void StreamHashCacheEntry(SerializationStream& stream, std::string& path, HashCacheEntry& entry);
+	bool UnpackZipEntry(Rom& rom, const ArchiveEntry& entry, std::stop_token stop_token, std::string& error);
+
+	constexpr std::array<u8, 6> seven_zip_signature = { '7', 'z', 0xBC, 0xAF, 0x27, 0x1C };
+
+	constexpr u16 zip_flag_encrypted = 1;
+	constexpr u16 zip_method_stored = 0;
+	constexpr u16 zip_method_deflated = 8;
+	constexpr u32 zip_central_directory_signature = 0x0201'4B50;
+	constexpr u32 zip_end_of_central_directory_signature = 0x0605'4B50;
+	constexpr u32 zip_local_header_signature = 0x0403'4B50;
+	constexpr size_t zip_central_directory_entry_size = 46;
+	constexpr size_t zip_end_of_central_directory_size = 22;
+	constexpr size_t zip_local_header_size = 30;
+	constexpr size_t zip_max_comment_size = 0xFFFF;
+
+	/* Data is hashed in pieces of this size, between which progress is reported and cancellation checked. */
+	constexpr size_t hash_chunk_size = 256 << 10;
+
+	const std::filesystem::path hash_cache_file_path = "rom_hashes.bin";
+	constexpr std::string_view hash_cache_kind = "HASH";
+	constexpr u32 hash_cache_version = 1;
+
+	/* Keyed by path. Touched by the loader thread and the gui thread. */
+	std::mutex hash_cache_mutex;
+	std::unordered_map<std::string, HashCacheEntry> hash_cache;
+	bool hash_cache_is_dirty;
+	bool hash_cache_is_loaded;
+
+	/* At most one rom is loaded in the background at a time; a new load cancels the one in progress. */
+	std::jthread loader_thread;
+	std::mutex completion_mutex;
+	std::optional<Completion> completion;
+
+	std::mutex progress_mutex;
+	std::string progress_path;
+	std::atomic<Phase> progress_phase = Phase::Idle;
+	std::atomic<u64> progress_num_done_bytes;
+	std::atomic<u64> progress_num_total_bytes;
+	thread_local bool reports_progress; /* set on the loader thread only */
+
+	/* Written by 'WriteTemporaryCopy' and not yet deleted. */
+	std::mutex temporary_copies_mutex;
+	std::vector<std::filesystem::path> temporary_copies;
+}
\ No newline at end of file
@@ -0,0 +1,164 @@
+module;
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+module Serialization;
+
+import <cstdio>;
+
+SerializationStream::SerializationStream(SerializationMode mode, const std::filesystem::path& path)
+	: mode(mode), file_path(path), write_buffer(&file_buffer)
+{
+	if (mode == SerializationMode::Read) {
+		error = !mapped_file.Open(path);
+		read_data = mapped_file.Data();
+	}
+	else {
+		file_is_pending_write = true;
+	}
+}
+
+
+SerializationStream::SerializationStream(SerializationMode mode, std::vector<u8>& buffer)
+	: mode(mode), write_buffer(&buffer)
+{
+	if (mode == SerializationMode::Read) {
+		read_data = buffer;
+	}
+}
+
+
+SerializationStream::~SerializationStream()
+{
+	Flush();
+}
+
+
+bool SerializationStream::Flush()
+{
+	/* Writes out a file stream. Does nothing for other streams, or if there has been an error.
+	   The data goes to a temporary file next to the target, which is synced to disk and then renamed over
+	   the target, so that the target is always either the old file or the complete new one. */
+	if (!file_is_pending_write || error) {
+		return !error;
+	}
+	file_is_pending_write = false;
+	std::filesystem::path temp_file_path = file_path;
+	temp_file_path += ".tmp";
+	std::FILE* file = std::fopen(temp_file_path.string().c_str(), "wb");
+	if (!file) {
+		error = true;
+		return false;
+	}
+	bool written = std::fwrite(file_buffer.data(), 1, file_buffer.size(), file) == file_buffer.size()
+		&& std::fflush(file) == 0;
+#ifdef _WIN32
+	written = written && _commit(_fileno(file)) == 0;
+#else
+	written = written && fsync(fileno(file)) == 0;
+#endif
+	written = std::fclose(file) == 0 && written;
+	std::error_code error_code;
+	if (written) {
+		std::filesystem::rename(temp_file_path, file_path, error_code);
+	}
+	if (!written || error_code) {
+		std::filesystem::remove(temp_file_path, error_code);
+		error = true;
+	}
+	return !error;
+}
+
+
+SerializationMode SerializationStream::GetMode() const
+{
+	return mode;
+}
+
+
+u32 SerializationStream::GetVersion() const
+{
+	/* When reading, the version found in the header, which may be older than the current one. */
+	return version;
+}
+
+
+bool SerializationStream::HasError() const
+{
+	return error;
+}
+
+
+std::span<const u8> SerializationStream::ReadView(size_t size)
+{
+	/* Returns the next 'size' bytes without copying them. For file streams, the view points into the
+	   mapping and stays valid for the lifetime of the stream. Read mode only. */
+	if (mode != SerializationMode::Read || error || size > read_data.size() - read_position) {
+		error = true;
+		return {};
+	}
+	std::span<const u8> view = read_data.subspan(read_position, size);
+	read_position += size;
+	return view;
+}
+
+
+void SerializationStream::SetError()
+{
+	/* For errors that the caller finds in what was read, e.g. a size that does not match. */
+	error = true;
+}
+
+
+void SerializationStream::Stream(std::string& string)
+{
+	u64 size = string.size();
+	Stream(size);
+	if (mode == SerializationMode::Read) {
+		std::span<const u8> bytes = ReadView(size_t(size));
+		string.assign(bytes.begin(), bytes.end());
+	}
+	else {
+		StreamBytes({ reinterpret_cast<u8*>(string.data()), string.size() });
+	}
+}
+
+
+void SerializationStream::StreamBytes(std::span<u8> bytes)
+{
+	if (mode == SerializationMode::Read) {
+		if (error || bytes.size() > read_data.size() - read_position) {
+			error = true;
+			std::ranges::fill(bytes, u8(0));
+			return;
+		}
+		std::memcpy(bytes.data(), read_data.data() + read_position, bytes.size());
+		read_position += bytes.size();
+	}
+	else if (!error) {
+		write_buffer->insert(write_buffer->end(), bytes.begin(), bytes.end());
+	}
+}
+
+
+void SerializationStream::StreamHeader(std::string_view kind, u32 version)
+{
+	/* 'kind' is a four-character code for what the stream holds, and 'version' the current version of
+	   its layout. Reading fails if the stream holds something else, or a version newer than 'version'. */
+	std::array<char, 4> stream_magic = magic;
+	std::array<char, 4> stream_kind{};
+	std::copy_n(kind.begin(), std::min(kind.size(), stream_kind.size()), stream_kind.begin());
+	std::array<char, 4> expected_kind = stream_kind;
+	u32 stream_version = version;
+	StreamBytes({ reinterpret_cast<u8*>(stream_magic.data()), stream_magic.size() });
+	StreamBytes({ reinterpret_cast<u8*>(stream_kind.data()), stream_kind.size() });
+	Stream(stream_version);
+	if (mode == SerializationMode::Read
+		&& (stream_magic != magic || stream_kind != expected_kind || stream_version > version)) {
+		error = true;
+	}
+	this->version = stream_version;
+}
\ No newline at end of file
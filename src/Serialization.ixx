@@ -0,0 +1,139 @@
+export module Serialization;
+
+import MappedFile;
+import Types;
+
+import <algorithm>;
+import <array>;
+import <bit>;
+import <cstring>;
+import <filesystem>;
+import <span>;
+import <string>;
+import <string_view>;
+import <type_traits>;
+import <utility>;
+import <vector>;
+
+export enum class SerializationMode {
+	Read, Write
+};
+
+/* A binary stream that reads or writes, depending on its mode, through the same calls, so that a type is
+   serialized by a single function that works both ways. Values are stored little-endian regardless of
+   the host. Spans of values are copied in bulk, which on little-endian hosts is a single memcpy.
+   Backends:
+   - a file. When reading, the file is memory mapped, and every read is a copy out of the mapping. When
+     writing, everything is buffered in memory and written in one go by 'Flush' or the destructor,
+     replacing any existing file atomically.
+   - a contiguous buffer, owned by the caller. Writing appends to it.
+   After an error, reads produce zeroes and writes are ignored, so that callers need only check
+   'HasError' once, at the end. */
+export class SerializationStream
+{
+public:
+	SerializationStream(SerializationMode mode, const std::filesystem::path& path);
+	SerializationStream(SerializationMode mode, std::vector<u8>& buffer);
+	SerializationStream(const SerializationStream&) = delete;
+	SerializationStream& operator=(const SerializationStream&) = delete;
+	~SerializationStream();
+
+	bool Flush();
+	SerializationMode GetMode() const;
+	u32 GetVersion() const;
+	bool HasError() const;
+	std::span<const u8> ReadView(size_t size);
+	void SetError();
+	template<typename T> void Stream(T& value);
+	template<typename T> void Stream(std::span<T> values);
+	void Stream(std::string& string);
+	template<typename T> void Stream(std::vector<T>& values);
+	void StreamBytes(std::span<u8> bytes);
+	void StreamHeader(std::string_view kind, u32 version);
+
+private:
+	/* Every stream starts with this magic number, followed by a four-character code for what the stream
+	   holds and the version of its layout. */
+	static constexpr std::array<char, 4> magic = { 'H', 'U', 'M', 'L' };
+
+	bool error = false;
+	SerializationMode mode;
+	u32 version = 0;
+
+	std::filesystem::path file_path;
+	bool file_is_pending_write = false;
+	MappedFile mapped_file;
+	std::vector<u8> file_buffer;
+
+	std::span<const u8> read_data;
+	size_t read_position = 0;
+	std::vector<u8>* write_buffer;
+};
+
+
+/// Template definitions ////////////////////////////
+template<typename T>
+void SerializationStream::Stream(T& value)
+{
+	if constexpr (std::is_same_v<T, bool>) {
+		u8 byte = value;
+		StreamBytes({ &byte, 1 });
+		value = byte != 0;
+	}
+	else if constexpr (std::is_enum_v<T>) {
+		std::underlying_type_t<T> underlying = std::to_underlying(value);
+		Stream(underlying);
+		value = T(underlying);
+	}
+	else {
+		Stream(std::span<T>{ &value, 1 });
+	}
+}
+
+
+template<typename T>
+void SerializationStream::Stream(std::span<T> values)
+{
+	static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>);
+	if constexpr (std::endian::native == std::endian::little || sizeof(T) == 1) {
+		StreamBytes({ reinterpret_cast<u8*>(values.data()), values.size_bytes() });
+	}
+	else {
+		for (T& value : values) {
+			std::array<u8, sizeof(T)> bytes;
+			if (mode == SerializationMode::Write) {
+				std::memcpy(bytes.data(), &value, sizeof(T));
+				std::ranges::reverse(bytes);
+			}
+			StreamBytes(bytes);
+			if (mode == SerializationMode::Read) {
+				std::ranges::reverse(bytes);
+				std::memcpy(&value, bytes.data(), sizeof(T));
+			}
+		}
+	}
+}
+
+
+template<typename T>
+void SerializationStream::Stream(std::vector<T>& values)
+{
+	u64 size = values.size();
+	Stream(size);
+	if (mode == SerializationMode::Read) {
+		if (error || size > read_data.size() - read_position) {
+			error = true;
+			values.clear();
+			return;
+		}
+		values.resize(size_t(size));
+	}
+	if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+		Stream(std::span<T>{ values });
+	}
+	else {
+		for (T& value : values) {
+			Stream(value);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+module StateStorage;
+
+import Compression;
+import Serialization;
+
+import <filesystem>;
+
+namespace StateStorage
+{
+	std::vector<u8> AcquireBuffer(size_t size)
+	{
+		std::vector<u8> buffer;
+		{
+			std::lock_guard lock{ mutex };
+			if (!buffer_pool.empty()) {
+				buffer = std::move(buffer_pool.back());
+				buffer_pool.pop_back();
+			}
+		}
+		buffer.resize(size);
+		return buffer;
+	}
+
+
+	void IoThreadLoop(std::stop_token stop_token)
+	{
+		while (true) {
+			Job job;
+			{
+				std::unique_lock lock{ mutex };
+				/* Once a stop is requested, the remaining jobs are still done before returning. */
+				if (!job_available.wait(lock, stop_token, [] { return !jobs.empty(); })) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			bool success = Save(job.state, job.path);
+			ReleaseBuffer(std::move(job.state));
+			std::lock_guard lock{ mutex };
+			completions.push_back({ .path = std::move(job.path), .success = success });
+		}
+	}
+
+
+	bool Load(const std::string& path, std::span<u8> state)
+	{
+		/* Fails unless the file holds a state of exactly the size of 'state'. */
+		SerializationStream stream{ SerializationMode::Read, std::filesystem::path(path) };
+		stream.StreamHeader(save_state_kind, save_state_version);
+		CompressionMethod compression_method = CompressionMethod::None;
+		if (stream.GetVersion() >= 2) {
+			stream.Stream(compression_method);
+		}
+		u64 state_size = 0;
+		stream.Stream(state_size);
+		if (stream.HasError() || state_size != state.size()) {
+			return false;
+		}
+		switch (compression_method) {
+		case CompressionMethod::None: {
+			std::span<const u8> stored_state = stream.ReadView(state.size());
+			if (stream.HasError()) {
+				return false;
+			}
+			std::ranges::copy(stored_state, state.begin());
+			return true;
+		}
+
+		case CompressionMethod::Rle: {
+			u64 compressed_size = 0;
+			stream.Stream(compressed_size);
+			std::span<const u8> compressed = stream.ReadView(size_t(compressed_size));
+			return !stream.HasError() && Compression::RleDecompress(compressed, state);
+		}
+
+		default:
+			return false;
+		}
+	}
+
+
+	std::optional<Completion> PollCompletion()
+	{
+		/* Called by the gui to learn about finished saves, without ever waiting for one. */
+		std::lock_guard lock{ mutex };
+		if (completions.empty()) {
+			return std::nullopt;
+		}
+		Completion completion = std::move(completions.front());
+		completions.pop_front();
+		return completion;
+	}
+
+
+	void ReleaseBuffer(std::vector<u8> buffer)
+	{
+		std::lock_guard lock{ mutex };
+		if (buffer_pool.size() < max_pooled_buffers) {
+			buffer_pool.push_back(std::move(buffer));
+		}
+	}
+
+
+	bool Save(std::span<const u8> state, const std::string& path)
+	{
+		/* Runs on the i/o thread. The stream writes to a temporary file, syncs it and renames it over
+		   'path', so that a crash never leaves a half-written state behind. */
+		std::error_code error_code;
+		std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error_code);
+		Compression::RleCompress(state, compressed_state);
+		SerializationStream stream{ SerializationMode::Write, std::filesystem::path(path) };
+		stream.StreamHeader(save_state_kind, save_state_version);
+		CompressionMethod compression_method = CompressionMethod::Rle;
+		stream.Stream(compression_method);
+		u64 state_size = state.size();
+		stream.Stream(state_size);
+		stream.Stream(compressed_state);
+		return stream.Flush();
+	}
+
+
+	void SaveAsync(std::vector<u8> state, std::string path)
+	{
+		/* Takes ownership of 'state', which should come from 'AcquireBuffer', and returns immediately.
+		   The result is reported through 'PollCompletion'. */
+		std::lock_guard lock{ mutex };
+		jobs.push_back({ .state = std::move(state), .path = std::move(path) });
+		if (!io_thread.joinable()) {
+			io_thread = std::jthread{ IoThreadLoop };
+		}
+		job_available.notify_one();
+	}
+
+
+	void Shutdown()
+	{
+		/* Waits for all pending saves to be written. */
+		if (io_thread.joinable()) {
+			io_thread.request_stop();
+			io_thread.join();
+		}
+	}
+}
\ No newline at end of file
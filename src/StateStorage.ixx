@@ -0,0 +1,65 @@
+export module StateStorage;
+
+import Types;
+
+import <condition_variable>;
+import <deque>;
+import <mutex>;
+import <optional>;
+import <span>;
+import <string>;
+import <string_view>;
+import <thread>;
+import <vector>;
+
+namespace StateStorage
+{
+	export
+	{
+		struct Completion
+		{
+			std::string path;
+			bool success;
+		};
+
+		std::vector<u8> AcquireBuffer(size_t size);
+		bool Load(const std::string& path, std::span<u8> state);
+		std::optional<Completion> PollCompletion();
+		void ReleaseBuffer(std::vector<u8> buffer);
+		void SaveAsync(std::vector<u8> state, std::string path);
+		void Shutdown();
+	}
+
+	/* A state waiting to be compressed and written by the i/o thread. */
+	struct Job
+	{
+		std::vector<u8> state;
+		std::string path;
+	};
+
+	void IoThreadLoop(std::stop_token stop_token);
+	bool Save(std::span<const u8> state, const std::string& path);
+
+	/* Save state files: a header, a compression method, the size of the state, and the state itself,
+	   compressed or not. Version 1 files, written before compression was added, lack the method and are
+	   never compressed. */
+	enum class CompressionMethod : u8 {
+		None, Rle
+	};
+
+	constexpr std::string_view save_state_kind = "STAT";
+	constexpr u32 save_state_version = 2;
+	/* Buffers are recycled rather than freed, so that a save state costs the emulation thread no
+	   allocation once a couple have been made. */
+	constexpr size_t max_pooled_buffers = 2;
+
+	std::mutex mutex;
+	std::condition_variable_any job_available;
+	std::deque<Job> jobs;
+	std::deque<Completion> completions;
+	std::vector<std::vector<u8>> buffer_pool;
+
+	std::jthread io_thread;
+
+	std::vector<u8> compressed_state; /* only touched on the i/o thread */
+}
\ No newline at end of file
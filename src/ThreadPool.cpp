@@ -0,0 +1,93 @@
+module ThreadPool;
+
+ThreadPool::ThreadPool(uint num_threads)
+{
+	for (uint i = 1; i < num_threads; ++i) {
+		workers.emplace_back([this](std::stop_token stop_token) { WorkerLoop(stop_token); });
+	}
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	/* Waking the workers is left to the stop tokens, which 'work_available' waits on. */
+	for (std::jthread& worker : workers) {
+		worker.request_stop();
+	}
+	workers.clear();
+}
+
+
+uint ThreadPool::GetNumThreads() const
+{
+	return uint(workers.size()) + 1;
+}
+
+
+void ThreadPool::RunBatch(uint num_tasks, TaskFunction function, void* context)
+{
+	if (num_tasks == 0) {
+		return;
+	}
+	if (workers.empty() || num_tasks == 1) {
+		for (uint i = 0; i < num_tasks; ++i) {
+			function(context, i);
+		}
+		return;
+	}
+	std::lock_guard batch_lock{ batch_mutex };
+	{
+		/* A worker that was late to the previous batch may still be looking for tasks in it. */
+		std::unique_lock lock{ mutex };
+		batch_done.wait(lock, [this] { return num_busy_workers == 0; });
+		this->function = function;
+		this->context = context;
+		this->num_tasks = num_tasks;
+		next_task_index.store(0, std::memory_order_relaxed);
+		num_unfinished_tasks = num_tasks;
+		++generation;
+	}
+	work_available.notify_all();
+	RunTasks();
+	std::unique_lock lock{ mutex };
+	batch_done.wait(lock, [this] { return num_unfinished_tasks == 0; });
+}
+
+
+void ThreadPool::RunTasks()
+{
+	uint num_finished_tasks = 0;
+	for (uint i = next_task_index.fetch_add(1, std::memory_order_relaxed); i < num_tasks;
+		i = next_task_index.fetch_add(1, std::memory_order_relaxed)) {
+		function(context, i);
+		++num_finished_tasks;
+	}
+	if (num_finished_tasks > 0) {
+		std::lock_guard lock{ mutex };
+		num_unfinished_tasks -= num_finished_tasks;
+		if (num_unfinished_tasks == 0) {
+			batch_done.notify_all();
+		}
+	}
+}
+
+
+void ThreadPool::WorkerLoop(std::stop_token stop_token)
+{
+	u64 last_generation = 0;
+	while (true) {
+		{
+			std::unique_lock lock{ mutex };
+			if (!work_available.wait(lock, stop_token, [&] { return generation != last_generation; })) {
+				return;
+			}
+			last_generation = generation;
+			++num_busy_workers;
+		}
+		RunTasks();
+		std::lock_guard lock{ mutex };
+		if (--num_busy_workers == 0) {
+			batch_done.notify_all();
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+export module ThreadPool;
+
+import Types;
+
+import <algorithm>;
+import <atomic>;
+import <condition_variable>;
+import <memory>;
+import <mutex>;
+import <stop_token>;
+import <thread>;
+import <type_traits>;
+import <vector>;
+
+/* A fixed set of worker threads that split a batch of tasks between them. The calling thread takes part
+   in every batch, so a pool of N threads has N - 1 workers. Workers sleep between batches.
+   'ParallelFor' is meant for short, evenly sized tasks, such as bands of an image, and does not
+   allocate; the function it is given is called through a pointer, without being copied. Batches are
+   run one at a time; the pool may be shared between threads, but their batches are serialized. */
+export class ThreadPool
+{
+public:
+	explicit ThreadPool(uint num_threads = std::max(std::thread::hardware_concurrency(), 1u));
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	uint GetNumThreads() const;
+	/* Calls 'function(task_index)' for every task index in [0, num_tasks), and returns once all calls
+	   have returned. */
+	template<typename Function> void ParallelFor(uint num_tasks, Function&& function);
+
+private:
+	using TaskFunction = void(*)(void* context, uint task_index);
+
+	void RunBatch(uint num_tasks, TaskFunction function, void* context);
+	void RunTasks();
+	void WorkerLoop(std::stop_token stop_token);
+
+	std::mutex batch_mutex; /* held by the thread whose batch is running */
+	std::mutex mutex;
+	std::condition_variable_any work_available;
+	std::condition_variable batch_done;
+
+	/* The current batch; only changed while no worker is inside 'RunTasks'. */
+	TaskFunction function = nullptr;
+	void* context = nullptr;
+	uint num_tasks = 0;
+	std::atomic<uint> next_task_index;
+
+	u64 generation = 0; /* incremented for every batch, so that workers can tell a new one from the last */
+	uint num_unfinished_tasks = 0;
+	uint num_busy_workers = 0;
+
+	std::vector<std::jthread> workers;
+};
+
+
+/// Template definitions ////////////////////////////
+template<typename Function>
+void ThreadPool::ParallelFor(uint num_tasks, Function&& function)
+{
+	using FunctionType = std::remove_reference_t<Function>;
+	RunBatch(num_tasks,
+		[](void* context, uint task_index) { (*static_cast<FunctionType*>(context))(task_index); },
+		const_cast<void*>(static_cast<const void*>(std::addressof(function))));
+}
\ No newline at end of file
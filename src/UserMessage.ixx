@@ -3,13 +3,16 @@ export module UserMessage;
 import <SDL.h>;
 
 import <cassert>;
+import <deque>;
 import <format>;
 import <iostream>;
+import <mutex>;
 import <string>;
+import <utility>;
 
 namespace UserMessage
 {
-	SDL_Window* sdl_window; /* Must be set via 'SetWindow' before any messages are shown. */
+	SDL_Window* sdl_window; /* Set via 'SetWindow'. If never set (headless mode), messages are printed to stderr instead. */
 
 	export
 	{
@@ -52,7 +55,48 @@ namespace UserMessage
 
 			std::string out_msg = out_msg_prefix + message;
 
+			if (!sdl_window) {
+				std::cerr << out_msg << '\n';
+				return;
+			}
+
 			SDL_ShowSimpleMessageBox(sdl_msg_type, "Message", out_msg.c_str(), sdl_window);
 		}
 	}
+
+	/* Messages from threads that must not block in a message box, e.g. the emulation thread, waiting to be
+	   shown on the gui thread. */
+	std::mutex posted_messages_mutex;
+	std::deque<std::pair<std::string, Type>> posted_messages;
+
+	export
+	{
+		void Post(std::string message, Type type = Type::Unspecified)
+		{
+			/* May be called on any thread; the message is shown by the next 'ShowPosted'. */
+			if (!sdl_window) {
+				Show(message, type); /* only printed, which does not block */
+				return;
+			}
+			std::lock_guard lock{ posted_messages_mutex };
+			posted_messages.emplace_back(std::move(message), type);
+		}
+
+		void ShowPosted()
+		{
+			/* Called on the gui thread once per frame. */
+			while (true) {
+				std::pair<std::string, Type> posted_message;
+				{
+					std::lock_guard lock{ posted_messages_mutex };
+					if (posted_messages.empty()) {
+						return;
+					}
+					posted_message = std::move(posted_messages.front());
+					posted_messages.pop_front();
+				}
+				Show(posted_message.first, posted_message.second);
+			}
+		}
+	}
 }
\ No newline at end of file
@@ -1,9 +1,43 @@
 module Video;
 
+import Emulator;
+import PixelConversion;
 import UserMessage;
 
 namespace Video
 {
+	bool AcquireNewestFrame()
+	{
+		/* Only swap if the core has published a frame since the last call. Otherwise, we would hand the
+		   front frame back to the shared slot and could end up displaying an older frame. */
+		if (shared_frame_index.load(std::memory_order_relaxed) & new_frame_bit) {
+			front_frame_index = shared_frame_index.exchange(front_frame_index, std::memory_order_acq_rel) & frame_index_mask;
+			return true;
+		}
+		return false;
+	}
+
+
+	uint ComputePitch(uint width)
+	{
+		return (width * GetActiveFramebuffer().bits_per_pixel + 7) / 8;
+	}
+
+
+	void CopyFrame(const u8* source, uint source_pitch, u8* target, uint target_pitch, uint height)
+	{
+		if (source_pitch == target_pitch) {
+			std::memcpy(target, source, size_t(target_pitch) * height);
+		}
+		else {
+			for (uint y = 0; y < height; ++y) {
+				std::memcpy(target + size_t(y) * target_pitch, source + size_t(y) * source_pitch,
+					std::min(source_pitch, target_pitch));
+			}
+		}
+	}
+
+
 	void DisableFullscreen()
 	{
 		// TODO
@@ -24,7 +58,6 @@ namespace Video
 		SDL_GetCurrentDisplayMode(0, &display_mode);
 		window.width = window.game_width = display_mode.w;
 		window.height = window.game_height = display_mode.h;
-		EvaluateWindowProperties();
 	}
 
 
@@ -34,23 +67,87 @@ namespace Video
 	}
 
 
-	void EvaluateWindowProperties()
+	void EvaluateWindowProperties(uint frame_width, uint frame_height)
 	{
-		if (framebuffer.width != 0 && framebuffer.height != 0) {
-			window.scale = std::min(window.game_width / framebuffer.width, window.game_height / framebuffer.height);
+		/* Called on the gui thread, for the frame about to be shown. The core may already be rendering
+		   frames of another size into 'framebuffer', which the gui thread therefore never looks at. */
+		if (frame_width != 0 && frame_height != 0) {
+			window.scale = std::min(window.game_width / frame_width, window.game_height / frame_height);
 		}
 		else {
 			window.scale = 0;
 		}
-		window.game_inner_render_offset_x = (window.game_width - window.scale * framebuffer.width) / 2;
-		window.game_inner_render_offset_y = (window.game_height - window.scale * framebuffer.height) / 2;
-		dstrect.w = window.scale * framebuffer.width;
-		dstrect.h = window.scale * framebuffer.height;
+		window.game_inner_render_offset_x = (window.game_width - window.scale * frame_width) / 2;
+		window.game_inner_render_offset_y = (window.game_height - window.scale * frame_height) / 2;
+		dstrect.w = window.scale * frame_width;
+		dstrect.h = window.scale * frame_height;
 		dstrect.x = window.game_offset_x + window.game_inner_render_offset_x;
 		dstrect.y = window.game_offset_y + window.game_inner_render_offset_y;
 	}
 
 
+	Framebuffer& GetActiveFramebuffer()
+	{
+		return frame_sink ? frame_sink->framebuffer : framebuffer;
+	}
+
+
+	SDL_Rect GetRenderRect()
+	{
+		/* Filtered frames that fit in the game render area, and are at least as large as the integer scaled
+		   frame, are shown pixel for pixel; otherwise they are stretched like unfiltered frames. */
+		if (VideoFilters::IsEnabled() && texture_width <= window.game_width && texture_height <= window.game_height
+			&& int(texture_width) >= dstrect.w && int(texture_height) >= dstrect.h) {
+			return {
+				.x = int(window.game_offset_x + (window.game_width - texture_width) / 2),
+				.y = int(window.game_offset_y + (window.game_height - texture_height) / 2),
+				.w = int(texture_width),
+				.h = int(texture_height)
+			};
+		}
+		return dstrect;
+	}
+
+
+	u8* GetFramebufferPtr()
+	{
+		/* Cores that render straight into this buffer (and into the ones returned by 'NotifyNewGameFrameReady')
+		   avoid the copy made for cores that use 'SetFramebufferPtr'. The buffer is later uploaded to the
+		   texture as-is, so a frame is never copied on the cpu at all. */
+		if (frame_sink) {
+			PrepareSinkFrame();
+			return frame_sink->pixels.data();
+		}
+		PrepareBackFrame();
+		return frames[back_frame_index].pixels.data();
+	}
+
+
+	uint GetTextureFormat(uint frame_pixel_format)
+	{
+		/* 24-bit and 1-bit formats are expanded on upload, in a single pass, to the renderer's native format.
+		   Otherwise, most renderers would convert them again internally. */
+		return PixelConversion::CanConvert(frame_pixel_format) ? native_texture_format : frame_pixel_format;
+	}
+
+
+	u64 HashFrame(u64 hash, std::span<const u8> pixels)
+	{
+		/* Eight bytes at a time. Only meant to tell frames apart, e.g. those of two runs of the same rom. */
+		size_t i = 0;
+		for (; i + 8 <= pixels.size(); i += 8) {
+			u64 word;
+			std::memcpy(&word, pixels.data() + i, sizeof(word));
+			hash = (hash ^ word) * 0x9E37'79B9'7F4A'7C15;
+			hash ^= hash >> 32;
+		}
+		for (; i < pixels.size(); ++i) {
+			hash = (hash ^ pixels[i]) * 0x9E37'79B9'7F4A'7C15;
+		}
+		return hash;
+	}
+
+
 	bool Initialize(SDL_Renderer* renderer, SDL_Window* window)
 	{
 		if (!renderer) {
@@ -63,35 +160,132 @@ namespace Video
 		}
 		Video::sdl_renderer = renderer;
 		Video::sdl_window = window;
+		SDL_RendererInfo renderer_info;
+		if (SDL_GetRendererInfo(renderer, &renderer_info) == 0) {
+			/* The formats are listed in order of preference. */
+			for (Uint32 i = 0; i < renderer_info.num_texture_formats; ++i) {
+				Uint32 format = renderer_info.texture_formats[i];
+				if (format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_ABGR8888) {
+					native_texture_format = format;
+					break;
+				}
+			}
+		}
+		PixelConversion::Initialize();
 		rendering_is_enabled = true;
-		RecreateTexture();
 		return true;
 	}
 
 
-	void NotifyNewGameFrameReady()
+	void InitializeHeadless()
+	{
+		/* Frames are still published to the in-memory triple buffer, so that they can be inspected, but
+		   nothing is ever uploaded or rendered. */
+		sdl_renderer = nullptr;
+		sdl_window = nullptr;
+		rendering_is_enabled = false;
+	}
+
+
+	u8* NotifyNewGameFrameReady()
+	{
+		if (frame_sink) {
+			PublishFrameToSink(frame_sink->framebuffer.external_ptr, frame_sink->framebuffer.pitch);
+			return frame_sink->pixels.data();
+		}
+		PublishFrame(framebuffer.external_ptr, framebuffer.pitch);
+		return frames[back_frame_index].pixels.data();
+	}
+
+
+	void PrepareBackFrame()
+	{
+		/* The back frame is owned by the emulation thread, so it is the only one that can be resized
+		   without synchronization. The other frames are resized once they come around as the back frame. */
+		Frame& back_frame = frames[back_frame_index];
+		size_t size = size_t(framebuffer.pitch) * framebuffer.height;
+		if (back_frame.pixels.size() != size) {
+			back_frame.pixels.resize(size);
+		}
+	}
+
+
+	void PrepareSinkFrame()
+	{
+		const Framebuffer& sink_framebuffer = frame_sink->framebuffer;
+		size_t size = size_t(sink_framebuffer.pitch) * sink_framebuffer.height;
+		if (frame_sink->pixels.size() != size) {
+			frame_sink->pixels.resize(size);
+		}
+	}
+
+
+	void PublishFrame(const u8* source, uint source_pitch)
+	{
+		/* Called on the emulation thread once the core has completed a frame. The frame is either already in
+		   the back frame, or is copied from 'source'. */
+		Profiler::Clock::time_point handoff_start = Profiler::Now();
+		if (core_run_start != Profiler::Clock::time_point{}) {
+			Profiler::Record(Profiler::Stage::CoreRun, core_run_start);
+		}
+
+		if (output_is_suppressed) {
+			/* The frame will never be shown; the core may render the next one over it. */
+			PrepareBackFrame();
+			Emulator::OnNewGameFrame();
+			core_run_start = Profiler::Now();
+			return;
+		}
+
+		PrepareBackFrame();
+		Frame& back_frame = frames[back_frame_index];
+		back_frame.width = framebuffer.width;
+		back_frame.height = framebuffer.height;
+		back_frame.pitch = framebuffer.pitch;
+		back_frame.pixel_format = framebuffer.pixel_format;
+		if (source) {
+			/* The core renders into memory of its own, which it may start overwriting as soon as we return.
+			   Take a copy now, on the emulation thread, rather than letting the gui thread read it later. */
+			CopyFrame(source, source_pitch, back_frame.pixels.data(), back_frame.pitch, back_frame.height);
+		}
+		back_frame_index = shared_frame_index.exchange(back_frame_index | new_frame_bit, std::memory_order_acq_rel) & frame_index_mask;
+		PrepareBackFrame();
+		Profiler::Record(Profiler::Stage::FrameHandoff, handoff_start);
+
+		/* Frame pacing happens in here, and is deliberately not part of any stage. */
+		Emulator::OnNewGameFrame();
+		core_run_start = Profiler::Now();
+	}
+
+
+	void PublishFrameToSink(const u8* source, uint source_pitch)
 	{
-		if (++frame_counter == 60) {
-			auto microsecs_to_render_60_frames = std::chrono::duration_cast<std::chrono::microseconds>(
-				std::chrono::steady_clock::now() - time_now).count();
-			f32 fps = 60.0f * 1'000'000.0f / f32(microsecs_to_render_60_frames);
-			UpdateWindowsFpsLabel(fps);
-			time_now = std::chrono::steady_clock::now();
-			frame_counter = 0;
+		PrepareSinkFrame();
+		const Framebuffer& sink_framebuffer = frame_sink->framebuffer;
+		if (source) {
+			CopyFrame(source, source_pitch, frame_sink->pixels.data(), sink_framebuffer.pitch, sink_framebuffer.height);
 		}
+		frame_sink->frame_hash = HashFrame(frame_sink->frame_hash, frame_sink->pixels);
+		++frame_sink->num_frames;
 	}
 
 
-	void RecreateTexture()
+	void RecreateTexture(uint width, uint height, uint pixel_format)
 	{
 		SDL_DestroyTexture(sdl_texture);
 		sdl_texture = SDL_CreateTexture(
 			sdl_renderer,
-			framebuffer.pixel_format,
+			pixel_format,
 			SDL_TEXTUREACCESS_STREAMING,
-			framebuffer.width,
-			framebuffer.height
+			width,
+			height
 		);
+		texture_width = width;
+		texture_height = height;
+		texture_pixel_format = pixel_format;
+		texture_is_stale = true;
+		/* Frames are opaque. Filters treat all channels alike, and may e.g. darken the alpha channel. */
+		SDL_SetTextureBlendMode(sdl_texture, SDL_BLENDMODE_NONE);
 	}
 
 
@@ -101,31 +295,78 @@ namespace Video
 			return;
 		}
 
-		void* locked_pixels = nullptr;
-		int locked_pixels_pitch;
-		SDL_LockTexture(sdl_texture, nullptr, &locked_pixels, &locked_pixels_pitch);
+		UpdateWindowsFpsLabel();
 
-		SDL_ConvertPixels(
-			framebuffer.width,        /* framebuffer width  */
-			framebuffer.height,       /* framebuffer height */
-			framebuffer.pixel_format, /* source format      */
-			framebuffer.ptr,          /* source             */
-			framebuffer.pitch,        /* source pitch       */
-			framebuffer.pixel_format, /* destination format */
-			locked_pixels,            /* destination        */
-			framebuffer.pitch         /* destination pitch  */
-		);
+		if (AcquireNewestFrame()) {
+			texture_is_stale = true;
+		}
+		const Frame& frame = frames[front_frame_index];
+		if (frame.width == 0 || frame.height == 0) {
+			return; /* no frame has been published yet */
+		}
+		EvaluateWindowProperties(frame.width, frame.height);
+		if (VideoFilters::IsEnabled()) {
+			/* The size of the filtered frame may depend on the size of the game render area. */
+			if (window.game_width != filter_target_width || window.game_height != filter_target_height) {
+				texture_is_stale = true;
+			}
+			if (texture_is_stale) {
+				UploadFilteredFrame();
+			}
+			SDL_Rect render_rect = GetRenderRect();
+			SDL_RenderCopy(sdl_renderer, sdl_texture, nullptr, &render_rect);
+			return;
+		}
+
+		uint texture_format = GetTextureFormat(frame.pixel_format);
+		if (frame.width != texture_width || frame.height != texture_height || texture_format != texture_pixel_format) {
+			RecreateTexture(frame.width, frame.height, texture_format);
+		}
+
+		/* If the texture has the same format as the frame, no conversion is needed, and uploading straight
+		   from the frame saves locking the texture and copying into the locked memory. Otherwise, the frame
+		   is converted straight into the locked memory. When the core has not produced a new frame since the
+		   last upload (paused, or a display refresh rate higher than the core's), the texture already holds it. */
+		if (texture_is_stale) {
+			Profiler::Clock::time_point upload_start = Profiler::Now();
+			if (texture_format == frame.pixel_format) {
+				SDL_UpdateTexture(sdl_texture, nullptr, frame.pixels.data(), frame.pitch);
+			}
+			else {
+				void* texture_pixels;
+				int texture_pitch;
+				if (SDL_LockTexture(sdl_texture, nullptr, &texture_pixels, &texture_pitch) == 0) {
+					PixelConversion::Convert(frame.pixel_format, texture_format, frame.pixels.data(), frame.pitch,
+						static_cast<u8*>(texture_pixels), uint(texture_pitch), frame.width, frame.height);
+					SDL_UnlockTexture(sdl_texture);
+				}
+			}
+			Profiler::Record(Profiler::Stage::PixelUpload, upload_start);
+			texture_is_stale = false;
+		}
 
-		SDL_UnlockTexture(sdl_texture);
 		SDL_RenderCopy(sdl_renderer, sdl_texture, nullptr, &dstrect);
 	}
 
 
+	void ResetCoreRunTimer()
+	{
+		/* Called on the emulation thread when it starts running the core again, e.g. after a pause, so that
+		   the time it spent not running the core is not recorded as part of the next frame. */
+		core_run_start = {};
+	}
+
+
+	void SetFilterChain(std::span<const VideoFilters::Filter> chain)
+	{
+		VideoFilters::SetChain(chain);
+		texture_is_stale = true;
+	}
+
+
 	void SetFramebufferHeight(uint height)
 	{
-		framebuffer.height = height;
-		EvaluateWindowProperties();
-		RecreateTexture();
+		GetActiveFramebuffer().height = height;
 	}
 
 
@@ -135,40 +376,34 @@ namespace Video
 			UserMessage::Show("Fatal: framebuffer pointer was set to null.", UserMessage::Type::Fatal);
 			exit(1);
 		}
-		framebuffer.ptr = ptr;
+		GetActiveFramebuffer().external_ptr = ptr;
 	}
 
 
 	void SetFramebufferSize(uint width, uint height)
 	{
-		framebuffer.width = width;
-		framebuffer.height = height;
-		framebuffer.pitch = width * framebuffer.bytes_per_pixel;
-		EvaluateWindowProperties();
-		RecreateTexture();
+		GetActiveFramebuffer().width = width;
+		GetActiveFramebuffer().height = height;
+		GetActiveFramebuffer().pitch = ComputePitch(width);
 	}
 
 
 	void SetFramebufferWidth(uint width)
 	{
-		framebuffer.width = width;
-		framebuffer.pitch = width * framebuffer.bytes_per_pixel;
-		EvaluateWindowProperties();
-		RecreateTexture();
+		GetActiveFramebuffer().width = width;
+		GetActiveFramebuffer().pitch = ComputePitch(width);
 	}
 
 
 	void SetGameRenderAreaOffsetX(uint offset)
 	{
 		window.game_offset_x = offset;
-		EvaluateWindowProperties();
 	}
 
 
 	void SetGameRenderAreaOffsetY(uint offset)
 	{
 		window.game_offset_y = offset;
-		EvaluateWindowProperties();
 	}
 
 
@@ -176,30 +411,34 @@ namespace Video
 	{
 		window.game_width = width;
 		window.game_height = height;
-		EvaluateWindowProperties();
 	}
 
 
 	void SetPixelFormat(PixelFormat format)
 	{
 		/* This is not ideal, but it's meant to decouple the cores from SDL completely */
+		Framebuffer& framebuffer = GetActiveFramebuffer();
 		framebuffer.pixel_format = [&] {
 			using enum PixelFormat;
 			switch (format) {
 			case ABGR8888:
-				framebuffer.bytes_per_pixel = 4;
+				framebuffer.bits_per_pixel = 32;
 				return SDL_PIXELFORMAT_ABGR8888;
 
+			case INDEX1LSB:
+				framebuffer.bits_per_pixel = 1;
+				return SDL_PIXELFORMAT_INDEX1LSB;
+
 			case BGR888:
-				framebuffer.bytes_per_pixel = 3;
+				framebuffer.bits_per_pixel = 24;
 				return SDL_PIXELFORMAT_BGR24;
 
 			case RGB888:
-				framebuffer.bytes_per_pixel = 3;
+				framebuffer.bits_per_pixel = 24;
 				return SDL_PIXELFORMAT_RGB24;
 
 			case RGBA8888:
-				framebuffer.bytes_per_pixel = 4;
+				framebuffer.bits_per_pixel = 32;
 				return SDL_PIXELFORMAT_RGBA8888;
 
 			default:
@@ -207,8 +446,13 @@ namespace Video
 				return SDL_PIXELFORMAT_RGBA8888;
 			}
 		}();
-		framebuffer.pitch = framebuffer.width * framebuffer.bytes_per_pixel;
-		RecreateTexture();
+		framebuffer.pitch = ComputePitch(framebuffer.width);
+	}
+
+
+	void SetThreadFrameSink(FrameSink* sink)
+	{
+		frame_sink = sink;
 	}
 
 
@@ -216,13 +460,77 @@ namespace Video
 	{
 		window.width = width;
 		window.height = height;
-		EvaluateWindowProperties();
 	}
 
 
-	void UpdateWindowsFpsLabel(f32 new_fps)
+	void SubmitFrame(const u8* pixels, uint width, uint height, uint pitch)
+	{
+		/* For cores that hand back whole frames; see 'FrameOutput'. */
+		const Framebuffer& active_framebuffer = GetActiveFramebuffer();
+		if (width != active_framebuffer.width || height != active_framebuffer.height) {
+			SetFramebufferSize(width, height);
+		}
+		if (frame_sink) {
+			PublishFrameToSink(pixels == frame_sink->pixels.data() ? nullptr : pixels, pitch);
+		}
+		else {
+			PublishFrame(pixels == frames[back_frame_index].pixels.data() ? nullptr : pixels, pitch);
+		}
+	}
+
+
+	void SuppressOutput(bool suppress)
+	{
+		output_is_suppressed = suppress;
+	}
+
+
+	void UploadFilteredFrame()
 	{
-		std::string label = std::format("FPS: {}", new_fps);
+		/* Filters run on 32-bit pixels, in the format of the texture, so that their output can be uploaded
+		   as-is. 32-bit frames are filtered straight from the front frame; others are converted first. */
+		const Frame& frame = frames[front_frame_index];
+		uint texture_format = GetTextureFormat(frame.pixel_format);
+		Profiler::Clock::time_point filter_start = Profiler::Now();
+		VideoFilters::Image input;
+		if (texture_format == frame.pixel_format) {
+			input = { reinterpret_cast<const u32*>(frame.pixels.data()), frame.width, frame.height, frame.pitch / 4 };
+		}
+		else {
+			filter_input.resize(size_t(frame.width) * frame.height);
+			PixelConversion::Convert(frame.pixel_format, texture_format, frame.pixels.data(), frame.pitch,
+				reinterpret_cast<u8*>(filter_input.data()), frame.width * 4, frame.width, frame.height);
+			input = { filter_input.data(), frame.width, frame.height, frame.width };
+		}
+		VideoFilters::Image output = VideoFilters::Apply(input, window.game_width, window.game_height);
+		filter_target_width = window.game_width;
+		filter_target_height = window.game_height;
+		Profiler::Record(Profiler::Stage::VideoFilter, filter_start);
+
+		Profiler::Clock::time_point upload_start = Profiler::Now();
+		if (output.width != texture_width || output.height != texture_height || texture_format != texture_pixel_format) {
+			RecreateTexture(output.width, output.height, texture_format);
+		}
+		SDL_UpdateTexture(sdl_texture, nullptr, output.pixels, int(output.pitch * sizeof(u32)));
+		Profiler::Record(Profiler::Stage::PixelUpload, upload_start);
+		texture_is_stale = false;
+	}
+
+
+	void UpdateWindowsFpsLabel()
+	{
+		/* Updated from the gui thread about once a second, from the number of frames the core has completed
+		   in the meantime. Window functions are not safe to call from the emulation thread. */
+		auto now = std::chrono::steady_clock::now();
+		auto elapsed = now - fps_label_time;
+		if (elapsed < std::chrono::seconds(1)) {
+			return;
+		}
+		u64 frame_count = Emulator::GetFrameCount();
+		f32 fps = f32(frame_count - fps_label_frame_count) / std::chrono::duration<f32>(elapsed).count();
+		std::string label = std::format("FPS: {:.1f}", fps);
 		SDL_SetWindowTitle(sdl_window, label.data());
+		fps_label_frame_count = frame_count;
+		fps_label_time = now;
 	}
 }
\ No newline at end of file
@@ -1,13 +1,20 @@
 export module Video;
 
+import Profiler;
 import Types;
+import VideoFilters;
 
 import <SDL.h>;
 
 import <algorithm>;
+import <array>;
+import <atomic>;
 import <cassert>;
 import <chrono>;
+import <cstring>;
 import <format>;
+import <span>;
+import <vector>;
 
 namespace Video
 {
@@ -21,13 +28,36 @@ namespace Video
 			RGBA8888,
 		};
 
+		struct Framebuffer
+		{
+			u8* external_ptr; /* set by cores that render into their own memory through 'SetFramebufferPtr' */
+			uint width, height, pitch;
+			uint bits_per_pixel;
+			uint pixel_format;
+		};
+
+		/* Takes the frames of a core that does not run on the emulation thread, e.g. one of several run side
+		   by side by 'Headless::RunBatch'. While a sink is set for a thread, the frames of the core that runs
+		   on it go to the sink, where they are counted and hashed, and are never shown. */
+		struct FrameSink
+		{
+			Framebuffer framebuffer;
+			std::vector<u8> pixels;
+			u64 num_frames;
+			u64 frame_hash; /* of every frame so far, in order */
+		};
+
 		void DisableFullscreen();
 		void DisableRendering();
 		void EnableFullscreen();
 		void EnableRendering();
+		u8* GetFramebufferPtr();
 		bool Initialize(SDL_Renderer* renderer, SDL_Window* window);
-		void NotifyNewGameFrameReady();
+		void InitializeHeadless();
+		u8* NotifyNewGameFrameReady();
 		void RenderGame();
+		void ResetCoreRunTimer();
+		void SetFilterChain(std::span<const VideoFilters::Filter> chain);
 		void SetFramebufferHeight(uint height);
 		void SetFramebufferPtr(u8* ptr);
 		void SetFramebufferSize(uint width, uint height);
@@ -36,20 +66,52 @@ namespace Video
 		void SetGameRenderAreaOffsetX(uint offset);
 		void SetGameRenderAreaOffsetY(uint offset);
 		void SetGameRenderAreaSize(uint width, uint height);
+		void SetThreadFrameSink(FrameSink* sink);
 		void SetWindowSize(uint width, uint height);
+		void SubmitFrame(const u8* pixels, uint width, uint height, uint pitch);
+		void SuppressOutput(bool suppress);
 	}
 
-	void EvaluateWindowProperties();
-	void RecreateTexture();
-	void UpdateWindowsFpsLabel(f32 new_fps);
+	bool AcquireNewestFrame();
+	uint ComputePitch(uint width);
+	void CopyFrame(const u8* source, uint source_pitch, u8* target, uint target_pitch, uint height);
+	void EvaluateWindowProperties(uint frame_width, uint frame_height);
+	Framebuffer& GetActiveFramebuffer();
+	SDL_Rect GetRenderRect();
+	uint GetTextureFormat(uint frame_pixel_format);
+	u64 HashFrame(u64 hash, std::span<const u8> pixels);
+	void PrepareBackFrame();
+	void PrepareSinkFrame();
+	void PublishFrame(const u8* source, uint source_pitch);
+	void PublishFrameToSink(const u8* source, uint source_pitch);
+	void RecreateTexture(uint width, uint height, uint pixel_format);
+	void UploadFilteredFrame();
+	void UpdateWindowsFpsLabel();
+
+	Framebuffer framebuffer;
+
+	thread_local FrameSink* frame_sink;
 
-	struct Framebuffer
+	/* A complete game frame, along with the format it was rendered in. The format is stored per frame
+	   so that the gui thread never has to look at 'framebuffer', which the core may change at any time. */
+	struct Frame
 	{
-		u8* ptr;
+		std::vector<u8> pixels;
 		uint width, height, pitch;
-		uint bytes_per_pixel;
 		uint pixel_format;
-	} framebuffer;
+	};
+
+	/* Triple buffering of game frames. The back frame is owned by the emulation thread, the front frame by
+	   the gui thread. 'PublishFrame' swaps the back frame with the shared one and sets the
+	   'new frame' bit; 'RenderGame' swaps the front frame with the shared one only if that bit is set.
+	   Both swaps are single atomic exchanges, so neither thread ever waits for the other. */
+	constexpr uint frame_index_mask = 3;
+	constexpr uint new_frame_bit = 4;
+
+	std::array<Frame, 3> frames;
+	std::atomic<uint> shared_frame_index = 1;
+	uint back_frame_index = 0;
+	uint front_frame_index = 2;
 
 	struct Window
 	{
@@ -60,14 +122,28 @@ namespace Video
 		uint scale; /* scale of game render area in relation to the base core resolution. */
 	} window;
 
+	bool output_is_suppressed; /* frames are not published, e.g. while running ahead; only touched on the emulation thread */
 	bool rendering_is_enabled;
+	bool texture_is_stale; /* true if 'sdl_texture' does not hold the current front frame */
 
-	uint frame_counter;
+	u64 fps_label_frame_count; /* 'Emulator::GetFrameCount' at the last fps label update */
 
 	SDL_Rect dstrect;
 	SDL_Renderer* sdl_renderer;
 	SDL_Texture* sdl_texture;
 	SDL_Window* sdl_window;
 
-	std::chrono::time_point time_now = std::chrono::steady_clock::now();
+	uint texture_width, texture_height; /* dimensions and format that 'sdl_texture' was created with */
+	uint texture_pixel_format;
+	/* The 32-bit format that the renderer takes without converting it again, and that frames in formats
+	   it would otherwise convert are converted to; see 'GetTextureFormat'. */
+	uint native_texture_format = SDL_PIXELFORMAT_ARGB8888;
+
+	/* Frames that are not in a 32-bit format are converted into this buffer before they are filtered. */
+	std::vector<u32> filter_input;
+	uint filter_target_width, filter_target_height; /* the game render area that the texture was last filtered for */
+
+	std::chrono::steady_clock::time_point fps_label_time = std::chrono::steady_clock::now();
+
+	Profiler::Clock::time_point core_run_start; /* when the emulation thread returned to the core after the last frame */
 }
\ No newline at end of file
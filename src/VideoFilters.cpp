@@ -0,0 +1,393 @@
+module;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HUMLA_X86 1
+#include <emmintrin.h>
+#else
+#define HUMLA_X86 0
+#endif
+
+module VideoFilters;
+
+namespace VideoFilters
+{
+	Image Apply(const Image& input, uint target_width, uint target_height)
+	{
+		if (!thread_pool) {
+			thread_pool = std::make_unique<ThreadPool>();
+		}
+		Image image = input;
+		size_t num_applied_stages = 0;
+		for (size_t i = 0; i < chain.size() && image.width > 0 && image.height > 0; ++i) {
+			/* The input of this stage is either 'input' or the output of the last stage that was applied,
+			   which is in the other buffer, so resizing this one leaves it alone. A stage that is skipped
+			   must not count, or the next one would write over its own input. */
+			std::vector<u32>& output = stage_outputs[num_applied_stages % 2];
+			switch (chain[i]) {
+			case Filter::CrtScanlines: {
+				uint scale = std::max(std::min(target_width / image.width, target_height / image.height), 2u);
+				output.resize(size_t(image.width) * scale * image.height * scale);
+				ForEachBand(image.height, [&](uint row_begin, uint row_end) {
+					CrtScanlinesBand(image, output.data(), scale, row_begin, row_end);
+				});
+				image = { output.data(), image.width * scale, image.height * scale, image.width * scale };
+				break;
+			}
+
+			case Filter::Scale2x: {
+				Image source = PadSource(image);
+				output.resize(size_t(image.width) * image.height * 4);
+				ForEachBand(image.height, [&](uint row_begin, uint row_end) {
+					Scale2xBand(source, output.data(), row_begin, row_end);
+				});
+				image = { output.data(), image.width * 2, image.height * 2, image.width * 2 };
+				break;
+			}
+
+			case Filter::Scale3x: {
+				Image source = PadSource(image);
+				output.resize(size_t(image.width) * image.height * 9);
+				ForEachBand(image.height, [&](uint row_begin, uint row_end) {
+					Scale3xBand(source, output.data(), row_begin, row_end);
+				});
+				image = { output.data(), image.width * 3, image.height * 3, image.width * 3 };
+				break;
+			}
+
+			case Filter::SharpBilinear: {
+				if (target_width == 0 || target_height == 0) {
+					continue;
+				}
+				/* Separably: first every source row is scaled horizontally, then the target rows are blended
+				   from those. At scales above 2, most target rows fall inside a single source row, and are copies. */
+				UpdateSharpBilinearTables(image, target_width, target_height);
+				uint output_width = uint(sharp_bilinear_columns.size());
+				uint output_height = uint(sharp_bilinear_rows.size());
+				sharp_bilinear_scaled_rows.resize(size_t(output_width) * image.height);
+				Image scaled_rows = { sharp_bilinear_scaled_rows.data(), output_width, image.height, output_width };
+				ForEachBand(image.height, [&](uint row_begin, uint row_end) {
+					SharpBilinearColumnsBand(image, sharp_bilinear_scaled_rows.data(), output_width, row_begin, row_end);
+				});
+				output.resize(size_t(output_width) * output_height);
+				ForEachBand(output_height, [&](uint row_begin, uint row_end) {
+					SharpBilinearRowsBand(scaled_rows, output.data(), row_begin, row_end);
+				});
+				image = { output.data(), output_width, output_height, output_width };
+				break;
+			}
+
+			case Filter::Xbr: {
+				Image source = PadSource(image);
+				output.resize(size_t(image.width) * image.height * 4);
+				ForEachBand(image.height, [&](uint row_begin, uint row_end) {
+					XbrBand(source, output.data(), row_begin, row_end);
+				});
+				image = { output.data(), image.width * 2, image.height * 2, image.width * 2 };
+				break;
+			}
+			}
+			++num_applied_stages;
+		}
+		return image;
+	}
+
+
+	void CrtScanlinesBand(const Image& source, u32* target, uint scale, uint row_begin, uint row_end)
+	{
+		/* Every source row becomes 'scale' target rows, of which roughly the last third is darkened. The first
+		   target row is scaled from the source; the others are copies of it. */
+		uint target_width = source.width * scale;
+		uint num_dark_rows = std::max(scale / 3, 1u);
+		for (uint y = row_begin; y < row_end; ++y) {
+			const u32* source_row = source.pixels + size_t(y) * source.pitch;
+			u32* first_row = target + size_t(y) * scale * target_width;
+			for (uint x = 0, target_x = 0; x < source.width; ++x) {
+				for (uint i = 0; i < scale; ++i) {
+					first_row[target_x++] = source_row[x];
+				}
+			}
+			for (uint i = 1; i < scale - num_dark_rows; ++i) {
+				std::copy_n(first_row, target_width, first_row + size_t(i) * target_width);
+			}
+			for (uint i = scale - num_dark_rows; i < scale; ++i) {
+				u32* row = first_row + size_t(i) * target_width;
+				for (uint x = 0; x < target_width; ++x) {
+					/* Two channels at a time; the products of 8-bit channels and weights of up to 256 fit in 16 bits. */
+					u32 pixel = first_row[x];
+					row[x] = ((pixel & 0x00FF'00FF) * scanline_brightness >> 8 & 0x00FF'00FF)
+						| ((pixel >> 8 & 0x00FF'00FF) * scanline_brightness & 0xFF00'FF00);
+				}
+			}
+		}
+	}
+
+
+	u32 Difference(u32 a, u32 b)
+	{
+#if HUMLA_X86
+		return u32(_mm_cvtsi128_si32(_mm_sad_epu8(_mm_cvtsi32_si128(int(a)), _mm_cvtsi32_si128(int(b)))));
+#else
+		u32 difference = 0;
+		for (uint shift = 0; shift < 32; shift += 8) {
+			difference += std::abs(int(a >> shift & 0xFF) - int(b >> shift & 0xFF));
+		}
+		return difference;
+#endif
+	}
+
+
+	std::span<const Filter> GetChain()
+	{
+		return chain;
+	}
+
+
+	bool IsEnabled()
+	{
+		return !chain.empty();
+	}
+
+
+	u32 Lerp(u32 a, u32 b, uint weight)
+	{
+		/* 'weight' is that of 'b', out of 256. Two channels at a time, as in 'CrtScanlinesBand'. */
+		uint a_weight = 256 - weight;
+		return (((a & 0x00FF'00FF) * a_weight + (b & 0x00FF'00FF) * weight) >> 8 & 0x00FF'00FF)
+			| (((a >> 8 & 0x00FF'00FF) * a_weight + (b >> 8 & 0x00FF'00FF) * weight) & 0xFF00'FF00);
+	}
+
+
+	Image PadSource(const Image& source)
+	{
+		/* Integer scalers look at the neighbours of every pixel. Replicating the edges up front saves them
+		   from checking for the edges, and lets the inner loops be vectorized. */
+		uint pitch = source.width + 2 * source_padding;
+		padded_source.resize(size_t(pitch) * (source.height + 2 * source_padding));
+		ForEachBand(source.height + 2 * source_padding, [&](uint row_begin, uint row_end) {
+			for (uint y = row_begin; y < row_end; ++y) {
+				uint source_y = std::clamp(int(y) - int(source_padding), 0, int(source.height) - 1);
+				const u32* source_row = source.pixels + size_t(source_y) * source.pitch;
+				u32* row = padded_source.data() + size_t(y) * pitch;
+				std::fill_n(row, source_padding, source_row[0]);
+				std::copy_n(source_row, source.width, row + source_padding);
+				std::fill_n(row + source_padding + source.width, source_padding, source_row[source.width - 1]);
+			}
+		});
+		return { padded_source.data() + size_t(source_padding) * pitch + source_padding, source.width, source.height, pitch };
+	}
+
+
+	void Scale2xBand(const Image& source, u32* target, uint row_begin, uint row_end)
+	{
+		/* AdvMAME2x. With B, D, F and H the pixels above, left of, right of and below pixel E, each of the four
+		   target pixels of E takes the color of the two source pixels next to it if they are equal, unless
+		   the pixels on both axes through E are equal (in which case E is part of a line, not an edge). */
+		uint target_pitch = 2 * source.width;
+		for (uint y = row_begin; y < row_end; ++y) {
+			const u32* row = source.pixels + size_t(y) * source.pitch;
+			u32* target_0 = target + size_t(2 * y) * target_pitch;
+			u32* target_1 = target_0 + target_pitch;
+			uint x = 0;
+#if HUMLA_X86
+			/* Four source pixels per iteration; SSE2 is always available on x64. */
+			auto select = [](__m128i mask, __m128i if_set, __m128i if_clear) {
+				return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+			};
+			for (; x + 4 <= source.width; x += 4) {
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - source.pitch));
+				__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+				__m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+				__m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+				__m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + source.pitch));
+				__m128i is_not_edge = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+				__m128i e0 = select(_mm_andnot_si128(is_not_edge, _mm_cmpeq_epi32(d, b)), d, e);
+				__m128i e1 = select(_mm_andnot_si128(is_not_edge, _mm_cmpeq_epi32(b, f)), f, e);
+				__m128i e2 = select(_mm_andnot_si128(is_not_edge, _mm_cmpeq_epi32(d, h)), d, e);
+				__m128i e3 = select(_mm_andnot_si128(is_not_edge, _mm_cmpeq_epi32(h, f)), f, e);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target_0 + 2 * x), _mm_unpacklo_epi32(e0, e1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target_0 + 2 * x + 4), _mm_unpackhi_epi32(e0, e1));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target_1 + 2 * x), _mm_unpacklo_epi32(e2, e3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(target_1 + 2 * x + 4), _mm_unpackhi_epi32(e2, e3));
+			}
+#endif
+			Scale2xRowScalar(row, source.pitch, target_0, target_1, x, source.width);
+		}
+	}
+
+
+	void Scale2xRowScalar(const u32* source, uint source_pitch, u32* target_0, u32* target_1, uint x_begin, uint x_end)
+	{
+		for (uint x = x_begin; x < x_end; ++x) {
+			const u32* pixel = source + x;
+			u32 b = *(pixel - source_pitch), d = pixel[-1], e = pixel[0], f = pixel[1], h = pixel[source_pitch];
+			bool is_edge = b != h && d != f;
+			target_0[2 * x] = is_edge && d == b ? d : e;
+			target_0[2 * x + 1] = is_edge && b == f ? f : e;
+			target_1[2 * x] = is_edge && d == h ? d : e;
+			target_1[2 * x + 1] = is_edge && h == f ? f : e;
+		}
+	}
+
+
+	void Scale3xBand(const Image& source, u32* target, uint row_begin, uint row_end)
+	{
+		/* AdvMAME3x. Source pixels are named A to I, row by row, with E at the center. */
+		uint target_pitch = 3 * source.width;
+		for (uint y = row_begin; y < row_end; ++y) {
+			const u32* above = source.pixels + size_t(y) * source.pitch - source.pitch;
+			const u32* row = above + source.pitch;
+			const u32* below = row + source.pitch;
+			u32* target_0 = target + size_t(3 * y) * target_pitch;
+			u32* target_1 = target_0 + target_pitch;
+			u32* target_2 = target_1 + target_pitch;
+			for (uint x = 0; x < source.width; ++x) {
+				const u32* top = above + x;
+				const u32* middle = row + x;
+				const u32* bottom = below + x;
+				u32 a = top[-1], b = top[0], c = top[1];
+				u32 d = middle[-1], e = middle[0], f = middle[1];
+				u32 g = bottom[-1], h = bottom[0], i = bottom[1];
+				u32* t0 = target_0 + 3 * x;
+				u32* t1 = target_1 + 3 * x;
+				u32* t2 = target_2 + 3 * x;
+				if (b != h && d != f) {
+					t0[0] = d == b ? d : e;
+					t0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+					t0[2] = b == f ? f : e;
+					t1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+					t1[1] = e;
+					t1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+					t2[0] = d == h ? d : e;
+					t2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+					t2[2] = h == f ? f : e;
+				}
+				else {
+					t0[0] = t0[1] = t0[2] = t1[0] = t1[1] = t1[2] = t2[0] = t2[1] = t2[2] = e;
+				}
+			}
+		}
+	}
+
+
+	void SetChain(std::span<const Filter> new_chain)
+	{
+		chain.assign(new_chain.begin(), new_chain.end());
+	}
+
+
+	void SharpBilinearColumnsBand(const Image& source, u32* target, uint target_width, uint row_begin, uint row_end)
+	{
+		for (uint y = row_begin; y < row_end; ++y) {
+			const u32* source_row = source.pixels + size_t(y) * source.pitch;
+			u32* target_row = target + size_t(y) * target_width;
+			for (uint x = 0; x < target_width; ++x) {
+				Tap tap = sharp_bilinear_columns[x];
+				target_row[x] = Lerp(source_row[tap.index_0], source_row[tap.index_1], tap.weight);
+			}
+		}
+	}
+
+
+	void SharpBilinearRowsBand(const Image& source, u32* target, uint row_begin, uint row_end)
+	{
+		for (uint y = row_begin; y < row_end; ++y) {
+			Tap tap = sharp_bilinear_rows[y];
+			const u32* row_0 = source.pixels + size_t(tap.index_0) * source.pitch;
+			const u32* row_1 = source.pixels + size_t(tap.index_1) * source.pitch;
+			u32* target_row = target + size_t(y) * source.width;
+			if (tap.weight == 0 || tap.weight == 256) {
+				std::copy_n(tap.weight == 0 ? row_0 : row_1, source.width, target_row);
+			}
+			else {
+				for (uint x = 0; x < source.width; ++x) {
+					target_row[x] = Lerp(row_0[x], row_1[x], tap.weight);
+				}
+			}
+		}
+	}
+
+
+	void UpdateSharpBilinearTables(const Image& source, uint target_width, uint target_height)
+	{
+		if (source.width == sharp_bilinear_source_width && source.height == sharp_bilinear_source_height
+			&& target_width == sharp_bilinear_target_width && target_height == sharp_bilinear_target_height) {
+			return;
+		}
+		sharp_bilinear_source_width = source.width;
+		sharp_bilinear_source_height = source.height;
+		sharp_bilinear_target_width = target_width;
+		sharp_bilinear_target_height = target_height;
+
+		/* The output keeps the aspect ratio of the source, and is as large as fits in the target. Every source
+		   pixel is drawn as a block of its own color, as with nearest neighbour scaling; only the outermost
+		   half target pixel of every block is blended with its neighbour, which hides the uneven block sizes
+		   of a non-integer scale without blurring the image. */
+		f64 scale = std::min(f64(target_width) / source.width, f64(target_height) / source.height);
+		auto make_taps = [scale](std::vector<Tap>& taps, uint source_size) {
+			uint target_size = std::max(uint(std::lround(source_size * scale)), 1u);
+			f64 axis_scale = f64(target_size) / source_size;
+			f64 block_half_width = std::max(0.5 - 0.5 / axis_scale, 0.0);
+			taps.resize(target_size);
+			for (uint i = 0; i < target_size; ++i) {
+				f64 texel = (i + 0.5) / axis_scale;
+				f64 texel_index = std::floor(texel);
+				f64 distance_from_center = texel - texel_index - 0.5;
+				f64 offset = (distance_from_center - std::clamp(distance_from_center, -block_half_width, block_half_width))
+					* axis_scale + 0.5;
+				/* Bilinear filtering between the centers of the source pixels around 'texel_index + offset'. */
+				f64 position = texel_index + offset - 0.5;
+				f64 position_index = std::floor(position);
+				int index = int(position_index);
+				taps[i] = {
+					.index_0 = uint(std::clamp(index, 0, int(source_size) - 1)),
+					.index_1 = uint(std::clamp(index + 1, 0, int(source_size) - 1)),
+					.weight = uint(std::lround((position - position_index) * 256))
+				};
+			}
+		};
+		make_taps(sharp_bilinear_columns, source.width);
+		make_taps(sharp_bilinear_rows, source.height);
+	}
+
+
+	u32 XbrCorner(Neighbourhood n)
+	{
+		/* xBR level 1, written for the bottom right corner. Pixels are named as in the reference:
+		            A1 B1 C1
+		         A0 A  B  C  C4
+		         D0 D  E  F  F4
+		         G0 G  H  I  I4
+		            G5 H5 I5
+		   If the color differences along the edge through F and H are smaller than those across it, the
+		   corner is blended with whichever of F and H is closer to E. */
+		u32 e = n(0, 0), f = n(1, 0), h = n(0, 1);
+		if (e == f || e == h) {
+			return e; /* the corner would be blended with E itself; this is the case for most of any image */
+		}
+		u32 b = n(0, -1), c = n(1, -1), d = n(-1, 0), f4 = n(2, 0);
+		u32 g = n(-1, 1), i = n(1, 1), i4 = n(2, 1), h5 = n(0, 2), i5 = n(1, 2);
+		u32 along_edge = Difference(e, c) + Difference(e, g) + Difference(i, f4) + Difference(i, h5) + 4 * Difference(h, f);
+		u32 across_edge = Difference(h, d) + Difference(h, i5) + Difference(f, i4) + Difference(f, b) + 4 * Difference(e, i);
+		if (along_edge < across_edge) {
+			return Lerp(e, Difference(e, f) <= Difference(e, h) ? f : h, 128);
+		}
+		return e;
+	}
+
+
+	void XbrBand(const Image& source, u32* target, uint row_begin, uint row_end)
+	{
+		int pitch = int(source.pitch);
+		uint target_pitch = 2 * source.width;
+		for (uint y = row_begin; y < row_end; ++y) {
+			const u32* row = source.pixels + size_t(y) * source.pitch;
+			u32* target_0 = target + size_t(2 * y) * target_pitch;
+			u32* target_1 = target_0 + target_pitch;
+			for (uint x = 0; x < source.width; ++x) {
+				target_0[2 * x] = XbrCorner({ row + x, -1, -pitch });
+				target_0[2 * x + 1] = XbrCorner({ row + x, 1, -pitch });
+				target_1[2 * x] = XbrCorner({ row + x, -1, pitch });
+				target_1[2 * x + 1] = XbrCorner({ row + x, 1, pitch });
+			}
+		}
+	}
+}
\ No newline at end of file
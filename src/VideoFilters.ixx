@@ -0,0 +1,105 @@
+export module VideoFilters;
+
+import ThreadPool;
+import Types;
+
+import <algorithm>;
+import <array>;
+import <cmath>;
+import <cstdlib>;
+import <memory>;
+import <span>;
+import <vector>;
+
+namespace VideoFilters
+{
+	export
+	{
+		enum class Filter {
+			CrtScanlines,
+			Scale2x,
+			Scale3x,
+			SharpBilinear,
+			Xbr,
+		};
+
+		/* An image of 32-bit pixels. The filters treat all four channels alike, so any channel order works. */
+		struct Image
+		{
+			const u32* pixels;
+			uint width, height;
+			uint pitch; /* in pixels */
+		};
+
+		/* Runs 'input' through the filter chain. The result stays valid until the next call. 'target_width'
+		   and 'target_height' are the size of the area that the result will be shown in; filters whose
+		   output size is not fixed by their input size fit their output to it. */
+		Image Apply(const Image& input, uint target_width, uint target_height);
+		std::span<const Filter> GetChain();
+		bool IsEnabled();
+		void SetChain(std::span<const Filter> chain);
+	}
+
+	/* A pixel together with its neighbours, read from an image padded with 'source_padding' replicated
+	   pixels on every side. 'dx' and 'dy' mirror the neighbourhood, so that a rule written for one corner
+	   of the output pixel can be applied to all four. */
+	struct Neighbourhood
+	{
+		const u32* center;
+		int dx, dy;
+		u32 operator()(int x, int y) const { return center[x * dx + y * dy]; }
+	};
+
+	/* The '...Band' functions filter the source rows in [row_begin, row_end), or the target rows for the
+	   sharp bilinear rows pass. They are called in parallel, on bands of rows. */
+	void CrtScanlinesBand(const Image& source, u32* target, uint scale, uint row_begin, uint row_end);
+	u32 Difference(u32 a, u32 b);
+	template<typename Function> void ForEachBand(uint num_rows, Function&& function);
+	u32 Lerp(u32 a, u32 b, uint weight);
+	Image PadSource(const Image& source);
+	void Scale2xBand(const Image& source, u32* target, uint row_begin, uint row_end);
+	void Scale2xRowScalar(const u32* source, uint source_pitch, u32* target_0, u32* target_1, uint x_begin, uint x_end);
+	void Scale3xBand(const Image& source, u32* target, uint row_begin, uint row_end);
+	void SharpBilinearColumnsBand(const Image& source, u32* target, uint target_width, uint row_begin, uint row_end);
+	void SharpBilinearRowsBand(const Image& source, u32* target, uint row_begin, uint row_end);
+	void UpdateSharpBilinearTables(const Image& source, uint target_width, uint target_height);
+	u32 XbrCorner(Neighbourhood n);
+	void XbrBand(const Image& source, u32* target, uint row_begin, uint row_end);
+
+	/* Integer scalers read up to two pixels past the edges of their source. */
+	constexpr uint source_padding = 2;
+	/* Bands per thread; more bands than threads evens out threads that get descheduled. */
+	constexpr uint bands_per_thread = 4;
+	/* Brightness of the dark line at the bottom of every scaled source row, out of 256. */
+	constexpr uint scanline_brightness = 112;
+
+	/* For every target column or row of the sharp bilinear filter: the two source columns or rows that it
+	   lies between, and the weight of the second one, out of 256. */
+	struct Tap
+	{
+		uint index_0, index_1;
+		uint weight;
+	};
+
+	std::vector<Filter> chain;
+
+	/* Stages alternate between the two outputs; every output is the input of the next stage. */
+	std::array<std::vector<u32>, 2> stage_outputs;
+	std::vector<u32> padded_source;
+	std::vector<Tap> sharp_bilinear_columns, sharp_bilinear_rows;
+	std::vector<u32> sharp_bilinear_scaled_rows; /* the source rows, scaled horizontally */
+	uint sharp_bilinear_source_width, sharp_bilinear_source_height; /* the sizes that the tables were made for */
+	uint sharp_bilinear_target_width, sharp_bilinear_target_height;
+
+	std::unique_ptr<ThreadPool> thread_pool; /* created on first use */
+
+	/// Template definitions ////////////////////////////
+	template<typename Function>
+	void ForEachBand(uint num_rows, Function&& function)
+	{
+		uint num_bands = std::min(num_rows, thread_pool->GetNumThreads() * bands_per_thread);
+		thread_pool->ParallelFor(num_bands, [&](uint band_index) {
+			function(uint(u64(num_rows) * band_index / num_bands), uint(u64(num_rows) * (band_index + 1) / num_bands));
+		});
+	}
+}
\ No newline at end of file